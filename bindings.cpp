@@ -1,9 +1,15 @@
 // Copyright © 2024 Yury Popov (@djphoenix).
 
 #include <nanobind/nanobind.h>
+#include <nanobind/stl/optional.h>
+#include <nanobind/stl/shared_ptr.h>
+#include <nanobind/stl/string.h>
+#include <nanobind/stl/tuple.h>
 #include <nanobind/stl/variant.h>
+#include <nanobind/stl/vector.h>
 
 #include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_lm.h"
 
 namespace nb = nanobind;
 using namespace nb::literals;
@@ -22,6 +28,15 @@ NB_MODULE(_ext, m) {
         "target_lengths"_a,
         nb::kw_only(),
         "blank"_a = int(0),
+        "reduction"_a = "none",
+        "zero_infinity"_a = false,
+        "batch_first"_a = false,
+        "need_grad"_a = nb::none(),
+        "checkpoint_interval"_a = int(0),
+        "memory_budget"_a = size_t(0),
+        "alpha_dtype"_a = nb::none(),
+        "max_deviation"_a = int(0),
+        "linear_space"_a = false,
         "stream"_a = nb::none(),
         R"(
         The Connectionist Temporal Classification loss
@@ -34,9 +49,10 @@ NB_MODULE(_ext, m) {
         Args:
             log_probs (array):
                 The logarithmized probabilities of the outputs (e.g. obtained with `mlx::core::log_softmax`)
-                of size `(T, N, C)`, where
+                of size `(T, N, C)` (or `(N, T, C)` with `batch_first`), where
                 `T = input length`, `N = batch size`, and
-                `C = number of classes` (including blank)
+                `C = number of classes` (including blank).
+                Any strides are accepted, so transposed views are consumed without copying.
 
             targets (array):
                 Target sequences of size `(N, S)`, where
@@ -58,8 +74,544 @@ NB_MODULE(_ext, m) {
             blank (int):
                 blank label. Default `0`.
 
+            reduction (str):
+                Reduction of per-sample losses: `'none'`, `'sum'`, or `'mean'`
+                (losses are divided by target lengths and then averaged over batch). Default `'none'`.
+
+            zero_infinity (bool):
+                Zero infinite losses (impossible alignments) and their gradients. Default `False`.
+
+            batch_first (bool):
+                `log_probs` (and its gradient) are `(N, T, C)`. Default `False`.
+
+            need_grad (bool, optional):
+                Keep full alpha lattice for gradient computation.
+                With `False`, only two rolling rows of alpha are kept per sequence, and gradient is not available.
+                Default `None` keeps lattice only when called under function transformation (e.g. `value_and_grad`).
+
+            checkpoint_interval (int):
+                Store alpha only every `checkpoint_interval` time steps, recomputing segments in backward pass (CPU only).
+                `0` stores every step (unless `memory_budget` is set), negative value picks `sqrt(T)`
+                for `O(sqrt(T))` memory. Default `0`.
+
+            memory_budget (int):
+                Budget in bytes for stored alpha, used to derive checkpoint interval when `checkpoint_interval` is `0`.
+                Default `0` (no limit).
+
+            alpha_dtype (Dtype, optional):
+                Storage type of alpha lattice: `float32` or type of `log_probs`.
+                Recurrences always accumulate in `float32`, loss and gradient are returned in type of `log_probs`.
+                Default `None` is `float32`.
+
+            max_deviation (int):
+                Approximate loss of very long inputs: only alignments deviating at most `max_deviation` labels
+                from the uniform one are summed, so every frame costs `O(max_deviation)` instead of `O(S)`.
+                Loss is never below the exact one. Default `0` computes exact loss.
+
+            linear_space (bool):
+                Run recurrences on probabilities rescaled every frame instead of log-probabilities (CPU only),
+                trading `logaddexp` of every cell for a few multiplications. Sequences whose lattice rows span
+                more than `float32` range fall back to log space. Default `False`.
+
+        Returns:
+            array: `(N)`, where `N = batch size`, or scalar when reduced
+        )"
+    );
+
+    m.def(
+        "ctc_loss_from_logits",
+        &ctc_loss_from_logits,
+        "logits"_a,
+        "targets"_a,
+        "input_lengths"_a,
+        "target_lengths"_a,
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "reduction"_a = "none",
+        "zero_infinity"_a = false,
+        "batch_first"_a = false,
+        "need_grad"_a = nb::none(),
+        "checkpoint_interval"_a = int(0),
+        "memory_budget"_a = size_t(0),
+        "alpha_dtype"_a = nb::none(),
+        "max_deviation"_a = int(0),
+        "linear_space"_a = false,
+        "stream"_a = nb::none(),
+        R"(
+        The Connectionist Temporal Classification loss of unnormalized outputs
+
+        Same as `ctc_loss(log_softmax(logits, 2), ...)`, with log-softmax fused into the loss kernels:
+        frame normalizers are computed along with alpha recurrence, and gradient with respect to `logits`
+        is produced directly, so neither log-probabilities nor their gradient are materialized.
+
+        Args:
+            logits (array):
+                Unnormalized outputs of size `(T, N, C)` (or `(N, T, C)` with `batch_first`), where
+                `T = input length`, `N = batch size`, and
+                `C = number of classes` (including blank).
+
+            Other arguments are the same as for `ctc_loss`.
+
+        Returns:
+            array: `(N)`, where `N = batch size`, or scalar when reduced
+        )"
+    );
+
+    m.def(
+        "ctc_greedy_decode",
+        [](const array& log_probs, const array& input_lengths, uint64_t blank, bool batch_first, StreamOrDevice s) {
+          auto out = ctc_greedy_decode(log_probs, input_lengths, blank, batch_first, s);
+          return std::make_tuple(out[0], out[1]);
+        },
+        "log_probs"_a,
+        "input_lengths"_a,
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "batch_first"_a = false,
+        "stream"_a = nb::none(),
+        R"(
+        Greedy (best path) CTC decoding
+
+        Takes the most probable class of every frame, then collapses repeated classes and removes blanks.
+
+        Args:
+            log_probs (array):
+                The logarithmized probabilities (or logits) of the outputs of size `(T, N, C)`
+                (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+
+            input_lengths (array):
+                Lengths of the inputs of size `(N)`, where `N = batch size` (must each be <= `T`).
+
+            blank (int):
+                blank label. Default `0`.
+
+            batch_first (bool):
+                `log_probs` are `(N, T, C)`. Default `False`.
+
+        Returns:
+            tuple(array, array): `int32` labels of size `(N, T)` padded with `blank`,
+            and `int32` numbers of decoded labels of size `(N)`
+        )"
+    );
+
+    m.def(
+        "ctc_beam_search_decode",
+        [](
+          const array& log_probs, const array& input_lengths, uint64_t blank, int beam_width, int top_k, int num_best, bool batch_first,
+          std::shared_ptr<ctc::NGramModel> lm, const std::vector<std::string>& alphabet, int word_delimiter, float lm_weight, float word_bonus,
+          StreamOrDevice s
+        ) {
+          auto out = ctc_beam_search_decode(
+            log_probs, input_lengths, blank, beam_width, top_k, num_best, batch_first,
+            lm, alphabet, word_delimiter, lm_weight, word_bonus, s
+          );
+          return std::make_tuple(out[0], out[1], out[2]);
+        },
+        "log_probs"_a,
+        "input_lengths"_a,
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "beam_width"_a = int(8),
+        "top_k"_a = int(0),
+        "num_best"_a = int(1),
+        "batch_first"_a = false,
+        "lm"_a = nb::none(),
+        "alphabet"_a = std::vector<std::string>(),
+        "word_delimiter"_a = int(-1),
+        "lm_weight"_a = 0.5f,
+        "word_bonus"_a = 0.f,
+        "stream"_a = nb::none(),
+        R"(
+        CTC prefix beam search decoding (CPU only)
+
+        Keeps `beam_width` most probable label prefixes after every frame, merging alignments which collapse
+        to the same prefix. Batch items are decoded in parallel.
+
+        Args:
+            log_probs (array):
+                The logarithmized probabilities of the outputs of size `(T, N, C)`
+                (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+
+            input_lengths (array):
+                Lengths of the inputs of size `(N)`, where `N = batch size` (must each be <= `T`).
+
+            blank (int):
+                blank label. Default `0`.
+
+            beam_width (int):
+                Number of prefixes kept after every frame. Default `8`.
+
+            top_k (int):
+                Only `top_k` most probable classes of every frame extend prefixes, `0` for all classes. Default `0`.
+
+            num_best (int):
+                Number of returned hypotheses, at most `beam_width`. Default `1`.
+
+            batch_first (bool):
+                `log_probs` are `(N, T, C)`. Default `False`.
+
+            lm (NGramModel, optional):
+                Word n-gram model fused into prefix scores. Default `None`.
+
+            alphabet (list[str]):
+                String of every class, used to form words for `lm`.
+
+            word_delimiter (int):
+                Class completing words for `lm` (e.g. space).
+
+            lm_weight (float):
+                Weight of LM log-probability of every completed word. Default `0.5`.
+
+            word_bonus (float):
+                Score added for every completed word. Default `0`.
+
+        Returns:
+            tuple(array, array, array): `int32` labels of size `(N, num_best, T)` padded with `blank`,
+            `int32` numbers of labels of size `(N, num_best)`, and `float32` log-probabilities
+            of size `(N, num_best)` including fused LM score, best first (`-inf` for missing hypotheses)
+        )"
+    );
+
+    m.def(
+        "ctc_forced_align",
+        [](const array& log_probs, const array& targets, const array& input_lengths, const array& target_lengths, uint64_t blank, bool batch_first, StreamOrDevice s) {
+          auto out = ctc_forced_align(log_probs, targets, input_lengths, target_lengths, blank, batch_first, s);
+          return std::make_tuple(out[0], out[1], out[2]);
+        },
+        "log_probs"_a,
+        "targets"_a,
+        "input_lengths"_a,
+        "target_lengths"_a,
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "batch_first"_a = false,
+        "stream"_a = nb::none(),
+        R"(
+        CTC forced alignment (CPU only)
+
+        Finds the most probable alignment of every target (Viterbi path over the same lattice as `ctc_loss`).
+
+        Args:
+            log_probs (array):
+                The logarithmized probabilities of the outputs of size `(T, N, C)`
+                (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+
+            targets (array):
+                Target sequences of size `(N, S)`.
+
+            input_lengths (array):
+                Lengths of the inputs of size `(N)` (must each be <= `T`).
+
+            target_lengths (array):
+                Lengths of the targets of size `(N)` (must each be <= `S`).
+
+            blank (int):
+                blank label. Default `0`.
+
+            batch_first (bool):
+                `log_probs` are `(N, T, C)`. Default `False`.
+
+        Returns:
+            tuple(array, array, array): `int32` class of every frame of size `(N, T)` (`blank` on blank
+            and padding frames), `int32` `[start, end)` frames of every target label of size `(N, S, 2)`
+            (`-1` on padding), and `float32` log-probabilities of best paths of size `(N)`
+            (`-inf` when alignment is impossible)
+        )"
+    );
+
+    m.def(
+        "ctc_posteriors",
+        [](const array& log_probs, const array& targets, const array& input_lengths, const array& target_lengths, uint64_t blank, int top_k, bool batch_first, StreamOrDevice s) -> nb::object {
+          auto out = ctc_posteriors(log_probs, targets, input_lengths, target_lengths, blank, top_k, batch_first, s);
+          if (top_k == 0) return nb::cast(out[0]);
+          return nb::cast(std::make_tuple(out[0], out[1]));
+        },
+        "log_probs"_a,
+        "targets"_a,
+        "input_lengths"_a,
+        "target_lengths"_a,
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "top_k"_a = int(0),
+        "batch_first"_a = false,
+        "stream"_a = nb::none(),
+        R"(
+        CTC state occupancy collapsed onto classes (CPU only)
+
+        Posterior probability of every class on every frame over all alignments of the target
+        (the term subtracted from `softmax` in gradient of `ctc_loss`), computed without a backward pass.
+        Every valid frame sums to `1`, padding frames and impossible alignments are all zeros.
+
+        Args:
+            log_probs (array):
+                The logarithmized probabilities of the outputs of size `(T, N, C)`
+                (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+
+            targets (array):
+                Target sequences of size `(N, S)`.
+
+            input_lengths (array):
+                Lengths of the inputs of size `(N)` (must each be <= `T`).
+
+            target_lengths (array):
+                Lengths of the targets of size `(N)` (must each be <= `S`).
+
+            blank (int):
+                blank label. Default `0`.
+
+            top_k (int):
+                Return only `top_k` most occupied classes of every frame, in descending order. Default `0` (dense).
+
+            batch_first (bool):
+                `log_probs` (and outputs) are `(N, T, C)`. Default `False`.
+
+        Returns:
+            array: `float32` posteriors of size `(T, N, C)` when `top_k` is `0`, or
+            tuple(array, array): `float32` posteriors and `int32` classes of size `(T, N, top_k)`
+            (padded with zero posteriors of blank)
+        )"
+    );
+
+    m.def(
+        "ctc_loss_chunk",
+        [](const array& log_probs, const array& targets, const array& chunk_lengths, const array& target_lengths, const std::optional<array>& state, uint64_t blank, bool batch_first, StreamOrDevice s) {
+          auto out = ctc_loss_chunk(log_probs, targets, chunk_lengths, target_lengths, state, blank, batch_first, s);
+          return std::make_tuple(out[0], out[1]);
+        },
+        "log_probs"_a,
+        "targets"_a,
+        "chunk_lengths"_a,
+        "target_lengths"_a,
+        "state"_a = nb::none(),
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "batch_first"_a = false,
+        "stream"_a = nb::none(),
+        R"(
+        Chunk of streaming CTC forward pass (CPU only)
+
+        Advances alpha rows of every sequence over a chunk of frames, so inputs of any length are consumed
+        with memory bounded by chunk size. Chaining chunks gives the same loss as `ctc_loss` of whole input.
+
+        Gradient flows back through states of chained chunks. It is the exact derivative with respect to
+        log-probabilities, which matches gradient of `ctc_loss` with respect to logits of `log_softmax`.
+
+        Args:
+            log_probs (array):
+                The logarithmized probabilities of chunk frames of size `(Tc, N, C)`
+                (or `(N, Tc, C)` with `batch_first`). Any strides are accepted.
+
+            targets (array):
+                Target sequences of size `(N, S)`, the same for every chunk.
+
+            chunk_lengths (array):
+                Numbers of chunk frames belonging to every sequence of size `(N)` (must each be <= `Tc`),
+                e.g. `mx.clip(input_lengths - t0, 0, Tc)`. Sequences with `0` frames keep their state.
+
+            target_lengths (array):
+                Lengths of the targets of size `(N)` (must each be <= `S`).
+
+            state (array, optional):
+                `float32` alpha row of size `(N, 2S+2)` returned for previous chunk. Default `None` (start of input).
+
+            blank (int):
+                blank label. Default `0`.
+
+            batch_first (bool):
+                `log_probs` are `(N, Tc, C)`. Default `False`.
+
+        Returns:
+            tuple(array, array): `float32` alpha row after the chunk of size `(N, 2S+2)`, and `float32`
+            negative log-likelihood of targets given frames consumed so far of size `(N)`
+        )"
+    );
+
+    m.def(
+        "rnnt_loss",
+        &rnnt_loss,
+        "logits"_a,
+        "targets"_a,
+        "logit_lengths"_a,
+        "target_lengths"_a,
+        nb::kw_only(),
+        "blank"_a = int(0),
+        "reduction"_a = "none",
+        "fused_log_softmax"_a = true,
+        "stream"_a = nb::none(),
+        R"(
+        The RNN-Transducer loss (CPU only)
+
+        Sums probability of all monotonic alignments of `T` frames to `U` target labels over `(T, U+1)` lattice,
+        where every node emits either blank (advancing frame) or next label (advancing target).
+
+        With `fused_log_softmax`, log-softmax is computed on the fly and gradient is computed with respect to
+        `logits` directly, without materializing log-probabilities or their gradient. When `logits` buffer
+        is not used elsewhere, gradient is written over it.
+
+        Args:
+            logits (array):
+                Joint network outputs of size `(N, T, U+1, C)`, where `N = batch size`, `T = max input length`,
+                `U = max target length` and `C = number of classes` (including blank): logits with
+                `fused_log_softmax`, log-probabilities otherwise. Any strides are accepted.
+
+            targets (array):
+                Target sequences of size `(N, U)`, padded to the length of the longest sequence.
+
+            logit_lengths (array):
+                Lengths of the inputs of size `(N)` (must each be in `[1, T]`).
+
+            target_lengths (array):
+                Lengths of the targets of size `(N)` (must each be <= `U`).
+
+            blank (int):
+                blank label. Default `0`.
+
+            reduction (str):
+                Reduction of per-sample losses: `"none"`, `"sum"` or `"mean"` (divided by batch size only).
+                Default `"none"`.
+
+            fused_log_softmax (bool):
+                `logits` are unnormalized, log-softmax is fused into loss and gradient. Default `True`.
+
+        Returns:
+            array: loss of size `(N)`, or scalar when reduced
+        )"
+    );
+
+    nb::class_<ctc::NGramModel>(
+        m,
+        "NGramModel",
+        R"(
+        Word n-gram language model in binary format, memory-mapped from file
+
+        Mapped pages are shared by processes opening the same file.
+        )"
+    )
+        .def(
+            nb::init<const std::string&>(),
+            "path"_a,
+            "Open binary model built by `NGramModel.build`."
+        )
+        .def_static(
+            "build",
+            &ctc::NGramModel::build,
+            "arpa_path"_a,
+            "output_path"_a,
+            "quant_bits"_a = int(8),
+            R"(
+            Build binary model from ARPA file
+
+            Args:
+                arpa_path (str):
+                    Path of ARPA model.
+
+                output_path (str):
+                    Path of binary model.
+
+                quant_bits (int):
+                    Bits per quantized log-probability and backoff (1..16). Default `8`.
+            )"
+        )
+        .def_prop_ro("order", &ctc::NGramModel::order, "Order of the model")
+        .def_prop_ro("vocab_size", &ctc::NGramModel::vocab_size, "Number of words")
+        .def(
+            "score",
+            [](const ctc::NGramModel& lm, const std::vector<std::string>& context, const std::string& word) {
+                std::vector<uint32_t> ids;
+                for (auto& w : context) ids.push_back(lm.word(w));
+                return lm.score(ids.data(), ids.size(), lm.word(word));
+            },
+            "context"_a,
+            "word"_a,
+            R"(
+            Log10-probability of `word` after `context` words (oldest first), with backoff
+
+            Returns:
+                float: log10-probability
+            )"
+        );
+
+    m.def(
+        "set_num_threads",
+        &ctc_set_num_threads,
+        "num_threads"_a,
+        R"(
+        Set number of threads used by the CPU implementation
+
+        Batch items are distributed across threads (or label positions of long targets, for batches smaller
+        than thread count), so results are identical for any thread count.
+
+        Args:
+            num_threads (int):
+                Number of threads. `0` resets to the number of hardware threads (default).
+        )"
+    );
+
+    m.def(
+        "get_num_threads",
+        &ctc_get_num_threads,
+        R"(
+        Number of threads used by the CPU implementation
+
         Returns:
-            array: `(N)`, where `N = batch size`
+            int: number of threads
+        )"
+    );
+
+    m.def(
+        "set_stats_enabled",
+        &ctc_set_stats_enabled,
+        "enabled"_a,
+        R"(
+        Enable or disable collection of CTC loss counters (disabled by default)
+
+        Raises when instrumentation is not compiled in (`MLX_CTC_STATS` CMake option).
+
+        Args:
+            enabled (bool):
+                Collect counters of `ctc_loss` forward and backward evaluations.
+        )"
+    );
+
+    m.def(
+        "get_stats",
+        []() {
+          auto st = ctc_get_stats();
+          nb::dict d;
+          d["forward_calls"]   = st.forward_calls;
+          d["backward_calls"]  = st.backward_calls;
+          d["alloc_ns"]        = st.alloc_ns;
+          d["alpha_ns"]        = st.alpha_ns;
+          d["final_ns"]        = st.final_ns;
+          d["beta_ns"]         = st.beta_ns;
+          d["vjp_final_ns"]    = st.vjp_final_ns;
+          d["bytes_allocated"] = st.bytes_allocated;
+          d["valid_cells"]     = st.valid_cells;
+          d["padded_cells"]    = st.padded_cells;
+          d["linear_fallbacks"] = st.linear_fallbacks;
+          return d;
+        },
+        R"(
+        CTC loss counters collected since last reset
+
+        Phase times are in nanoseconds, measured by the CPU implementation and summed over worker threads:
+        `alloc` of outputs, `alpha` recurrence (with recomputation between checkpoints), `final` loss reduction,
+        `beta` sweep (beta recurrence with occupancy and gradient rows, which alternate every frame) and `vjp_final`
+        (gradient of padding frames).
+        GPU evaluations count calls and allocated bytes only. Cells are positions of `(T, N, 2S+1)` lattice
+        within (valid) or outside (padded) sequence lengths. Linear fallbacks count passes of sequences
+        recomputed in log space by `linear_space` loss.
+
+        Returns:
+            dict: counters by name
+        )"
+    );
+
+    m.def(
+        "reset_stats",
+        &ctc_reset_stats,
+        R"(
+        Reset all CTC loss counters to zero
         )"
     );
 }
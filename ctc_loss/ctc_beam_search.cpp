@@ -0,0 +1,413 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_beam_search.h"
+#include "ctc_loss/thread_pool.h"
+
+namespace mlx::core {
+
+namespace stdlib = std;
+#include "ctc_loss/ctc_logmath.h"
+
+#define assert_contiguous(a) \
+  if (a.ndim() > 0 && a.strides()[a.ndim()-1] != 1) throw std::runtime_error(#a " should be contiguous on last dimension")
+
+namespace ctc {
+
+static constexpr float kNegInf = -std::numeric_limits<float>::infinity();
+static constexpr float kLn10 = 2.30258509299404568f; // LM scores are log10
+
+static inline size_t slot_hash(uint64_t key, size_t mask) {
+  return size_t((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static inline size_t table_size(size_t num_items) {
+  size_t size = 64;
+  while (size < num_items * 2) size *= 2;
+  return size;
+}
+
+// Next generation stamp, slots are cleared only when stamp wraps around
+template <typename S>
+static inline uint32_t next_stamp(std::vector<S>& slots, uint32_t stamp) {
+  if (++stamp != 0) return stamp;
+  for (auto& s : slots) s.stamp = 0;
+  return 1;
+}
+
+static inline uint64_t make_key(uint32_t parent, int32_t label) {
+  return (uint64_t(parent) << 32) | uint32_t(label);
+}
+
+void PrefixBeamSearch::reset(size_t beam_width, size_t top_k, size_t num_channels, size_t blank, const LMFusion* lm) {
+  beam_width_ = beam_width;
+  num_channels_ = num_channels;
+  blank_ = blank;
+
+  frame_.resize(num_channels);
+  classes_.clear();
+  for (size_t c = 0; c < num_channels; c++) {
+    if (c != blank) classes_.push_back(int32_t(c));
+  }
+  top_k_ = (top_k > 0 && top_k < classes_.size()) ? top_k : 0;
+  num_classes_ = top_k_ ? top_k_ : classes_.size();
+
+  nodes_.clear();
+  nodes_.push_back({ kNoNode, -1, 0 });
+  if (children_.empty()) children_.resize(table_size(1024));
+  children_stamp_ = next_stamp(children_, children_stamp_);
+
+  // Every beam produces at most one candidate per class, plus its own prefix
+  size_t max_next = beam_width * (num_classes_ + 1);
+  if (next_slots_.size() < table_size(max_next)) next_slots_.assign(table_size(max_next), { 0, 0, 0 });
+  next_.reserve(max_next);
+  beams_.reserve(max_next);
+
+  lm_ = lm;
+  node_lm_.clear();
+  lm_states_.clear();
+  if (lm_) {
+    // Root context is sentence start
+    size_t stride = lm_->model->order();
+    lm_states_.resize(stride, 0);
+    if (lm_->model->bos() != NGramModel::kNoWord && stride > 1) {
+      lm_states_[0] = 1;
+      lm_states_[1] = lm_->model->bos();
+    }
+    node_lm_.push_back({ 0.f, 0, 0, 0, NAN, 0 });
+  }
+
+  beams_.clear();
+  beams_.push_back({ key(0), 0, 0.f, kNegInf, 0.f, 0.f });
+}
+
+// Appends context `state` extended by `word` (dropping oldest word), returns its offset
+uint32_t PrefixBeamSearch::push_state(uint32_t state, uint32_t word) {
+  size_t stride = lm_->model->order();
+  uint32_t next = uint32_t(lm_states_.size());
+  lm_states_.resize(next + stride, 0);
+  if (stride == 1) return next;
+  uint32_t size = lm_states_[state];
+  const uint32_t* words = &lm_states_[state + 1];
+  uint32_t* out = &lm_states_[next + 1];
+  if (word == NGramModel::kNoWord) return next; // Unknown word without `<unk>` breaks context
+  size_t keep = std::min<size_t>(size, stride - 2);
+  std::copy(words + size - keep, words + size, out);
+  out[keep] = word;
+  lm_states_[next] = uint32_t(keep + 1);
+  return next;
+}
+
+// Fused score of completing current word of `node`, cached per node
+float PrefixBeamSearch::word_score(uint32_t node) {
+  auto& nl = node_lm_[node];
+  if (!std::isnan(nl.word_score)) return nl.word_score;
+  if (nl.word_begin == node) {
+    // Empty word (consecutive delimiters)
+    nl.word_score = 0.f;
+    nl.word_state = nl.state;
+    return 0.f;
+  }
+
+  word_.clear();
+  for (uint32_t n = node; n != nl.word_begin; n = nodes_[n].parent) {
+    const auto& s = lm_->alphabet[nodes_[n].label];
+    word_.insert(word_.begin(), s.begin(), s.end());
+  }
+  const auto& model = *lm_->model;
+  uint32_t word = model.word(nl.word_hash, word_.data(), word_.size());
+  float lp = model.score(lm_states_.data() + nl.state + 1, lm_states_[nl.state], word);
+  uint32_t state = push_state(nl.state, word);
+
+  auto& nw = node_lm_[node];
+  nw.word_score = lm_->weight * lp * kLn10 + lm_->bonus;
+  nw.word_state = state;
+  return nw.word_score;
+}
+
+void PrefixBeamSearch::add_lm_node(uint32_t node) {
+  uint32_t parent = nodes_[node].parent;
+  size_t label = size_t(nodes_[node].label);
+  if (label == lm_->delimiter) {
+    float score = node_lm_[parent].score + word_score(parent);
+    node_lm_.push_back({ score, node_lm_[parent].word_state, node, 0, NAN, 0 });
+  } else {
+    const auto& p = node_lm_[parent];
+    node_lm_.push_back({ p.score, p.state, p.word_begin, lm_->extend(p.word_hash, label), NAN, 0 });
+  }
+}
+
+uint64_t PrefixBeamSearch::key(uint32_t node) const {
+  return make_key(nodes_[node].parent, nodes_[node].label);
+}
+
+void PrefixBeamSearch::grow_children() {
+  children_.assign(children_.size() * 2, { 0, 0, 0 });
+  children_stamp_ = next_stamp(children_, children_stamp_);
+  size_t mask = children_.size() - 1;
+  for (uint32_t n = 1; n < nodes_.size(); n++) {
+    uint64_t k = key(n);
+    size_t i = slot_hash(k, mask);
+    while (children_[i].stamp == children_stamp_) i = (i + 1) & mask;
+    children_[i] = { k, n, children_stamp_ };
+  }
+}
+
+// Finds or creates trie node of non-root prefix
+uint32_t PrefixBeamSearch::child(uint64_t key) {
+  if (nodes_.size() * 2 >= children_.size()) grow_children();
+  size_t mask = children_.size() - 1;
+  for (size_t i = slot_hash(key, mask);; i = (i + 1) & mask) {
+    auto& slot = children_[i];
+    if (slot.stamp != children_stamp_) {
+      uint32_t node = uint32_t(nodes_.size());
+      uint32_t parent = uint32_t(key >> 32);
+      nodes_.push_back({ parent, int32_t(uint32_t(key)), nodes_[parent].length + 1 });
+      slot = { key, node, children_stamp_ };
+      if (lm_) add_lm_node(node);
+      return node;
+    }
+    if (slot.key == key) return slot.value;
+  }
+}
+
+PrefixBeamSearch::Beam& PrefixBeamSearch::next_beam(uint64_t key) {
+  size_t mask = next_slots_.size() - 1;
+  for (size_t i = slot_hash(key, mask);; i = (i + 1) & mask) {
+    auto& slot = next_slots_[i];
+    if (slot.stamp != next_stamp_) {
+      slot = { key, uint32_t(next_.size()), next_stamp_ };
+      next_.push_back({ key, kNoNode, kNegInf, kNegInf, 0.f, kNegInf });
+      return next_.back();
+    }
+    if (slot.key == key) return next_[slot.value];
+  }
+}
+
+// Moves `top_k_` most probable non-blank classes of current frame to the front of `classes_`
+void PrefixBeamSearch::select_classes() {
+  if (!top_k_) return;
+  const float* logp = frame_.data();
+  std::nth_element(classes_.begin(), classes_.begin() + top_k_, classes_.end(), [logp](int32_t a, int32_t b) {
+    return logp[a] > logp[b] || (logp[a] == logp[b] && a < b);
+  });
+}
+
+void PrefixBeamSearch::step() {
+  const float* logp = frame_.data();
+  select_classes();
+
+  next_.clear();
+  next_stamp_ = next_stamp(next_slots_, next_stamp_);
+
+  float lp_blank = logp[blank_];
+  for (const auto& beam : beams_) {
+    float total = logaddexp(beam.p_b, beam.p_nb);
+    int32_t last = nodes_[beam.node].label;
+
+    // LM score changes only when a word is completed by delimiter
+    float lm_same = 0.f, lm_word = 0.f;
+    int32_t delimiter = -1;
+    if (lm_) {
+      lm_same = node_lm_[beam.node].score;
+      lm_word = lm_same + word_score(beam.node);
+      delimiter = int32_t(lm_->delimiter);
+    }
+
+    // Blank keeps prefix
+    auto& same = next_beam(beam.key);
+    same.node = beam.node;
+    same.lm = lm_same;
+    same.p_b = logaddexp(same.p_b, total + lp_blank);
+
+    // Repeated last label collapses into the same prefix
+    if (last >= 0) same.p_nb = logaddexp(same.p_nb, beam.p_nb + logp[last]);
+
+    for (size_t i = 0; i < num_classes_; i++) {
+      int32_t c = classes_[i];
+      // Repeated label extends prefix only when separated by blank
+      float p = ((c == last) ? beam.p_b : total) + logp[c];
+      if (p == kNegInf) continue;
+      auto& ext = next_beam(make_key(beam.node, c));
+      ext.lm = (c == delimiter) ? lm_word : lm_same;
+      ext.p_nb = logaddexp(ext.p_nb, p);
+    }
+  }
+
+  // Candidates which can not be extended further are dropped together with pruned ones
+  size_t num_next = 0;
+  for (auto& beam : next_) {
+    beam.score = logaddexp(beam.p_b, beam.p_nb) + beam.lm;
+    if (beam.score != kNegInf) next_[num_next++] = beam;
+  }
+  next_.resize(num_next);
+
+  // Ties are broken by key, which does not depend on order of candidates
+  if (next_.size() > beam_width_) {
+    std::nth_element(next_.begin(), next_.begin() + beam_width_, next_.end(), [](const Beam& a, const Beam& b) {
+      return a.score > b.score || (a.score == b.score && a.key < b.key);
+    });
+    next_.resize(beam_width_);
+  }
+  for (auto& beam : next_) {
+    if (beam.node == kNoNode) beam.node = child(beam.key);
+  }
+  std::swap(beams_, next_);
+}
+
+size_t PrefixBeamSearch::finalize() {
+  if (lm_) {
+    // Last word is completed by end of sentence
+    const auto& model = *lm_->model;
+    for (auto& beam : beams_) {
+      float score = node_lm_[beam.node].score + word_score(beam.node);
+      if (model.eos() != NGramModel::kNoWord) {
+        uint32_t state = node_lm_[beam.node].word_state;
+        score += lm_->weight * model.score(lm_states_.data() + state + 1, lm_states_[state], model.eos()) * kLn10;
+      }
+      beam.score = logaddexp(beam.p_b, beam.p_nb) + score;
+    }
+  }
+  std::sort(beams_.begin(), beams_.end(), [](const Beam& a, const Beam& b) {
+    return a.score > b.score || (a.score == b.score && a.key < b.key);
+  });
+  return beams_.size();
+}
+
+float PrefixBeamSearch::score(size_t i) const {
+  return beams_[i].score;
+}
+
+size_t PrefixBeamSearch::labels(size_t i, int32_t* out) const {
+  uint32_t node = beams_[i].node;
+  size_t length = nodes_[node].length;
+  for (size_t k = length; k > 0; k--) {
+    out[k - 1] = nodes_[node].label;
+    node = nodes_[node].parent;
+  }
+  return length;
+}
+
+} // namespace ctc
+
+template <typename T, typename I>
+static void ctc_beam_search_impl(
+  const array& log_probs,
+  const array& input_lengths,
+  uint64_t blank,
+  size_t beam_width,
+  size_t top_k,
+  size_t num_best,
+  bool batch_first,
+  const ctc::LMFusion* lm,
+  array& labels,
+  array& lengths,
+  array& scores
+) {
+  assert_contiguous(input_lengths);
+
+  labels.set_data(allocator::malloc_or_wait(labels.nbytes()));
+  lengths.set_data(allocator::malloc_or_wait(lengths.nbytes()));
+  scores.set_data(allocator::malloc_or_wait(scores.nbytes()));
+
+  size_t axis_T            = batch_first ? 1 : 0;
+  size_t axis_B            = batch_first ? 0 : 1;
+  size_t max_input_length  = log_probs.shape()[axis_T];
+  size_t batch_size        = log_probs.shape()[axis_B];
+  size_t num_channels      = log_probs.shape()[2];
+
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
+
+  const T* logp_data = log_probs.data<T>();
+  const I* inl_data = input_lengths.data<I>();
+  int32_t* labels_data = labels.data<int32_t>();
+  int32_t* lengths_data = lengths.data<int32_t>();
+  float* scores_data = scores.data<float>();
+
+  std::vector<size_t> costs(batch_size);
+  for (size_t b = 0; b < batch_size; b++) costs[b] = size_t(inl_data[b]);
+
+  ctc::ThreadPool::instance().parallel_for(ctc::schedule_by_cost(costs), [&](size_t b) {
+    // Arena and hash tables are kept per thread, so their storage is reused across batch items and calls
+    static thread_local ctc::PrefixBeamSearch search;
+    search.reset(beam_width, top_k, num_channels, blank, lm);
+
+    size_t input_length = size_t(inl_data[b]);
+    for (size_t t = 0; t < input_length; t++) {
+      const T* logp_time_data = &logp_data[logp_stride_T * t + logp_stride_B * b];
+      float* frame = search.frame();
+      for (size_t c = 0; c < num_channels; c++) frame[c] = float(logp_time_data[logp_stride_C * c]);
+      search.step();
+    }
+
+    size_t found = search.finalize();
+    for (size_t n = 0; n < num_best; n++) {
+      int32_t* labels_data_bn = &labels_data[(b * num_best + n) * max_input_length];
+      size_t length = 0;
+      if (n < found) {
+        length = search.labels(n, labels_data_bn);
+        scores_data[b * num_best + n] = search.score(n);
+      } else {
+        scores_data[b * num_best + n] = -std::numeric_limits<float>::infinity();
+      }
+      lengths_data[b * num_best + n] = int32_t(length);
+      std::fill(labels_data_bn + length, labels_data_bn + max_input_length, int32_t(blank));
+    }
+  });
+}
+
+template <typename T>
+static void ctc_beam_search_impl_i(
+  const array& log_probs,
+  const array& input_lengths,
+  uint64_t blank,
+  size_t beam_width,
+  size_t top_k,
+  size_t num_best,
+  bool batch_first,
+  const ctc::LMFusion* lm,
+  array& labels,
+  array& lengths,
+  array& scores
+) {
+  if (input_lengths.dtype() == uint64 || input_lengths.dtype() == int64) {
+    return ctc_beam_search_impl<T, uint64_t>(log_probs, input_lengths, blank, beam_width, top_k, num_best, batch_first, lm, labels, lengths, scores);
+  }
+  if (input_lengths.dtype() == uint32 || input_lengths.dtype() == int32) {
+    return ctc_beam_search_impl<T, uint32_t>(log_probs, input_lengths, blank, beam_width, top_k, num_best, batch_first, lm, labels, lengths, scores);
+  }
+  if (input_lengths.dtype() == uint16 || input_lengths.dtype() == int16) {
+    return ctc_beam_search_impl<T, uint16_t>(log_probs, input_lengths, blank, beam_width, top_k, num_best, batch_first, lm, labels, lengths, scores);
+  }
+  if (input_lengths.dtype() == uint8 || input_lengths.dtype() == int8) {
+    return ctc_beam_search_impl<T, uint8_t>(log_probs, input_lengths, blank, beam_width, top_k, num_best, batch_first, lm, labels, lengths, scores);
+  }
+  throw std::runtime_error("CTCBeamSearch is only supported for integral input lengths.");
+}
+
+void CTCBeamSearch::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs     = inputs[0];
+  auto& input_lengths = inputs[1];
+  auto& labels        = outarr[0];
+  auto& lengths       = outarr[1];
+  auto& scores        = outarr[2];
+
+  if (log_probs.dtype() == float32) {
+    return ctc_beam_search_impl_i<float>(log_probs, input_lengths, blank_, beam_width_, top_k_, num_best_, batch_first_, lm_.get(), labels, lengths, scores);
+  }
+  if (log_probs.dtype() == float16) {
+    return ctc_beam_search_impl_i<float16_t>(log_probs, input_lengths, blank_, beam_width_, top_k_, num_best_, batch_first_, lm_.get(), labels, lengths, scores);
+  }
+  if (log_probs.dtype() == bfloat16) {
+    return ctc_beam_search_impl_i<bfloat16_t>(log_probs, input_lengths, blank_, beam_width_, top_k_, num_best_, batch_first_, lm_.get(), labels, lengths, scores);
+  }
+  throw std::runtime_error("CTCBeamSearch is only supported for floating point types.");
+}
+
+} // namespace mlx::core
@@ -0,0 +1,112 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ctc_loss/ctc_lm.h"
+
+namespace mlx::core::ctc {
+
+/**
+ *  CTC prefix beam search over a single sequence.
+ *
+ *  Prefixes are nodes of a trie stored in a flat arena and identified by `(parent, label)` key, so equal
+ *  prefixes reached through different alignments are merged by hashing that key. Candidates of every step
+ *  are merged before trie nodes are created, and only prefixes surviving pruning are added to the trie.
+ *  Hash tables are invalidated by generation stamps, and all storage is kept between `reset` calls,
+ *  so decoding does not allocate once buffers have grown to the working size.
+ *
+ *  With language model fusion, every trie node caches its LM context and fused score, and the score of
+ *  completing its current word is computed once, when first requested by a candidate or by `finalize`.
+ **/
+class PrefixBeamSearch {
+public:
+  // Starts new sequence; `top_k == 0` extends beams with every class on every frame
+  void reset(size_t beam_width, size_t top_k, size_t num_channels, size_t blank, const LMFusion* lm = nullptr);
+
+  // Frame buffer of `num_channels` log-probabilities, to be filled before `step`
+  float* frame() { return frame_.data(); }
+
+  // Advances beams by one frame
+  void step();
+
+  // Adds end of sentence score, sorts beams by descending score, returns their number
+  size_t finalize();
+
+  // Log-probability of `i`-th best hypothesis (after `finalize`), including fused LM score
+  float score(size_t i) const;
+
+  // Writes labels of `i`-th best hypothesis (after `finalize`), returns their number
+  size_t labels(size_t i, int32_t* out) const;
+
+private:
+  struct Node {
+    uint32_t parent;
+    int32_t label; // -1 for root
+    uint32_t length;
+  };
+
+  struct Beam {
+    uint64_t key;  // `(parent, label)` of prefix
+    uint32_t node; // Trie node, `kNoNode` until prefix survives pruning
+    float p_b;     // Log-probability of alignments ending with blank
+    float p_nb;    // Log-probability of alignments ending with last label
+    float lm;      // Fused LM score of prefix
+    float score;   // Total log-probability with LM score, valid after pruning
+  };
+
+  struct NodeLM {
+    float score;         // Fused LM score of completed words
+    uint32_t state;      // LM context, offset in `lm_states_`
+    uint32_t word_begin; // Node ending previous word (delimiter or root)
+    uint64_t word_hash;  // Hash of current (incomplete) word
+    float word_score;    // Fused score of completing current word, `NaN` until computed
+    uint32_t word_state; // LM context after completing current word
+  };
+
+  static constexpr uint32_t kNoNode = ~uint32_t(0);
+
+  struct Slot {
+    uint64_t key;
+    uint32_t value;
+    uint32_t stamp;
+  };
+
+  uint64_t key(uint32_t node) const;
+  uint32_t child(uint64_t key);
+  Beam& next_beam(uint64_t key);
+  void grow_children();
+  void select_classes();
+  void add_lm_node(uint32_t node);
+  float word_score(uint32_t node);
+  uint32_t push_state(uint32_t state, uint32_t word);
+
+  size_t beam_width_ = 0;
+  size_t top_k_ = 0;
+  size_t num_channels_ = 0;
+  size_t blank_ = 0;
+
+  std::vector<float> frame_;
+  std::vector<int32_t> classes_;
+  size_t num_classes_ = 0;
+
+  std::vector<Node> nodes_;
+  std::vector<Slot> children_;
+  uint32_t children_stamp_ = 0;
+
+  std::vector<Beam> beams_;
+  std::vector<Beam> next_;
+  std::vector<Slot> next_slots_;
+  uint32_t next_stamp_ = 0;
+
+  const LMFusion* lm_ = nullptr;
+  std::vector<NodeLM> node_lm_;
+  std::vector<uint32_t> lm_states_; // Context size followed by `order - 1` word ids, oldest first
+  std::string word_;
+};
+
+} // namespace mlx::core::ctc
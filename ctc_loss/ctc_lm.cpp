@@ -0,0 +1,476 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ctc_loss/ctc_lm.h"
+
+namespace mlx::core::ctc {
+
+static constexpr char kMagic[8] = { 'M', 'L', 'X', 'C', 'T', 'C', 'L', 'M' };
+static constexpr uint32_t kVersion = 1;
+static constexpr uint16_t kAbsent = 0xffff; // Prefix-only entry, which is not an n-gram itself
+static constexpr float kMissingScore = -100.f;
+
+struct NGramModel::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t order;
+  uint32_t quant_bits;
+  uint32_t vocab_size;
+  uint32_t bos;
+  uint32_t eos;
+  uint32_t unk;
+  uint32_t codebook_size;
+  uint64_t counts[kMaxOrder];        // Entries of every order
+  uint64_t entries[kMaxOrder];       // Offsets of `counts[n] + 1` entries (last one ends child ranges)
+  uint64_t prob_codes[kMaxOrder];    // Offsets of `codebook_size` log-probabilities
+  uint64_t backoff_codes[kMaxOrder]; // Offsets of `codebook_size` backoffs
+  uint64_t vocab_table;              // Offset of `vocab_table_size` word ids
+  uint64_t vocab_table_size;
+  uint64_t vocab_offsets;            // Offset of `vocab_size + 1` string offsets
+  uint64_t vocab_strings;            // Offset of concatenated words
+  uint64_t file_size;
+};
+
+struct NGramModel::Entry {
+  uint32_t word;
+  uint32_t next; // First child in next order
+  uint16_t prob;
+  uint16_t backoff;
+};
+
+static inline size_t vocab_slot(uint64_t hash, size_t mask) {
+  return size_t((hash * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+uint64_t NGramModel::word_hash(const char* data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; i++) hash = hash * kHashMul + uint8_t(data[i]);
+  return hash;
+}
+
+// ----------------------------- Builder -----------------------------
+
+namespace {
+
+struct ArpaLevel {
+  std::vector<uint32_t> words; // `n` ids per entry
+  std::vector<float> probs;
+  std::vector<float> backoffs;
+  std::vector<uint32_t> order; // Sorted permutation of entries
+};
+
+// Equal-population bins, exact values when there are few of them
+static std::vector<float> make_codebook(std::vector<float> values, size_t size) {
+  std::sort(values.begin(), values.end());
+  std::vector<float> uniq(values);
+  uniq.erase(std::unique(uniq.begin(), uniq.end()), uniq.end());
+  if (uniq.size() <= size) return uniq;
+  std::vector<float> codebook(size);
+  for (size_t b = 0; b < size; b++) {
+    size_t lo = b * values.size() / size, hi = (b + 1) * values.size() / size;
+    double sum = 0;
+    for (size_t i = lo; i < hi; i++) sum += values[i];
+    codebook[b] = float(sum / double(hi - lo));
+  }
+  return codebook;
+}
+
+static uint16_t encode(const std::vector<float>& codebook, float value) {
+  auto it = std::lower_bound(codebook.begin(), codebook.end(), value);
+  if (it == codebook.end()) return uint16_t(codebook.size() - 1);
+  if (it != codebook.begin() && value - *(it - 1) < *it - value) it--;
+  return uint16_t(it - codebook.begin());
+}
+
+struct Writer {
+  std::ofstream out;
+  uint64_t offset = 0;
+
+  uint64_t write(const void* data, size_t size) {
+    uint64_t pos = offset;
+    out.write(static_cast<const char*>(data), size);
+    offset += size;
+    static const char zeros[8] = {};
+    size_t pad = (8 - offset % 8) % 8;
+    out.write(zeros, pad);
+    offset += pad;
+    return pos;
+  }
+};
+
+} // namespace
+
+void NGramModel::build(const std::string& arpa_path, const std::string& output_path, int quant_bits) {
+  if (quant_bits < 1 || quant_bits > 16) throw std::invalid_argument("[ctc_lm] quant_bits should be in range [1, 16].");
+
+  std::ifstream in(arpa_path);
+  if (!in) throw std::runtime_error("[ctc_lm] Can not open " + arpa_path);
+
+  std::vector<std::string> vocab;
+  std::unordered_map<std::string, uint32_t> vocab_ids;
+  std::vector<ArpaLevel> levels;
+  std::vector<uint64_t> declared;
+
+  auto word_id = [&](const std::string& w) {
+    auto it = vocab_ids.find(w);
+    if (it != vocab_ids.end()) return it->second;
+    uint32_t id = uint32_t(vocab.size());
+    vocab.push_back(w);
+    vocab_ids.emplace(w, id);
+    // Words seen only in higher orders are added as prefix-only unigrams
+    levels[0].words.push_back(id);
+    levels[0].probs.push_back(NAN);
+    levels[0].backoffs.push_back(0.f);
+    return id;
+  };
+
+  std::string line;
+  size_t section = 0; // 0 - header, n - n-grams of order n
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+    if (line == "\\data\\") continue;
+    if (line == "\\end\\") break;
+    if (line.rfind("ngram ", 0) == 0) {
+      auto eq = line.find('=');
+      size_t n = std::stoul(line.substr(6, eq - 6));
+      if (n < 1 || n > kMaxOrder) throw std::runtime_error("[ctc_lm] Unsupported n-gram order " + std::to_string(n));
+      if (declared.size() < n) declared.resize(n);
+      declared[n - 1] = std::stoull(line.substr(eq + 1));
+      continue;
+    }
+    if (line[0] == '\\') {
+      section = std::stoul(line.substr(1));
+      if (section < 1 || section > declared.size()) throw std::runtime_error("[ctc_lm] Unexpected section " + line);
+      if (levels.empty()) levels.resize(declared.size());
+      levels[section - 1].probs.reserve(declared[section - 1]);
+      continue;
+    }
+    if (section == 0) continue;
+
+    std::istringstream fields(line);
+    float prob, backoff = 0.f;
+    fields >> prob;
+    auto& level = levels[section - 1];
+    if (section == 1) {
+      std::string w;
+      fields >> w;
+      if (!(fields >> backoff)) backoff = 0.f;
+      auto it = vocab_ids.find(w);
+      if (it != vocab_ids.end()) {
+        level.probs[it->second] = prob;
+        level.backoffs[it->second] = backoff;
+        continue;
+      }
+      word_id(w);
+      level.probs.back() = prob;
+      level.backoffs.back() = backoff;
+      continue;
+    }
+    for (size_t i = 0; i < section; i++) {
+      std::string w;
+      if (!(fields >> w)) throw std::runtime_error("[ctc_lm] Malformed n-gram: " + line);
+      level.words.push_back(word_id(w));
+    }
+    if (!(fields >> backoff)) backoff = 0.f;
+    level.probs.push_back(prob);
+    level.backoffs.push_back(backoff);
+  }
+  if (levels.empty() || vocab.empty()) throw std::runtime_error("[ctc_lm] No n-grams in " + arpa_path);
+
+  size_t order = levels.size();
+  auto less = [](const uint32_t* a, const uint32_t* b, size_t n) {
+    return std::lexicographical_compare(a, a + n, b, b + n);
+  };
+  auto sort_level = [&](size_t k) {
+    auto& level = levels[k];
+    size_t n = k + 1, count = level.probs.size();
+    level.order.resize(count);
+    for (size_t i = 0; i < count; i++) level.order[i] = uint32_t(i);
+    std::sort(level.order.begin(), level.order.end(), [&](uint32_t a, uint32_t b) {
+      return less(&level.words[a * n], &level.words[b * n], n);
+    });
+  };
+
+  // Every n-gram should have its context as an entry of lower order, missing ones are added as prefix-only
+  for (size_t k = order; k-- > 1;) {
+    sort_level(k - 1);
+    auto& level = levels[k];
+    auto& lower = levels[k - 1];
+    size_t n = k + 1;
+    std::vector<uint32_t> missing;
+    for (size_t i = 0; i < level.probs.size(); i++) {
+      const uint32_t* prefix = &level.words[i * n];
+      auto it = std::lower_bound(lower.order.begin(), lower.order.end(), prefix, [&](uint32_t e, const uint32_t* p) {
+        return less(&lower.words[e * k], p, k);
+      });
+      if (it != lower.order.end() && std::equal(prefix, prefix + k, &lower.words[*it * k])) continue;
+      missing.insert(missing.end(), prefix, prefix + k);
+    }
+    for (size_t i = 0; i < missing.size(); i += k) {
+      if (i > 0 && std::equal(&missing[i], &missing[i] + k, &missing[i - k])) continue;
+      lower.words.insert(lower.words.end(), &missing[i], &missing[i] + k);
+      lower.probs.push_back(NAN);
+      lower.backoffs.push_back(0.f);
+    }
+  }
+  for (size_t k = 0; k < order; k++) sort_level(k);
+  for (size_t k = 1; k < order; k++) {
+    // Deduplicate prefixes added from different (non-adjacent) n-grams
+    auto& level = levels[k];
+    size_t n = k + 1;
+    std::vector<uint32_t> uniq;
+    for (size_t i = 0; i < level.order.size(); i++) {
+      if (i > 0 && std::equal(&level.words[level.order[i] * n], &level.words[level.order[i] * n] + n, &level.words[level.order[i - 1] * n])) {
+        if (!std::isnan(level.probs[level.order[i]])) uniq.back() = level.order[i];
+        continue;
+      }
+      uniq.push_back(level.order[i]);
+    }
+    level.order.swap(uniq);
+  }
+
+  Header header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.order = uint32_t(order);
+  header.quant_bits = uint32_t(quant_bits);
+  header.vocab_size = uint32_t(vocab.size());
+  header.codebook_size = uint32_t(std::min<size_t>(size_t(1) << quant_bits, kAbsent));
+  auto special = [&](const char* w) {
+    auto it = vocab_ids.find(w);
+    return it == vocab_ids.end() ? kNoWord : it->second;
+  };
+  header.bos = special("<s>");
+  header.eos = special("</s>");
+  header.unk = special("<unk>");
+
+  Writer w;
+  w.out.open(output_path, std::ios::binary | std::ios::trunc);
+  if (!w.out) throw std::runtime_error("[ctc_lm] Can not write " + output_path);
+  w.write(&header, sizeof(header));
+
+  for (size_t k = 0; k < order; k++) {
+    auto& level = levels[k];
+    size_t n = k + 1;
+    std::vector<float> probs, backoffs;
+    for (auto i : level.order) {
+      if (!std::isnan(level.probs[i])) probs.push_back(level.probs[i]);
+      backoffs.push_back(level.backoffs[i]);
+    }
+    auto prob_codebook = make_codebook(probs, header.codebook_size);
+    auto backoff_codebook = make_codebook(backoffs, header.codebook_size);
+    if (prob_codebook.empty()) prob_codebook.push_back(0.f);
+    if (backoff_codebook.empty()) backoff_codebook.push_back(0.f);
+
+    // Children of every entry are contiguous, as both orders are sorted lexicographically
+    std::vector<Entry> entries(level.order.size() + 1);
+    size_t child = 0;
+    for (size_t e = 0; e < level.order.size(); e++) {
+      uint32_t i = level.order[e];
+      const uint32_t* ids = &level.words[i * n];
+      entries[e].word = ids[k];
+      entries[e].prob = std::isnan(level.probs[i]) ? kAbsent : encode(prob_codebook, level.probs[i]);
+      entries[e].backoff = encode(backoff_codebook, level.backoffs[i]);
+      entries[e].next = uint32_t(child);
+      if (k + 1 < order) {
+        auto& upper = levels[k + 1];
+        while (child < upper.order.size() && std::equal(ids, ids + n, &upper.words[upper.order[child] * (n + 1)])) child++;
+      }
+    }
+    entries.back() = { kNoWord, uint32_t(child), kAbsent, 0 };
+
+    header.counts[k] = level.order.size();
+    header.entries[k] = w.write(entries.data(), entries.size() * sizeof(Entry));
+    prob_codebook.resize(header.codebook_size, 0.f);
+    backoff_codebook.resize(header.codebook_size, 0.f);
+    header.prob_codes[k] = w.write(prob_codebook.data(), prob_codebook.size() * sizeof(float));
+    header.backoff_codes[k] = w.write(backoff_codebook.data(), backoff_codebook.size() * sizeof(float));
+  }
+
+  std::vector<uint64_t> offsets(vocab.size() + 1);
+  std::string strings;
+  for (size_t i = 0; i < vocab.size(); i++) {
+    offsets[i] = strings.size();
+    strings += vocab[i];
+  }
+  offsets.back() = strings.size();
+
+  size_t table_size = 64;
+  while (table_size < vocab.size() * 2) table_size *= 2;
+  std::vector<uint32_t> table(table_size, kNoWord);
+  for (size_t i = 0; i < vocab.size(); i++) {
+    size_t slot = vocab_slot(word_hash(vocab[i].data(), vocab[i].size()), table_size - 1);
+    while (table[slot] != kNoWord) slot = (slot + 1) & (table_size - 1);
+    table[slot] = uint32_t(i);
+  }
+
+  header.vocab_table = w.write(table.data(), table.size() * sizeof(uint32_t));
+  header.vocab_table_size = table_size;
+  header.vocab_offsets = w.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+  header.vocab_strings = w.write(strings.data(), strings.size());
+  header.file_size = w.offset;
+
+  w.out.seekp(0);
+  w.out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!w.out) throw std::runtime_error("[ctc_lm] Failed to write " + output_path);
+}
+
+// ----------------------------- Model -----------------------------
+
+NGramModel::NGramModel(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("[ctc_lm] Can not open " + path);
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+    ::close(fd);
+    throw std::runtime_error("[ctc_lm] Invalid model file " + path);
+  }
+  size_ = size_t(st.st_size);
+  void* data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) throw std::runtime_error("[ctc_lm] Can not map " + path);
+  data_ = static_cast<const uint8_t*>(data);
+  header_ = reinterpret_cast<const Header*>(data_);
+  if (!valid()) {
+    ::munmap(const_cast<uint8_t*>(data_), size_);
+    data_ = nullptr;
+    throw std::runtime_error("[ctc_lm] Invalid model file " + path);
+  }
+}
+
+// Header is checked before anything else is read: every table should lie within the file, aligned as written,
+// and hold as many items as lookups may index. Entries are checked lazily by lookups.
+bool NGramModel::valid() const {
+  const Header& h = *header_;
+  auto fits = [&](uint64_t offset, uint64_t count, size_t item) {
+    return offset % 8 == 0 && offset <= size_ && count <= (size_ - offset) / item;
+  };
+  auto known = [&](uint32_t id) { return id == kNoWord || id < h.vocab_size; };
+  if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion || h.file_size != size_) return false;
+  if (h.order < 1 || h.order > kMaxOrder || h.codebook_size < 1 || h.codebook_size > kAbsent) return false;
+  if (h.vocab_size < 1 || h.counts[0] < h.vocab_size || !known(h.bos) || !known(h.eos) || !known(h.unk)) return false;
+  for (size_t k = 0; k < h.order; k++) {
+    if (h.counts[k] >= kNoWord || !fits(h.entries[k], h.counts[k] + 1, sizeof(Entry))) return false;
+    if (!fits(h.prob_codes[k], h.codebook_size, sizeof(float))) return false;
+    if (!fits(h.backoff_codes[k], h.codebook_size, sizeof(float))) return false;
+  }
+  // Probes stop at an empty slot, so table is larger than vocabulary
+  if (h.vocab_table_size <= h.vocab_size || (h.vocab_table_size & (h.vocab_table_size - 1)) != 0) return false;
+  if (!fits(h.vocab_table, h.vocab_table_size, sizeof(uint32_t))) return false;
+  if (!fits(h.vocab_offsets, uint64_t(h.vocab_size) + 1, sizeof(uint64_t))) return false;
+  return h.vocab_strings <= size_;
+}
+
+NGramModel::~NGramModel() {
+  if (data_) ::munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+size_t NGramModel::order() const { return header_->order; }
+size_t NGramModel::vocab_size() const { return header_->vocab_size; }
+uint32_t NGramModel::bos() const { return header_->bos; }
+uint32_t NGramModel::eos() const { return header_->eos; }
+uint32_t NGramModel::unk() const { return header_->unk; }
+
+uint32_t NGramModel::word(uint64_t hash, const char* data, size_t size) const {
+  auto table = reinterpret_cast<const uint32_t*>(data_ + header_->vocab_table);
+  auto offsets = reinterpret_cast<const uint64_t*>(data_ + header_->vocab_offsets);
+  auto strings = reinterpret_cast<const char*>(data_ + header_->vocab_strings);
+  size_t mask = header_->vocab_table_size - 1;
+  size_t strings_size = size_ - header_->vocab_strings;
+  size_t slot = vocab_slot(hash, mask);
+  for (size_t i = 0; i <= mask; i++, slot = (slot + 1) & mask) {
+    uint32_t id = table[slot];
+    if (id == kNoWord || id >= header_->vocab_size) break;
+    uint64_t begin = offsets[id], end = offsets[id + 1];
+    if (begin > end || end > strings_size) break;
+    if (end - begin == size && std::memcmp(strings + begin, data, size) == 0) return id;
+  }
+  return header_->unk;
+}
+
+uint32_t NGramModel::word(const std::string& word) const {
+  return this->word(word_hash(word.data(), word.size()), word.data(), word.size());
+}
+
+const NGramModel::Entry* NGramModel::find(const uint32_t* words, size_t size) const {
+  if (words[0] >= header_->vocab_size) return nullptr;
+  auto level = reinterpret_cast<const Entry*>(data_ + header_->entries[0]);
+  const Entry* e = &level[words[0]];
+  for (size_t k = 1; k < size; k++) {
+    auto upper = reinterpret_cast<const Entry*>(data_ + header_->entries[k]);
+    if (e[0].next > e[1].next || e[1].next > header_->counts[k]) return nullptr;
+    const Entry* lo = upper + e[0].next;
+    const Entry* hi = upper + e[1].next;
+    e = std::lower_bound(lo, hi, words[k], [](const Entry& x, uint32_t w) { return x.word < w; });
+    if (e == hi || e->word != words[k]) return nullptr;
+  }
+  return e;
+}
+
+float NGramModel::prob(size_t n, const Entry& e) const {
+  if (e.prob >= header_->codebook_size) return kMissingScore;
+  return reinterpret_cast<const float*>(data_ + header_->prob_codes[n])[e.prob];
+}
+
+float NGramModel::backoff(size_t n, const Entry& e) const {
+  if (e.backoff >= header_->codebook_size) return 0.f;
+  return reinterpret_cast<const float*>(data_ + header_->backoff_codes[n])[e.backoff];
+}
+
+float NGramModel::score(const uint32_t* context, size_t size, uint32_t word) const {
+  if (word == kNoWord) return kMissingScore;
+  size_t used = std::min<size_t>(size, header_->order - 1);
+  uint32_t words[kMaxOrder];
+  std::copy(context + size - used, context + size, words);
+  size = used;
+  words[size] = word;
+
+  // Longest n-gram present in the model, plus backoffs of longer contexts
+  for (size_t i = 0; i <= size; i++) {
+    const Entry* e = find(&words[i], size - i + 1);
+    if (!e || e->prob == kAbsent) continue;
+    float p = prob(size - i, *e);
+    for (size_t j = 0; j < i; j++) {
+      const Entry* c = find(&words[j], size - j);
+      if (c) p += backoff(size - j - 1, *c);
+    }
+    return p;
+  }
+  return kMissingScore;
+}
+
+// ----------------------------- Fusion -----------------------------
+
+LMFusion::LMFusion(
+  std::shared_ptr<const NGramModel> model,
+  std::vector<std::string> alphabet,
+  size_t delimiter,
+  float weight,
+  float bonus
+) :
+  model(std::move(model)),
+  alphabet(std::move(alphabet)),
+  delimiter(delimiter),
+  weight(weight),
+  bonus(bonus) {
+  for (auto& s : this->alphabet) {
+    uint64_t mul = 1;
+    for (size_t i = 0; i < s.size(); i++) mul *= NGramModel::kHashMul;
+    hash_mul.push_back(mul);
+    hash_add.push_back(NGramModel::word_hash(s.data(), s.size()));
+  }
+}
+
+} // namespace mlx::core::ctc
@@ -0,0 +1,100 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mlx::core::ctc {
+
+/**
+ *  Word n-gram language model in compact binary format, read through `mmap`.
+ *
+ *  The file is built offline from ARPA by `NGramModel::build`. Every order is a flat array of entries sorted
+ *  by word id and grouped under their `(n-1)`-gram prefix (a trie in breadth-first layout), so lookups are
+ *  binary searches within a child range. Log-probabilities and backoffs are quantized per order to
+ *  `2^bits` bins of equal population. Words are found through an open-addressing hash table of
+ *  `word_hash` values, which can be computed incrementally while a word is being decoded.
+ *
+ *  Mapped pages are shared by all processes opening the same file, so workers do not parse or copy the model.
+ **/
+class NGramModel {
+public:
+  static constexpr size_t kMaxOrder = 8;
+  static constexpr uint32_t kNoWord = ~uint32_t(0);
+
+  // Parses ARPA file and writes binary model with `quant_bits` (1..16) per log-probability and backoff
+  static void build(const std::string& arpa_path, const std::string& output_path, int quant_bits = 8);
+
+  explicit NGramModel(const std::string& path);
+  ~NGramModel();
+
+  NGramModel(const NGramModel&) = delete;
+  NGramModel& operator=(const NGramModel&) = delete;
+
+  size_t order() const;
+  size_t vocab_size() const;
+  uint32_t bos() const;
+  uint32_t eos() const;
+  uint32_t unk() const;
+
+  // Word id, `unk()` for words missing in vocabulary (`kNoWord` when model has no `<unk>` either)
+  uint32_t word(uint64_t hash, const char* data, size_t size) const;
+  uint32_t word(const std::string& word) const;
+
+  /**
+   *  Log10-probability of `word` after `context` (`size` word ids, oldest first), with backoff.
+   *  Words missing in the model score `-100`.
+   **/
+  float score(const uint32_t* context, size_t size, uint32_t word) const;
+
+  // Polynomial hash of word bytes: `h = h * kHashMul + byte`, starting from `0`
+  static constexpr uint64_t kHashMul = 0x100000001b3ull;
+  static uint64_t word_hash(const char* data, size_t size, uint64_t hash = 0);
+
+private:
+  struct Header;
+  struct Entry;
+
+  bool valid() const;
+  const Entry* find(const uint32_t* words, size_t size) const;
+  float prob(size_t n, const Entry& e) const;
+  float backoff(size_t n, const Entry& e) const;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  const Header* header_ = nullptr;
+};
+
+/**
+ *  Shallow fusion of word n-gram model into CTC prefix beam search.
+ *
+ *  Each class is mapped to a string of `alphabet`; `delimiter` class ends words. Prefix score is extended
+ *  by `weight * ln(P(word | context)) + bonus` for every completed word.
+ **/
+struct LMFusion {
+  std::shared_ptr<const NGramModel> model;
+  std::vector<std::string> alphabet;
+  size_t delimiter;
+  float weight;
+  float bonus;
+
+  // Per-class `kHashMul^len` and hash of alphabet string, to extend word hash by whole class strings
+  std::vector<uint64_t> hash_mul;
+  std::vector<uint64_t> hash_add;
+
+  LMFusion(
+    std::shared_ptr<const NGramModel> model,
+    std::vector<std::string> alphabet,
+    size_t delimiter,
+    float weight,
+    float bonus
+  );
+
+  uint64_t extend(uint64_t hash, size_t label) const { return hash * hash_mul[label] + hash_add[label]; }
+};
+
+} // namespace mlx::core::ctc
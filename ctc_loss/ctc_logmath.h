@@ -0,0 +1,114 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+// Log-semiring math of lattice recurrences, shared by CPU and Metal through `stdlib` namespace alias.
+// Included by `ctc_loss_impl.h`, CPU row kernels, RNN-T and beam search (possibly inside a namespace),
+// so it must not include anything.
+//
+// Values are log-probabilities in `float`: `-inf` is the semiring zero and `logaddexp` is its addition.
+// Both modes reduce every sum to its maximum plus `log1p` of exponents of non-positive differences,
+// so arguments of `exp` are in `[-inf, 0]` and argument of `log` is in `[1, 3]`:
+//
+//   - exact (default): `stdlib::exp` and `stdlib::log`, `log1p` corrected for small arguments.
+//   - fast (`MLX_CTC_FAST_MATH`, passed to Metal through `ctc_metal_config.h`): inline branch-free cephes
+//     polynomials, the same as in vector row kernels of CPU.
+//     `exp` is flushed to zero below `-87.3`, error of `logaddexp` is within 2 ulp of result
+//     (or `1e-7` absolute, for results near zero).
+
+#if defined(__METAL_VERSION__)
+#define CTC_FLOAT_AS_INT(x) metal::as_type<int>(x)
+#define CTC_INT_AS_FLOAT(x) metal::as_type<float>(x)
+#else
+#define CTC_FLOAT_AS_INT(x) __builtin_bit_cast(int, x)
+#define CTC_INT_AS_FLOAT(x) __builtin_bit_cast(float, x)
+#endif
+
+#ifndef MTL_CONSTP
+#define MTL_CONSTP
+#endif
+
+template <typename T>
+static MTL_CONSTP const T neginf = -stdlib::numeric_limits<T>::infinity();
+
+// Constants of cephes polynomials, shared with vector row kernels of CPU (`ctc_loss_simd_impl.h`)
+static MTL_CONSTP const float _ctc_exp_min = -87.3f;             // `exp` is flushed to zero below
+static MTL_CONSTP const float _ctc_log2e = 1.44269504088896341f;
+static MTL_CONSTP const float _ctc_ln2_hi = 0.693359375f;        // ln(2) split for exact range reduction
+static MTL_CONSTP const float _ctc_ln2_lo = -2.12194440e-4f;
+static MTL_CONSTP const float _ctc_sqrt_half = 0.707106781186547524f;
+static MTL_CONSTP const float _ctc_exp_poly[6] = {
+  1.9875691500E-4f, 1.3981999507E-3f, 8.3334519073E-3f, 4.1665795894E-2f, 1.6666665459E-1f, 5.0000001201E-1f,
+};
+static MTL_CONSTP const float _ctc_log_poly[9] = {
+  7.0376836292E-2f, -1.1514610310E-1f, 1.1676998740E-1f, -1.2420140846E-1f, 1.4249322787E-1f,
+  -1.6668057665E-1f, 2.0000714765E-1f, -2.4999993993E-1f, 3.3333331174E-1f,
+};
+
+// exp(x) for x < 88, exactly 0 below float range
+static inline float _ctc_fast_exp(float x) {
+  float xc = stdlib::max(x, _ctc_exp_min);
+  // Round to nearest by adding 1.5 * 2^23
+  float fn = (xc * _ctc_log2e + 12582912.f) - 12582912.f;
+  float r  = fn * -_ctc_ln2_hi + xc;
+  r = fn * -_ctc_ln2_lo + r;
+  float p = _ctc_exp_poly[0];
+  for (int i = 1; i < 6; i++) p = p * r + _ctc_exp_poly[i];
+  float y = p * (r * r) + r + 1.f;
+  float scale = CTC_INT_AS_FLOAT((int(fn) + 127) << 23);
+  return (x < _ctc_exp_min) ? 0.f : y * scale;
+}
+
+// log(x) for normal positive x
+static inline float _ctc_fast_log(float x) {
+  int xi = CTC_FLOAT_AS_INT(x);
+  float e = float((xi >> 23) - 126);
+  float m = CTC_INT_AS_FLOAT((xi & 0x007fffff) | 0x3f000000);
+  bool lower = m < _ctc_sqrt_half;
+  e = lower ? e - 1.f : e;
+  m = (lower ? m + m : m) - 1.f;
+  float z = m * m;
+  float y = _ctc_log_poly[0];
+  for (int i = 1; i < 9; i++) y = y * m + _ctc_log_poly[i];
+  y = y * m * z;
+  y = e * _ctc_ln2_lo + y;
+  y = z * -0.5f + y;
+  return e * _ctc_ln2_hi + (m + y);
+}
+
+static inline float _ctc_exp(float x) {
+#if defined(MLX_CTC_FAST_MATH)
+  return _ctc_fast_exp(x);
+#else
+  return stdlib::exp(x);
+#endif
+}
+
+static inline float _ctc_log(float x) {
+#if defined(MLX_CTC_FAST_MATH)
+  return _ctc_fast_log(x);
+#else
+  return stdlib::log(x);
+#endif
+}
+
+// log(1 + x) for x >= 0: rounding error of `1 + x` is cancelled by scaling with `x / (w - 1)`
+static inline float _ctc_log1p(float x) {
+  float w = 1.f + x;
+  return (w == 1.f) ? x : _ctc_log(w) * (x / (w - 1.f));
+}
+
+// log(exp(x) + exp(y))
+static inline float logaddexp(float x, float y) {
+  float maxval = stdlib::max(x, y);
+  float minval = stdlib::min(x, y);
+  float res = maxval + _ctc_log1p(_ctc_exp(minval - maxval));
+  return (maxval == neginf<float>) ? maxval : res;
+}
+
+// log(exp(x) + exp(y) + exp(z)), with two exponents and one logarithm
+static inline float logaddexp(float x, float y, float z) {
+  float maxval = stdlib::max(x, stdlib::max(y, z));
+  float minval = stdlib::min(x, stdlib::min(y, z));
+  float midval = stdlib::max(stdlib::min(x, y), stdlib::min(stdlib::max(x, y), z));
+  float res = maxval + _ctc_log1p(_ctc_exp(midval - maxval) + _ctc_exp(minval - maxval));
+  return (maxval == neginf<float>) ? maxval : res;
+}
@@ -2,11 +2,31 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include "mlx/ops.h"
 #include "mlx/primitives.h"
 
 namespace mlx::core {
 
+namespace ctc {
+class NGramModel;
+struct LMFusion;
+}
+
+/**
+ *  Reduction applied to per-sample losses (PyTorch semantics):
+ *  `none` returns `(N)` losses, `sum` - their sum, `mean` - mean of losses divided by target lengths.
+ **/
+enum class CTCReduction : size_t {
+  none = 0,
+  sum  = 1,
+  mean = 2,
+};
+
 /**
  *  The Connectionist Temporal Classification loss.
  * 
@@ -15,15 +35,16 @@ namespace mlx::core {
  *  with respect to each input node. The alignment of input to target is assumed to be "many-to-one", which
  *  limits the length of the target sequence such that it must be <= the input length.
  * 
- *  Return: `(N)`, where `N = batch size`
+ *  Return: `(N)`, where `N = batch size`, or scalar when reduced
  * 
  **/
 array ctc_loss(
   /**
    *  The logarithmized probabilities of the outputs (e.g. obtained with `mlx::core::log_softmax`)
-   *  of size `(T, N, C)`, where
+   *  of size `(T, N, C)` (or `(N, T, C)` with `batch_first`), where
    *  `T = input length`, `N = batch size`, and
-   *  `C = number of classes` (including blank)
+   *  `C = number of classes` (including blank).
+   *  Any strides are accepted, so transposed views are consumed without copying.
    */
   const array& log_probs,
   /**
@@ -48,19 +69,404 @@ array ctc_loss(
   const array& target_lengths,
 
   uint64_t blank = 0,   // Blank label, default `0`.
+  /**
+   *  Reduction of per-sample losses: `"none"` (default), `"sum"` or `"mean"`.
+   *  Reduction (and scaling of gradient) is performed by the loss kernels, without extra operations in graph.
+   */
+  const std::string& reduction = "none",
+  bool zero_infinity = false, // Zero infinite losses (impossible alignments) and their gradients
+  bool batch_first = false,   // `log_probs` (and its gradient) are `(N, T, C)`
+  /**
+   *  Keep full `log_alpha` lattice for gradient computation.
+   *  With `false`, only two rolling rows of alpha are kept per sequence, and gradient is not available.
+   *  Default (`std::nullopt`) keeps lattice only when called under function transformation (e.g. `value_and_grad`).
+   */
+  std::optional<bool> need_grad = std::nullopt,
+  /**
+   *  Store alpha only every `checkpoint_interval` time steps, recomputing segments in backward pass (CPU only).
+   *  `0` stores every step (unless `memory_budget` is set), negative value picks `sqrt(T)` for `O(sqrt(T))` memory.
+   */
+  int checkpoint_interval = 0,
+  /**
+   *  Budget in bytes for stored alpha, used to derive checkpoint interval when `checkpoint_interval` is `0`.
+   *  `0` means no limit.
+   */
+  size_t memory_budget = 0,
+  /**
+   *  Storage type of `log_alpha` (and `log_beta` on GPU): `float32` or type of `log_probs`.
+   *  Recurrences always accumulate in `float32`, loss and gradient are returned in type of `log_probs`.
+   *  Default (`std::nullopt`) is `float32`.
+   */
+  std::optional<Dtype> alpha_dtype = std::nullopt,
+  /**
+   *  Approximate loss of very long inputs: only alignments deviating at most `max_deviation` labels from
+   *  the uniform one (target spread evenly over the input) are summed, so every frame costs `O(max_deviation)`
+   *  instead of `O(S)`. Loss is never below the exact one, gradient is that of approximate loss.
+   *  `0` (default) computes exact loss, which still skips cells unreachable from the first frame
+   *  or from the last one.
+   */
+  int max_deviation = 0,
+  /**
+   *  Run recurrences on probabilities rescaled every frame instead of log-probabilities (CPU only):
+   *  emissions are exponentiated once and cells cost a few multiplications instead of `logaddexp`.
+   *  Sequences whose lattice rows span more than `float` range (e.g. very peaky emissions) fall back
+   *  to log space, every sequence is computed by a single thread. Default `false`.
+   */
+  bool linear_space = false,
   StreamOrDevice s = {} // Stream on which to schedule the operation
 );
 
+/**
+ *  The Connectionist Temporal Classification loss of unnormalized `logits`.
+ *
+ *  Same as `ctc_loss(log_softmax(logits, -1), ...)`, without materializing log-probabilities: log-normalizer
+ *  of every frame is computed by the loss and kept for backward pass, and gradient with respect to `logits`
+ *  (`softmax - posterior`) is produced directly.
+ *
+ *  Return: `(N)`, where `N = batch size`, or scalar when reduced
+ **/
+array ctc_loss_from_logits(
+  /**
+   *  Unnormalized scores of size `(T, N, C)` (or `(N, T, C)` with `batch_first`), with any strides.
+   */
+  const array& logits,
+  const array& targets,        // Target sequences of size `(N, S)`
+  const array& input_lengths,  // Lengths of the inputs of size `(N)` (must each be <= `T`)
+  const array& target_lengths, // Lengths of the targets of size `(N)` (must each be <= `S`)
+  uint64_t blank = 0,
+  const std::string& reduction = "none",
+  bool zero_infinity = false,
+  bool batch_first = false,
+  std::optional<bool> need_grad = std::nullopt,
+  int checkpoint_interval = 0,
+  size_t memory_budget = 0,
+  std::optional<Dtype> alpha_dtype = std::nullopt,
+  int max_deviation = 0,
+  bool linear_space = false,
+  StreamOrDevice s = {} // Other arguments are the same as for `ctc_loss`
+);
+
+/**
+ *  Greedy (best path) CTC decoding.
+ *
+ *  Takes most probable class of every frame, then collapses repeated classes and removes blanks.
+ *
+ *  Return: `[labels, lengths]`, where `labels` are `(N, T)` `int32` decoded sequences padded with `blank`
+ *  and `lengths` are `(N)` `int32` numbers of decoded labels.
+ **/
+std::vector<array> ctc_greedy_decode(
+  /**
+   *  The logarithmized probabilities (or logits) of the outputs of size `(T, N, C)`
+   *  (or `(N, T, C)` with `batch_first`), with any strides.
+   */
+  const array& log_probs,
+  /**
+   *  Lengths of the inputs of size `(N)` (must each be <= `T`).
+   */
+  const array& input_lengths,
+  uint64_t blank = 0,       // Blank label, default `0`.
+  bool batch_first = false, // `log_probs` are `(N, T, C)`
+  StreamOrDevice s = {}     // Stream on which to schedule the operation
+);
+
+/**
+ *  CTC prefix beam search decoding (CPU only).
+ *
+ *  Keeps `beam_width` most probable label prefixes, merging alignments which collapse to the same prefix.
+ *  With `top_k`, only `top_k` most probable classes of every frame extend prefixes.
+ *
+ *  Return: `[labels, lengths, scores]`, where `labels` are `(N, num_best, T)` `int32` hypotheses padded with `blank`,
+ *  `lengths` are `(N, num_best)` `int32` numbers of their labels, and `scores` are `(N, num_best)` `float32`
+ *  log-probabilities, best first (`-inf` when less than `num_best` hypotheses were found).
+ *
+ *  With `lm`, scores of prefixes are fused with word n-gram model: every class is mapped to string of `alphabet`,
+ *  `word_delimiter` class completes words, and each completed word adds `lm_weight * ln(P(word)) + word_bonus`.
+ *  Last word and end of sentence are scored at the end of input, and returned scores include the LM part.
+ **/
+std::vector<array> ctc_beam_search_decode(
+  /**
+   *  The logarithmized probabilities of the outputs of size `(T, N, C)`
+   *  (or `(N, T, C)` with `batch_first`), with any strides.
+   */
+  const array& log_probs,
+  /**
+   *  Lengths of the inputs of size `(N)` (must each be <= `T`).
+   */
+  const array& input_lengths,
+  uint64_t blank = 0,       // Blank label, default `0`.
+  int beam_width = 8,       // Number of prefixes kept after every frame
+  int top_k = 0,            // Number of classes extending prefixes on every frame, `0` for all
+  int num_best = 1,         // Number of returned hypotheses (<= `beam_width`)
+  bool batch_first = false, // `log_probs` are `(N, T, C)`
+  std::shared_ptr<const ctc::NGramModel> lm = nullptr, // Word n-gram model for shallow fusion
+  const std::vector<std::string>& alphabet = {},       // String of every class (with `lm`)
+  int word_delimiter = -1,  // Class completing words (with `lm`)
+  float lm_weight = 0.5f,   // Weight of LM log-probability
+  float word_bonus = 0.f,   // Score added for every completed word
+  StreamOrDevice s = {}     // Stream on which to schedule the operation, default is CPU
+);
+
+/**
+ *  CTC forced alignment (CPU only).
+ *
+ *  Finds the most probable alignment of every target (Viterbi path over the same lattice as `ctc_loss`).
+ *
+ *  Return: `[labels, segments, scores]`, where `labels` are `(N, T)` `int32` classes of every frame
+ *  (`blank` on blank and padding frames), `segments` are `(N, S, 2)` `int32` `[start, end)` frames of every
+ *  target label (`-1` on padding), and `scores` are `(N)` `float32` log-probabilities of best paths
+ *  (`-inf` when alignment is impossible, with all frames blank).
+ **/
+std::vector<array> ctc_forced_align(
+  /**
+   *  The logarithmized probabilities of the outputs of size `(T, N, C)`
+   *  (or `(N, T, C)` with `batch_first`), with any strides.
+   */
+  const array& log_probs,
+  /**
+   *  Target sequences of size `(N, S)`.
+   */
+  const array& targets,
+  /**
+   *  Lengths of the inputs of size `(N)` (must each be <= `T`).
+   */
+  const array& input_lengths,
+  /**
+   *  Lengths of the targets of size `(N)` (must each be <= `S`).
+   */
+  const array& target_lengths,
+  uint64_t blank = 0,       // Blank label, default `0`.
+  bool batch_first = false, // `log_probs` are `(N, T, C)`
+  StreamOrDevice s = {}     // Stream on which to schedule the operation, default is CPU
+);
+
+/**
+ *  CTC state occupancy collapsed onto classes (CPU only).
+ *
+ *  Posterior probability `gamma(t, c) = sum(alpha * beta) / p(l|x)` of every class on every frame, summed over
+ *  positions of extended label sequence with that class. It is the term subtracted from `softmax` in gradient
+ *  of `ctc_loss`, computed by a single forward and backward sweep, without gradient of any input.
+ *  Every valid frame sums to `1`, padding frames and sequences with impossible alignment are all zeros.
+ *
+ *  Only blank and classes of the target can be occupied, so with `top_k > 0` it is returned in sparse form
+ *  of `top_k` most occupied classes of every frame, in descending order.
+ *
+ *  Return: `[posteriors]` of size `(T, N, C)` (or `(N, T, C)` with `batch_first`) with `top_k == 0`,
+ *  or `[values, classes]` of size `(T, N, top_k)` (or `(N, T, top_k)`) otherwise, where `classes` are padded
+ *  with blank and zero values. Posteriors are `float32`, classes are `int32`.
+ **/
+std::vector<array> ctc_posteriors(
+  /**
+   *  The logarithmized probabilities of the outputs of size `(T, N, C)`
+   *  (or `(N, T, C)` with `batch_first`), with any strides.
+   */
+  const array& log_probs,
+  /**
+   *  Target sequences of size `(N, S)`.
+   */
+  const array& targets,
+  /**
+   *  Lengths of the inputs of size `(N)` (must each be <= `T`).
+   */
+  const array& input_lengths,
+  /**
+   *  Lengths of the targets of size `(N)` (must each be <= `S`).
+   */
+  const array& target_lengths,
+  uint64_t blank = 0,       // Blank label, default `0`.
+  int top_k = 0,            // Number of most occupied classes of every frame, `0` for dense output
+  bool batch_first = false, // `log_probs` (and outputs) are `(N, T, C)`
+  StreamOrDevice s = {}     // Stream on which to schedule the operation, default is CPU
+);
+
+/**
+ *  Chunk of streaming CTC forward pass (CPU only).
+ *
+ *  Advances alpha rows of every sequence over a chunk of frames `log_probs[t0:t1]`, so inputs of any length
+ *  are consumed with memory bounded by chunk size. Chaining chunks gives the same loss as `ctc_loss` of whole
+ *  input, computed by the same recurrence.
+ *
+ *  `state` is the last alpha row of previous chunk: `(N, 2S+2)` `float32` log-probabilities of extended label
+ *  positions (as rows of `log_alpha`). Without `state`, alpha of a virtual frame before the input is used
+ *  (`0` at first position, `-inf` elsewhere), from which the recurrence produces initial alpha.
+ *
+ *  Gradient flows back through `state`, so chained chunks are differentiable as a whole. It is the exact derivative
+ *  with respect to `log_probs` (`ctc_loss` assumes log-softmax inputs, as `torch` does), so both agree on gradient
+ *  with respect to logits.
+ *
+ *  Return: `[state, loss]`, where `state` is `(N, 2S+2)` `float32` alpha row after the chunk, and `loss` is `(N)`
+ *  `float32` negative log-likelihood of target given frames consumed so far (`inf` when alignment is impossible).
+ **/
+std::vector<array> ctc_loss_chunk(
+  /**
+   *  The logarithmized probabilities of chunk frames of size `(Tc, N, C)`
+   *  (or `(N, Tc, C)` with `batch_first`), with any strides.
+   */
+  const array& log_probs,
+  /**
+   *  Target sequences of size `(N, S)`, the same for every chunk.
+   */
+  const array& targets,
+  /**
+   *  Numbers of chunk frames belonging to every sequence of size `(N)` (must each be <= `Tc`),
+   *  e.g. `clip(input_lengths - t0, 0, Tc)`. Sequences with `0` frames keep their state.
+   */
+  const array& chunk_lengths,
+  /**
+   *  Lengths of the targets of size `(N)` (must each be <= `S`).
+   */
+  const array& target_lengths,
+  const std::optional<array>& state = std::nullopt, // Alpha row returned for previous chunk
+  uint64_t blank = 0,       // Blank label, default `0`.
+  bool batch_first = false, // `log_probs` are `(N, Tc, C)`
+  StreamOrDevice s = {}     // Stream on which to schedule the operation, default is CPU
+);
+
+/**
+ *  The RNN-Transducer loss (CPU only).
+ *
+ *  Sums probability of all monotonic alignments of `T` frames to `U` target labels over `(T, U+1)` lattice,
+ *  where every node emits either blank (advancing frame) or next label (advancing target).
+ *  Lattice is computed by anti-diagonals, whose nodes do not depend on each other.
+ *
+ *  With `fused_log_softmax`, `logits` are normalized on the fly (normalizers are kept for backward pass), and
+ *  gradient is computed with respect to `logits` directly. Neither log-probabilities nor gradient with respect
+ *  to them are materialized, and when `logits` buffer can be donated, gradient is written over it.
+ *
+ *  Return: `(N)`, where `N = batch size`, or scalar when reduced
+ **/
+array rnnt_loss(
+  /**
+   *  Joint network outputs of size `(N, T, U+1, C)`, where
+   *  `N = batch size`, `T = max input length`, `U = max target length` and
+   *  `C = number of classes` (including blank): logits with `fused_log_softmax`, log-probabilities otherwise.
+   *  Any strides are accepted.
+   */
+  const array& logits,
+  /**
+   *  Target sequences of size `(N, U)`, padded to the length of the longest sequence.
+   */
+  const array& targets,
+  /**
+   *  Lengths of the inputs of size `(N)` (must each be in `[1, T]`).
+   */
+  const array& logit_lengths,
+  /**
+   *  Lengths of the targets of size `(N)` (must each be <= `U`).
+   */
+  const array& target_lengths,
+  uint64_t blank = 0, // Blank label, default `0`.
+  /**
+   *  Reduction of per-sample losses: `"none"` (default), `"sum"` or `"mean"`.
+   *  Unlike `ctc_loss`, `"mean"` divides by batch size only.
+   */
+  const std::string& reduction = "none",
+  bool fused_log_softmax = true, // `logits` are unnormalized, log-softmax is fused into loss and gradient
+  StreamOrDevice s = {}          // Stream on which to schedule the operation, default is CPU
+);
+
+/**
+ *  Set number of threads used by the CPU implementation.
+ *
+ *  Batch items are distributed across threads (or label positions of long targets, for batches smaller than
+ *  thread count), so results are identical for any thread count.
+ *  `0` resets to the number of hardware threads (default).
+ **/
+void ctc_set_num_threads(int num_threads);
+
+/**
+ *  Number of threads used by the CPU implementation.
+ **/
+int ctc_get_num_threads();
+
+/**
+ *  Counters of `CTCLoss` and `CTCLossVJP` evaluations since last reset, collected while enabled.
+ *
+ *  Phase times are in nanoseconds, measured by the CPU implementation and summed over worker threads:
+ *  `alloc` of outputs, `alpha` recurrence (including recomputation between checkpoints), `final` loss reduction,
+ *  `beta` sweep (beta recurrence with occupancy and gradient rows, which alternate every frame) and `vjp_final`
+ *  (gradient of padding frames).
+ *  GPU evaluations count calls and allocated bytes only, as their kernels run asynchronously.
+ *  Cells are positions of `(T, N, 2S+1)` lattice within (valid) or outside (padded) sequence lengths.
+ *  Linear fallbacks count passes of sequences recomputed in log space by `linear_space` loss.
+ **/
+struct CTCStats {
+  uint64_t forward_calls;
+  uint64_t backward_calls;
+  uint64_t alloc_ns;
+  uint64_t alpha_ns;
+  uint64_t final_ns;
+  uint64_t beta_ns;
+  uint64_t vjp_final_ns;
+  uint64_t bytes_allocated;
+  uint64_t valid_cells;
+  uint64_t padded_cells;
+  uint64_t linear_fallbacks;
+};
+
+/**
+ *  Enable or disable collection of `CTCStats` (disabled by default).
+ *
+ *  Throws when instrumentation is compiled out (`MLX_CTC_STATS` is not defined).
+ **/
+void ctc_set_stats_enabled(bool enabled);
+
+/**
+ *  Whether `CTCStats` are being collected.
+ **/
+bool ctc_get_stats_enabled();
+
+/**
+ *  Snapshot of `CTCStats` collected since last reset.
+ **/
+CTCStats ctc_get_stats();
+
+/**
+ *  Reset all `CTCStats` counters to zero.
+ **/
+void ctc_reset_stats();
+
 class CTCLoss : public Primitive {
 private:
   uint64_t blank_;
+  bool need_grad_;
+  size_t checkpoint_; // Alpha is stored every `checkpoint_` time steps
+  CTCReduction reduction_;
+  bool zero_infinity_;
+  bool batch_first_;
+  bool from_logits_; // Inputs are logits, normalized per frame on the fly
+  size_t max_deviation_; // Lattice is limited to band around diagonal, `0` for exact loss
+  bool linear_space_; // Recurrences run on rescaled probabilities, falling back to log space
 public:
-  explicit CTCLoss(Stream stream, uint64_t blank = 0) : Primitive(stream), blank_(blank) {};
+  explicit CTCLoss(
+    Stream stream,
+    uint64_t blank = 0,
+    bool need_grad = true,
+    size_t checkpoint = 1,
+    CTCReduction reduction = CTCReduction::none,
+    bool zero_infinity = false,
+    bool batch_first = false,
+    bool from_logits = false,
+    size_t max_deviation = 0,
+    bool linear_space = false
+  ) :
+    Primitive(stream),
+    blank_(blank),
+    need_grad_(need_grad),
+    checkpoint_(checkpoint),
+    reduction_(reduction),
+    zero_infinity_(zero_infinity),
+    batch_first_(batch_first),
+    from_logits_(from_logits),
+    max_deviation_(max_deviation),
+    linear_space_(linear_space) {};
   void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
   void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
   void print(std::ostream& os) override { os << "CTCLoss"; }
   bool is_equivalent(const Primitive& other) const override {
-    return static_cast<const CTCLoss&>(other).blank_ == blank_;
+    auto& o = static_cast<const CTCLoss&>(other);
+    return o.blank_ == blank_ && o.need_grad_ == need_grad_ && o.checkpoint_ == checkpoint_ &&
+      o.reduction_ == reduction_ && o.zero_infinity_ == zero_infinity_ && o.batch_first_ == batch_first_ &&
+      o.from_logits_ == from_logits_ && o.max_deviation_ == max_deviation_ && o.linear_space_ == linear_space_;
   }
 
   std::vector<array> vjp(
@@ -73,13 +479,220 @@ public:
 class CTCLossVJP : public Primitive {
 private:
   uint64_t blank_;
+  size_t checkpoint_;
+  CTCReduction reduction_;
+  bool zero_infinity_;
+  bool batch_first_;
+  bool from_logits_;
+  size_t max_deviation_;
+  bool linear_space_;
 public:
-  explicit CTCLossVJP(Stream stream, uint64_t blank = 0) : Primitive(stream), blank_(blank) {};
+  explicit CTCLossVJP(
+    Stream stream,
+    uint64_t blank = 0,
+    size_t checkpoint = 1,
+    CTCReduction reduction = CTCReduction::none,
+    bool zero_infinity = false,
+    bool batch_first = false,
+    bool from_logits = false,
+    size_t max_deviation = 0,
+    bool linear_space = false
+  ) :
+    Primitive(stream),
+    blank_(blank),
+    checkpoint_(checkpoint),
+    reduction_(reduction),
+    zero_infinity_(zero_infinity),
+    batch_first_(batch_first),
+    from_logits_(from_logits),
+    max_deviation_(max_deviation),
+    linear_space_(linear_space) {};
   void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
   void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
   void print(std::ostream& os) override { os << "CTCLossVJP"; }
   bool is_equivalent(const Primitive& other) const override {
-    return static_cast<const CTCLossVJP&>(other).blank_ == blank_;
+    auto& o = static_cast<const CTCLossVJP&>(other);
+    return o.blank_ == blank_ && o.checkpoint_ == checkpoint_ &&
+      o.reduction_ == reduction_ && o.zero_infinity_ == zero_infinity_ && o.batch_first_ == batch_first_ &&
+      o.from_logits_ == from_logits_ && o.max_deviation_ == max_deviation_ && o.linear_space_ == linear_space_;
+  }
+};
+
+class CTCGreedyDecode : public Primitive {
+private:
+  uint64_t blank_;
+  bool batch_first_;
+public:
+  explicit CTCGreedyDecode(Stream stream, uint64_t blank = 0, bool batch_first = false) :
+    Primitive(stream), blank_(blank), batch_first_(batch_first) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "CTCGreedyDecode"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const CTCGreedyDecode&>(other);
+    return o.blank_ == blank_ && o.batch_first_ == batch_first_;
+  }
+};
+
+class CTCBeamSearch : public Primitive {
+private:
+  uint64_t blank_;
+  size_t beam_width_;
+  size_t top_k_;
+  size_t num_best_;
+  bool batch_first_;
+  std::shared_ptr<const ctc::LMFusion> lm_;
+public:
+  explicit CTCBeamSearch(
+    Stream stream,
+    uint64_t blank = 0,
+    size_t beam_width = 8,
+    size_t top_k = 0,
+    size_t num_best = 1,
+    bool batch_first = false,
+    std::shared_ptr<const ctc::LMFusion> lm = nullptr
+  ) :
+    Primitive(stream),
+    blank_(blank),
+    beam_width_(beam_width),
+    top_k_(top_k),
+    num_best_(num_best),
+    batch_first_(batch_first),
+    lm_(std::move(lm)) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "CTCBeamSearch"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const CTCBeamSearch&>(other);
+    return o.blank_ == blank_ && o.beam_width_ == beam_width_ && o.top_k_ == top_k_ &&
+      o.num_best_ == num_best_ && o.batch_first_ == batch_first_ && o.lm_ == lm_;
+  }
+};
+
+class CTCForcedAlign : public Primitive {
+private:
+  uint64_t blank_;
+  bool batch_first_;
+public:
+  explicit CTCForcedAlign(Stream stream, uint64_t blank = 0, bool batch_first = false) :
+    Primitive(stream), blank_(blank), batch_first_(batch_first) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "CTCForcedAlign"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const CTCForcedAlign&>(other);
+    return o.blank_ == blank_ && o.batch_first_ == batch_first_;
+  }
+};
+
+class CTCPosteriors : public Primitive {
+private:
+  uint64_t blank_;
+  size_t top_k_;
+  bool batch_first_;
+public:
+  explicit CTCPosteriors(Stream stream, uint64_t blank = 0, size_t top_k = 0, bool batch_first = false) :
+    Primitive(stream), blank_(blank), top_k_(top_k), batch_first_(batch_first) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "CTCPosteriors"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const CTCPosteriors&>(other);
+    return o.blank_ == blank_ && o.top_k_ == top_k_ && o.batch_first_ == batch_first_;
+  }
+};
+
+class CTCLossChunk : public Primitive {
+private:
+  uint64_t blank_;
+  bool batch_first_;
+public:
+  explicit CTCLossChunk(Stream stream, uint64_t blank = 0, bool batch_first = false) :
+    Primitive(stream), blank_(blank), batch_first_(batch_first) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "CTCLossChunk"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const CTCLossChunk&>(other);
+    return o.blank_ == blank_ && o.batch_first_ == batch_first_;
+  }
+
+  std::vector<array> vjp(
+      const std::vector<array>& primals,
+      const std::vector<array>& cotangents,
+      const std::vector<int>& argnums,
+      const std::vector<array>& outputs) override;
+};
+
+class CTCLossChunkVJP : public Primitive {
+private:
+  uint64_t blank_;
+  bool batch_first_;
+public:
+  explicit CTCLossChunkVJP(Stream stream, uint64_t blank = 0, bool batch_first = false) :
+    Primitive(stream), blank_(blank), batch_first_(batch_first) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "CTCLossChunkVJP"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const CTCLossChunkVJP&>(other);
+    return o.blank_ == blank_ && o.batch_first_ == batch_first_;
+  }
+};
+
+class RNNTLoss : public Primitive {
+private:
+  uint64_t blank_;
+  CTCReduction reduction_;
+  bool fused_log_softmax_;
+public:
+  explicit RNNTLoss(
+    Stream stream,
+    uint64_t blank = 0,
+    CTCReduction reduction = CTCReduction::none,
+    bool fused_log_softmax = true
+  ) :
+    Primitive(stream),
+    blank_(blank),
+    reduction_(reduction),
+    fused_log_softmax_(fused_log_softmax) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "RNNTLoss"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const RNNTLoss&>(other);
+    return o.blank_ == blank_ && o.reduction_ == reduction_ && o.fused_log_softmax_ == fused_log_softmax_;
+  }
+
+  std::vector<array> vjp(
+      const std::vector<array>& primals,
+      const std::vector<array>& cotangents,
+      const std::vector<int>& argnums,
+      const std::vector<array>& outputs) override;
+};
+
+class RNNTLossVJP : public Primitive {
+private:
+  uint64_t blank_;
+  CTCReduction reduction_;
+  bool fused_log_softmax_;
+public:
+  explicit RNNTLossVJP(
+    Stream stream,
+    uint64_t blank = 0,
+    CTCReduction reduction = CTCReduction::none,
+    bool fused_log_softmax = true
+  ) :
+    Primitive(stream),
+    blank_(blank),
+    reduction_(reduction),
+    fused_log_softmax_(fused_log_softmax) {};
+  void eval_cpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) override;
+  void print(std::ostream& os) override { os << "RNNTLossVJP"; }
+  bool is_equivalent(const Primitive& other) const override {
+    auto& o = static_cast<const RNNTLossVJP&>(other);
+    return o.blank_ == blank_ && o.reduction_ == reduction_ && o.fused_log_softmax_ == fused_log_softmax_;
   }
 };
 
@@ -5,6 +5,8 @@
 #include "mlx/backend/metal/kernels/bf16.h"
 #include "mlx/backend/metal/kernels/utils.h"
 
+#include "ctc_loss/ctc_metal_config.h"
+
 #define MTL_DEVICEP device
 #define MTL_CONSTP  constant
 namespace stdlib = metal;
@@ -20,18 +22,49 @@ template <typename T>
 }
 
 template <typename T, typename I>
+[[kernel]] void ctc_loss_log_norm(
+  device   const      T* logits         [[buffer(0)]],
+  device   const      I* input_lengths  [[buffer(1)]],
+  device          float* log_norm       [[buffer(2)]],
+  constant const size_t& logp_stride_T  [[buffer(3)]],
+  constant const size_t& logp_stride_B  [[buffer(4)]],
+  constant const size_t& logp_stride_C  [[buffer(5)]],
+  constant const size_t& norm_stride_T  [[buffer(6)]],
+  constant const size_t& norm_stride_B  [[buffer(7)]],
+  constant const size_t& num_channels   [[buffer(8)]],
+  uint2 pos [[thread_position_in_grid]]
+) {
+  _ctc_loss_calc_log_norm(
+    input_lengths,
+    logits,
+    log_norm,
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    norm_stride_T, norm_stride_B,
+    num_channels,
+    pos.y, pos.x
+  );
+}
+
+template <typename T, typename A, typename I>
 [[kernel]] void ctc_loss_alpha(
   device   const      T* log_probs      [[buffer(0)]],
   device   const      I* targets        [[buffer(1)]],
   device   const      I* target_lengths [[buffer(2)]],
   device   const      I* input_lengths  [[buffer(3)]],
-  device              T* log_alpha      [[buffer(4)]],
-  constant const      I& blank          [[buffer(5)]],
-  constant const size_t& tgt_stride_B   [[buffer(6)]],
-  constant const size_t& loga_stride_T  [[buffer(7)]],
-  constant const size_t& loga_stride_B  [[buffer(8)]],
-  constant const size_t& logp_stride_T  [[buffer(9)]],
-  constant const size_t& logp_stride_B  [[buffer(10)]],
+  device   const  float* log_norm       [[buffer(4)]],
+  device              A* log_alpha      [[buffer(5)]],
+  constant const      I& blank          [[buffer(6)]],
+  constant const size_t& tgt_stride_B   [[buffer(7)]],
+  constant const size_t& loga_stride_T  [[buffer(8)]],
+  constant const size_t& loga_stride_B  [[buffer(9)]],
+  constant const size_t& logp_stride_T  [[buffer(10)]],
+  constant const size_t& logp_stride_B  [[buffer(11)]],
+  constant const size_t& logp_stride_C  [[buffer(12)]],
+  constant const size_t& loga_time_mask [[buffer(13)]],
+  constant const size_t& norm_stride_T  [[buffer(14)]],
+  constant const size_t& norm_stride_B  [[buffer(15)]],
+  constant const   bool& from_logits    [[buffer(16)]],
+  constant const size_t& max_deviation  [[buffer(17)]],
   uint2 bc [[thread_position_in_grid]]
 ) {
   size_t b = bc.y;
@@ -47,23 +80,31 @@ template <typename T, typename I>
         log_probs,
         log_alpha,
         tgt_stride_B,
-        logp_stride_T, logp_stride_B,
+        logp_stride_T, logp_stride_B, logp_stride_C,
         loga_stride_T, loga_stride_B,
+        loga_time_mask,
+        from_logits ? log_norm[norm_stride_T * t + norm_stride_B * b] : 0,
         blank,
+        input_length,
+        max_deviation,
         t, b, c
       );
     }
   }
 }
 
-template <typename T, typename I>
+template <typename T, typename A, typename I>
 [[kernel]] void ctc_loss_final(
   device   const      I* target_lengths [[buffer(0)]],
   device   const      I* input_lengths  [[buffer(1)]],
-  device   const      T* log_alpha      [[buffer(2)]],
+  device   const      A* log_alpha      [[buffer(2)]],
   device              T* loss           [[buffer(3)]],
   constant const size_t& loga_stride_T  [[buffer(4)]],
   constant const size_t& loga_stride_B  [[buffer(5)]],
+  constant const size_t& loga_time_mask [[buffer(6)]],
+  constant const size_t& reduction      [[buffer(7)]],
+  constant const   bool& zero_infinity  [[buffer(8)]],
+  constant const size_t& batch_size     [[buffer(9)]],
   uint b [[thread_position_in_grid]]
 ) {
   _ctc_loss_final(
@@ -72,61 +113,76 @@ template <typename T, typename I>
     log_alpha,
     loss,
     loga_stride_T, loga_stride_B,
+    loga_time_mask,
+    reduction, zero_infinity, batch_size,
     b
   );
 }
 
-template <typename T, typename I>
+template <typename T, typename A, typename I>
 [[kernel]] void ctc_loss_vjp(
   device   const      T* log_probs      [[buffer(0)]],
   device   const      I* targets        [[buffer(1)]],
   device   const      I* target_lengths [[buffer(2)]],
   device   const      I* input_lengths  [[buffer(3)]],
-  device              T* log_beta       [[buffer(4)]],
-  constant const      I& blank          [[buffer(5)]],
-  constant const size_t& tgt_stride_B   [[buffer(6)]],
-  constant const size_t& logb_stride_T  [[buffer(7)]],
-  constant const size_t& logb_stride_B  [[buffer(8)]],
-  constant const size_t& logp_stride_T  [[buffer(9)]],
-  constant const size_t& logp_stride_B  [[buffer(10)]],
+  device   const  float* log_norm       [[buffer(4)]],
+  device              A* log_beta       [[buffer(5)]],
+  constant const      I& blank          [[buffer(6)]],
+  constant const size_t& tgt_stride_B   [[buffer(7)]],
+  constant const size_t& logb_stride_T  [[buffer(8)]],
+  constant const size_t& logb_stride_B  [[buffer(9)]],
+  constant const size_t& logp_stride_T  [[buffer(10)]],
+  constant const size_t& logp_stride_B  [[buffer(11)]],
+  constant const size_t& logp_stride_C  [[buffer(12)]],
+  constant const size_t& norm_stride_T  [[buffer(13)]],
+  constant const size_t& norm_stride_B  [[buffer(14)]],
+  constant const   bool& from_logits    [[buffer(15)]],
+  constant const size_t& max_deviation  [[buffer(16)]],
   uint2 bc [[thread_position_in_grid]]
 ) {
   size_t b = bc.y;
   size_t c = bc.x;
+  size_t target_length = size_t(target_lengths[b]);
   size_t input_length = size_t(input_lengths[b]);
   for (size_t t = input_length; t-- > 0;) {
     metal::threadgroup_barrier(metal::mem_flags::mem_device);
-    _ctc_loss_vjp_calc_beta(
-      input_lengths,
-      target_lengths,
-      targets,
-      log_probs,
-      log_beta,
-      tgt_stride_B,
-      logp_stride_T, logp_stride_B,
-      logb_stride_T, logb_stride_B,
-      blank,
-      t, b, c
-    );
+    if (c <= target_length) {
+      _ctc_loss_vjp_calc_beta(
+        input_lengths,
+        target_lengths,
+        targets,
+        log_probs,
+        log_beta,
+        tgt_stride_B,
+        logp_stride_T, logp_stride_B, logp_stride_C,
+        logb_stride_T, logb_stride_B,
+        from_logits ? log_norm[norm_stride_T * t + norm_stride_B * b] : 0,
+        blank,
+        max_deviation,
+        t, b, c
+      );
+    }
   }
 }
 
-template <typename T, typename I>
+template <typename T, typename A, typename I>
 [[kernel]] void ctc_loss_vjp_grad_step(
   device   const      I* targets        [[buffer(0)]],
   device   const      I* target_lengths [[buffer(1)]],
-  device   const      T* log_alpha      [[buffer(2)]],
-  device   const      T* log_beta       [[buffer(3)]],
-  device              T* grad           [[buffer(4)]],
-  constant const      I& blank          [[buffer(5)]],
-  constant const size_t& tgt_stride_B   [[buffer(6)]],
-  constant const size_t& loga_stride_T  [[buffer(7)]],
-  constant const size_t& loga_stride_B  [[buffer(8)]],
-  constant const size_t& grad_stride_T  [[buffer(9)]],
-  constant const size_t& grad_stride_B  [[buffer(10)]],
+  device   const      I* input_lengths  [[buffer(2)]],
+  device   const      A* log_alpha      [[buffer(3)]],
+  device   const      A* log_beta       [[buffer(4)]],
+  device              T* grad           [[buffer(5)]],
+  constant const      I& blank          [[buffer(6)]],
+  constant const size_t& tgt_stride_B   [[buffer(7)]],
+  constant const size_t& loga_stride_T  [[buffer(8)]],
+  constant const size_t& loga_stride_B  [[buffer(9)]],
+  constant const size_t& grad_stride_T  [[buffer(10)]],
+  constant const size_t& grad_stride_B  [[buffer(11)]],
   uint2 pos [[thread_position_in_grid]]
 ) {
   _ctc_loss_vjp_grad_step(
+    input_lengths,
     target_lengths,
     targets,
     log_alpha,
@@ -141,33 +197,78 @@ template <typename T, typename I>
   );
 }
 
-template <typename T, typename I>
+template <typename T, typename A, typename I>
 [[kernel]] void ctc_loss_vjp_final(
-  device   const      T* log_probs     [[buffer(0)]],
-  device   const      I* input_lengths [[buffer(1)]],
-  device   const      T* nll           [[buffer(2)]],
-  device   const      T* ctg           [[buffer(3)]],
-  device              T* grad          [[buffer(4)]],
-  constant const size_t& logp_stride_T [[buffer(5)]],
-  constant const size_t& logp_stride_B [[buffer(6)]],
-  constant const size_t& grad_stride_T [[buffer(7)]],
-  constant const size_t& grad_stride_B [[buffer(8)]],
+  device   const      T* log_probs      [[buffer(0)]],
+  device   const      I* input_lengths  [[buffer(1)]],
+  device   const      I* target_lengths [[buffer(2)]],
+  device   const      A* log_alpha      [[buffer(3)]],
+  device   const      T* ctg            [[buffer(4)]],
+  device   const  float* log_norm       [[buffer(5)]],
+  device              T* grad           [[buffer(6)]],
+  constant const size_t& logp_stride_T  [[buffer(7)]],
+  constant const size_t& logp_stride_B  [[buffer(8)]],
+  constant const size_t& logp_stride_C  [[buffer(9)]],
+  constant const size_t& loga_stride_T  [[buffer(10)]],
+  constant const size_t& loga_stride_B  [[buffer(11)]],
+  constant const size_t& grad_stride_T  [[buffer(12)]],
+  constant const size_t& grad_stride_B  [[buffer(13)]],
+  constant const size_t& reduction      [[buffer(14)]],
+  constant const   bool& zero_infinity  [[buffer(15)]],
+  constant const size_t& batch_size     [[buffer(16)]],
+  constant const size_t& norm_stride_T  [[buffer(17)]],
+  constant const size_t& norm_stride_B  [[buffer(18)]],
+  constant const   bool& from_logits    [[buffer(19)]],
   uint3 pos [[thread_position_in_grid]]
 ) {
   _ctc_loss_vjp_final(
     input_lengths,
+    target_lengths,
     log_probs,
-    nll, ctg,
+    log_alpha,
+    ctg,
     grad,
-    logp_stride_T, logp_stride_B,
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    loga_stride_T, loga_stride_B,
     grad_stride_T, grad_stride_B,
+    reduction, zero_infinity, batch_size,
+    from_logits ? log_norm[norm_stride_T * pos.z + norm_stride_B * pos.y] : 0,
     pos.z, pos.y, pos.x
   );
 }
 
-#define inst_fn(base, tname, type, iname, indx, ...)          \
-  template [[kernel, host_name(#base "_" #tname "_" #iname)]] \
-  void base<type, indx>(__VA_ARGS__)
+template <typename T, typename I>
+[[kernel]] void ctc_greedy_decode(
+  device   const      T* log_probs        [[buffer(0)]],
+  device   const      I* input_lengths    [[buffer(1)]],
+  device        int32_t* labels           [[buffer(2)]],
+  device        int32_t* lengths          [[buffer(3)]],
+  constant const size_t& blank            [[buffer(4)]],
+  constant const size_t& logp_stride_T    [[buffer(5)]],
+  constant const size_t& logp_stride_B    [[buffer(6)]],
+  constant const size_t& logp_stride_C    [[buffer(7)]],
+  constant const size_t& labels_stride_B  [[buffer(8)]],
+  constant const size_t& num_channels     [[buffer(9)]],
+  constant const size_t& max_input_length [[buffer(10)]],
+  uint b [[thread_position_in_grid]]
+) {
+  _ctc_greedy_decode(
+    input_lengths,
+    log_probs,
+    labels,
+    lengths,
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    labels_stride_B,
+    num_channels,
+    max_input_length,
+    blank,
+    b
+  );
+}
+
+#define inst_fn(base, tname, type, aname, atyp, iname, indx, ...)        \
+  template [[kernel, host_name(#base "_" #tname "_" #aname "_" #iname)]] \
+  void base<type, atyp, indx>(__VA_ARGS__)
 
 #define inst_ctc_loss_fill(tname, type) \
   template [[kernel, host_name("ctc_loss_fill_z_" #tname)]] \
@@ -176,97 +277,192 @@ template <typename T, typename I>
     uint x [[thread_position_in_grid]] \
   )
 
-#define inst_ctc_loss_alpha(tname, type, iname, indx)     \
-  inst_fn(ctc_loss_alpha, tname, type, iname, indx,       \
-    device   const   type* log_probs      [[buffer(0)]],  \
-    device   const   indx* targets        [[buffer(1)]],  \
-    device   const   indx* target_lengths [[buffer(2)]],  \
-    device   const   indx* input_lengths  [[buffer(3)]],  \
-    device           type* log_alpha      [[buffer(4)]],  \
-    constant const   indx& blank          [[buffer(5)]],  \
-    constant const size_t& tgt_stride_B   [[buffer(6)]],  \
-    constant const size_t& loga_stride_T  [[buffer(7)]],  \
-    constant const size_t& loga_stride_B  [[buffer(8)]],  \
-    constant const size_t& logp_stride_T  [[buffer(9)]],  \
-    constant const size_t& logp_stride_B  [[buffer(10)]], \
-    uint2 bc [[thread_position_in_grid]]                  \
+#define inst_ctc_loss_alpha(tname, type, aname, atyp, iname, indx) \
+  inst_fn(ctc_loss_alpha, tname, type, aname, atyp, iname, indx,   \
+    device   const   type* log_probs      [[buffer(0)]],           \
+    device   const   indx* targets        [[buffer(1)]],           \
+    device   const   indx* target_lengths [[buffer(2)]],           \
+    device   const   indx* input_lengths  [[buffer(3)]],           \
+    device   const  float* log_norm       [[buffer(4)]],           \
+    device           atyp* log_alpha      [[buffer(5)]],           \
+    constant const   indx& blank          [[buffer(6)]],           \
+    constant const size_t& tgt_stride_B   [[buffer(7)]],           \
+    constant const size_t& loga_stride_T  [[buffer(8)]],           \
+    constant const size_t& loga_stride_B  [[buffer(9)]],           \
+    constant const size_t& logp_stride_T  [[buffer(10)]],          \
+    constant const size_t& logp_stride_B  [[buffer(11)]],          \
+    constant const size_t& logp_stride_C  [[buffer(12)]],          \
+    constant const size_t& loga_time_mask [[buffer(13)]],          \
+    constant const size_t& norm_stride_T  [[buffer(14)]],          \
+    constant const size_t& norm_stride_B  [[buffer(15)]],          \
+    constant const   bool& from_logits    [[buffer(16)]],          \
+    constant const size_t& max_deviation  [[buffer(17)]],          \
+    uint2 bc [[thread_position_in_grid]]                           \
+  )
+
+#define inst_ctc_loss_final(tname, type, aname, atyp, iname, indx) \
+  inst_fn(ctc_loss_final, tname, type, aname, atyp, iname, indx,   \
+    device   const   indx* target_lengths [[buffer(0)]],           \
+    device   const   indx* input_lengths  [[buffer(1)]],           \
+    device   const   atyp* log_alpha      [[buffer(2)]],           \
+    device           type* loss           [[buffer(3)]],           \
+    constant const size_t& loga_stride_T  [[buffer(4)]],           \
+    constant const size_t& loga_stride_B  [[buffer(5)]],           \
+    constant const size_t& loga_time_mask [[buffer(6)]],           \
+    constant const size_t& reduction      [[buffer(7)]],           \
+    constant const   bool& zero_infinity  [[buffer(8)]],           \
+    constant const size_t& batch_size     [[buffer(9)]],           \
+    uint b [[thread_position_in_grid]]                             \
+  )
+
+#define inst_ctc_loss_vjp(tname, type, aname, atyp, iname, indx) \
+  inst_fn(ctc_loss_vjp, tname, type, aname, atyp, iname, indx,   \
+    device   const   type* log_probs      [[buffer(0)]],         \
+    device   const   indx* targets        [[buffer(1)]],         \
+    device   const   indx* target_lengths [[buffer(2)]],         \
+    device   const   indx* input_lengths  [[buffer(3)]],         \
+    device   const  float* log_norm       [[buffer(4)]],         \
+    device           atyp* log_beta       [[buffer(5)]],         \
+    constant const   indx& blank          [[buffer(6)]],         \
+    constant const size_t& tgt_stride_B   [[buffer(7)]],         \
+    constant const size_t& logb_stride_T  [[buffer(8)]],         \
+    constant const size_t& logb_stride_B  [[buffer(9)]],         \
+    constant const size_t& logp_stride_T  [[buffer(10)]],        \
+    constant const size_t& logp_stride_B  [[buffer(11)]],        \
+    constant const size_t& logp_stride_C  [[buffer(12)]],        \
+    constant const size_t& norm_stride_T  [[buffer(13)]],        \
+    constant const size_t& norm_stride_B  [[buffer(14)]],        \
+    constant const   bool& from_logits    [[buffer(15)]],        \
+    constant const size_t& max_deviation  [[buffer(16)]],        \
+    uint2 bc [[thread_position_in_grid]]                         \
   )
 
-#define inst_ctc_loss_final(tname, type, iname, indx)    \
-  inst_fn(ctc_loss_final, tname, type, iname, indx,      \
-    device   const   indx* target_lengths [[buffer(0)]], \
-    device   const   indx* input_lengths  [[buffer(1)]], \
-    device   const   type* log_alpha      [[buffer(2)]], \
-    device           type* loss           [[buffer(3)]], \
-    constant const size_t& loga_stride_T  [[buffer(4)]], \
-    constant const size_t& loga_stride_B  [[buffer(5)]], \
-    uint b [[thread_position_in_grid]]                   \
+#define inst_ctc_loss_vjp_grad_step(tname, type, aname, atyp, iname, indx) \
+  inst_fn(ctc_loss_vjp_grad_step, tname, type, aname, atyp, iname, indx,   \
+    device   const   indx* targets        [[buffer(0)]],                   \
+    device   const   indx* target_lengths [[buffer(1)]],                   \
+    device   const   indx* input_lengths  [[buffer(2)]],                   \
+    device   const   atyp* log_alpha      [[buffer(3)]],                   \
+    device   const   atyp* log_beta       [[buffer(4)]],                   \
+    device           type* grad           [[buffer(5)]],                   \
+    constant const   indx& blank          [[buffer(6)]],                   \
+    constant const size_t& tgt_stride_B   [[buffer(7)]],                   \
+    constant const size_t& loga_stride_T  [[buffer(8)]],                   \
+    constant const size_t& loga_stride_B  [[buffer(9)]],                   \
+    constant const size_t& grad_stride_T  [[buffer(10)]],                  \
+    constant const size_t& grad_stride_B  [[buffer(11)]],                  \
+    uint2 pos [[thread_position_in_grid]]                                  \
   )
 
-#define inst_ctc_loss_vjp(tname, type, iname, indx)       \
-  inst_fn(ctc_loss_vjp, tname, type, iname, indx,         \
-    device   const   type* log_probs      [[buffer(0)]],  \
-    device   const   indx* targets        [[buffer(1)]],  \
-    device   const   indx* target_lengths [[buffer(2)]],  \
-    device   const   indx* input_lengths  [[buffer(3)]],  \
-    device           type* log_beta       [[buffer(4)]],  \
-    constant const   indx& blank          [[buffer(5)]],  \
-    constant const size_t& tgt_stride_B   [[buffer(6)]],  \
-    constant const size_t& logb_stride_T  [[buffer(7)]],  \
-    constant const size_t& logb_stride_B  [[buffer(8)]],  \
-    constant const size_t& logp_stride_T  [[buffer(9)]],  \
-    constant const size_t& logp_stride_B  [[buffer(10)]], \
-    uint2 bc [[thread_position_in_grid]]                  \
+#define inst_ctc_loss_vjp_final(tname, type, aname, atyp, iname, indx) \
+  inst_fn(ctc_loss_vjp_final, tname, type, aname, atyp, iname, indx,   \
+    device   const   type* log_probs      [[buffer(0)]],               \
+    device   const   indx* input_lengths  [[buffer(1)]],               \
+    device   const   indx* target_lengths [[buffer(2)]],               \
+    device   const   atyp* log_alpha      [[buffer(3)]],               \
+    device   const   type* ctg            [[buffer(4)]],               \
+    device   const  float* log_norm       [[buffer(5)]],               \
+    device           type* grad           [[buffer(6)]],               \
+    constant const size_t& logp_stride_T  [[buffer(7)]],               \
+    constant const size_t& logp_stride_B  [[buffer(8)]],               \
+    constant const size_t& logp_stride_C  [[buffer(9)]],               \
+    constant const size_t& loga_stride_T  [[buffer(10)]],              \
+    constant const size_t& loga_stride_B  [[buffer(11)]],              \
+    constant const size_t& grad_stride_T  [[buffer(12)]],              \
+    constant const size_t& grad_stride_B  [[buffer(13)]],              \
+    constant const size_t& reduction      [[buffer(14)]],              \
+    constant const   bool& zero_infinity  [[buffer(15)]],              \
+    constant const size_t& batch_size     [[buffer(16)]],              \
+    constant const size_t& norm_stride_T  [[buffer(17)]],              \
+    constant const size_t& norm_stride_B  [[buffer(18)]],              \
+    constant const   bool& from_logits    [[buffer(19)]],              \
+    uint3 pos [[thread_position_in_grid]]                              \
   )
 
-#define inst_ctc_loss_vjp_grad_step(tname, type, iname, indx) \
-  inst_fn(ctc_loss_vjp_grad_step, tname, type, iname, indx,   \
-    device   const   indx* targets        [[buffer(0)]],      \
-    device   const   indx* target_lengths [[buffer(1)]],      \
-    device   const   type* log_alpha      [[buffer(2)]],      \
-    device   const   type* log_beta       [[buffer(3)]],      \
-    device           type* grad           [[buffer(4)]],      \
-    constant const   indx& blank          [[buffer(5)]],      \
-    constant const size_t& tgt_stride_B   [[buffer(6)]],      \
-    constant const size_t& loga_stride_T  [[buffer(7)]],      \
-    constant const size_t& loga_stride_B  [[buffer(8)]],      \
-    constant const size_t& grad_stride_T  [[buffer(9)]],      \
-    constant const size_t& grad_stride_B  [[buffer(10)]],     \
-    uint2 pos [[thread_position_in_grid]]                     \
+#define inst_ctc_loss_log_norm(tname, type, iname, indx)                  \
+  template [[kernel, host_name("ctc_loss_log_norm_" #tname "_" #iname)]] \
+  void ctc_loss_log_norm<type, indx>(                                     \
+    device   const   type* logits         [[buffer(0)]],                  \
+    device   const   indx* input_lengths  [[buffer(1)]],                  \
+    device          float* log_norm       [[buffer(2)]],                  \
+    constant const size_t& logp_stride_T  [[buffer(3)]],                  \
+    constant const size_t& logp_stride_B  [[buffer(4)]],                  \
+    constant const size_t& logp_stride_C  [[buffer(5)]],                  \
+    constant const size_t& norm_stride_T  [[buffer(6)]],                  \
+    constant const size_t& norm_stride_B  [[buffer(7)]],                  \
+    constant const size_t& num_channels   [[buffer(8)]],                  \
+    uint2 pos [[thread_position_in_grid]]                                 \
   )
 
-#define inst_ctc_loss_vjp_final(tname, type, iname, indx) \
-  inst_fn(ctc_loss_vjp_final, tname, type, iname, indx,   \
-    device   const   type* log_probs     [[buffer(0)]],   \
-    device   const   indx* input_lengths [[buffer(1)]],   \
-    device   const   type* nll           [[buffer(2)]],   \
-    device   const   type* ctg           [[buffer(3)]],   \
-    device           type* grad          [[buffer(4)]],   \
-    constant const size_t& logp_stride_T [[buffer(5)]],   \
-    constant const size_t& logp_stride_B [[buffer(6)]],   \
-    constant const size_t& grad_stride_T [[buffer(7)]],   \
-    constant const size_t& grad_stride_B [[buffer(8)]],   \
-    uint3 pos [[thread_position_in_grid]]                 \
+#define inst_ctc_greedy_decode(tname, type, iname, indx)              \
+  template [[kernel, host_name("ctc_greedy_decode_" #tname "_" #iname)]] \
+  void ctc_greedy_decode<type, indx>(                                     \
+    device   const   type* log_probs        [[buffer(0)]],                \
+    device   const   indx* input_lengths    [[buffer(1)]],                \
+    device        int32_t* labels           [[buffer(2)]],                \
+    device        int32_t* lengths          [[buffer(3)]],                \
+    constant const size_t& blank            [[buffer(4)]],                \
+    constant const size_t& logp_stride_T    [[buffer(5)]],                \
+    constant const size_t& logp_stride_B    [[buffer(6)]],                \
+    constant const size_t& logp_stride_C    [[buffer(7)]],                \
+    constant const size_t& labels_stride_B  [[buffer(8)]],                \
+    constant const size_t& num_channels     [[buffer(9)]],                \
+    constant const size_t& max_input_length [[buffer(10)]],               \
+    uint b [[thread_position_in_grid]]                                    \
   )
 
-#define inst_ctc_loss_i(tname, type, iname, indx)        \
-  inst_ctc_loss_alpha(tname, type, iname, indx);         \
-  inst_ctc_loss_final(tname, type, iname, indx);         \
-  inst_ctc_loss_vjp(tname, type, iname, indx);           \
-  inst_ctc_loss_vjp_grad_step(tname, type, iname, indx); \
-  inst_ctc_loss_vjp_final(tname, type, iname, indx);
+#define inst_ctc_loss_i(tname, type, aname, atyp, iname, indx)        \
+  inst_ctc_loss_alpha(tname, type, aname, atyp, iname, indx);         \
+  inst_ctc_loss_final(tname, type, aname, atyp, iname, indx);         \
+  inst_ctc_loss_vjp(tname, type, aname, atyp, iname, indx);           \
+  inst_ctc_loss_vjp_grad_step(tname, type, aname, atyp, iname, indx); \
+  inst_ctc_loss_vjp_final(tname, type, aname, atyp, iname, indx);
+
+#define inst_ctc_loss_a(tname, type, aname, atyp)              \
+  inst_ctc_loss_i(tname, type, aname, atyp, uint64, uint64_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp,  int64,  int64_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp, uint32, uint32_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp,  int32,  int32_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp, uint16, uint16_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp,  int16,  int16_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp,  uint8,  uint8_t); \
+  inst_ctc_loss_i(tname, type, aname, atyp,   int8,   int8_t);
+
+// Alpha/beta are stored either in `float32` or in the input type
+inst_ctc_loss_a(float32 , float     , float32 , float     );
+inst_ctc_loss_a(float16 , half      , float32 , float     );
+inst_ctc_loss_a(float16 , half      , float16 , half      );
+inst_ctc_loss_a(bfloat16, bfloat16_t, float32 , float     );
+inst_ctc_loss_a(bfloat16, bfloat16_t, bfloat16, bfloat16_t);
+
+inst_ctc_loss_fill(float32 , float     );
+inst_ctc_loss_fill(float16 , half      );
+inst_ctc_loss_fill(bfloat16, bfloat16_t);
+
+#define inst_ctc_loss_log_norm_i(tname, type)           \
+  inst_ctc_loss_log_norm(tname, type, uint64, uint64_t); \
+  inst_ctc_loss_log_norm(tname, type,  int64,  int64_t); \
+  inst_ctc_loss_log_norm(tname, type, uint32, uint32_t); \
+  inst_ctc_loss_log_norm(tname, type,  int32,  int32_t); \
+  inst_ctc_loss_log_norm(tname, type, uint16, uint16_t); \
+  inst_ctc_loss_log_norm(tname, type,  int16,  int16_t); \
+  inst_ctc_loss_log_norm(tname, type,  uint8,  uint8_t); \
+  inst_ctc_loss_log_norm(tname, type,   int8,   int8_t);
+
+inst_ctc_loss_log_norm_i(float32 , float     );
+inst_ctc_loss_log_norm_i(float16 , half      );
+inst_ctc_loss_log_norm_i(bfloat16, bfloat16_t);
 
-#define inst_ctc_loss_all(tname, type)            \
-  inst_ctc_loss_i(tname, type, uint64, uint64_t); \
-  inst_ctc_loss_i(tname, type,  int64,  int64_t); \
-  inst_ctc_loss_i(tname, type, uint32, uint32_t); \
-  inst_ctc_loss_i(tname, type,  int32,  int32_t); \
-  inst_ctc_loss_i(tname, type, uint16, uint16_t); \
-  inst_ctc_loss_i(tname, type,  int16,  int16_t); \
-  inst_ctc_loss_i(tname, type,  uint8,  uint8_t); \
-  inst_ctc_loss_i(tname, type,   int8,   int8_t); \
-  inst_ctc_loss_fill(tname, type);
+#define inst_ctc_greedy_decode_i(tname, type)           \
+  inst_ctc_greedy_decode(tname, type, uint64, uint64_t); \
+  inst_ctc_greedy_decode(tname, type,  int64,  int64_t); \
+  inst_ctc_greedy_decode(tname, type, uint32, uint32_t); \
+  inst_ctc_greedy_decode(tname, type,  int32,  int32_t); \
+  inst_ctc_greedy_decode(tname, type, uint16, uint16_t); \
+  inst_ctc_greedy_decode(tname, type,  int16,  int16_t); \
+  inst_ctc_greedy_decode(tname, type,  uint8,  uint8_t); \
+  inst_ctc_greedy_decode(tname, type,   int8,   int8_t);
 
-inst_ctc_loss_all(float32 , float     );
-inst_ctc_loss_all(float16 , half      );
-inst_ctc_loss_all(bfloat16, bfloat16_t);
+inst_ctc_greedy_decode_i(float32 , float     );
+inst_ctc_greedy_decode_i(float16 , half      );
+inst_ctc_greedy_decode_i(bfloat16, bfloat16_t);
@@ -1,6 +1,14 @@
 // Copyright © 2024 Yury Popov (@djphoenix).
 
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cstdint>
+
 #include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_loss_simd.h"
+#include "ctc_loss/ctc_stats.h"
+#include "ctc_loss/thread_pool.h"
 
 namespace mlx::core {
 
@@ -8,224 +16,965 @@ namespace stdlib = std;
 #include "ctc_loss_impl.h"
 
 #define assert_contiguous(a) \
-  if (a.strides()[a.ndim()-1] != 1) throw std::runtime_error(#a " should be contiguous on last dimension")
+  if (a.ndim() > 0 && a.strides()[a.ndim()-1] != 1) throw std::runtime_error(#a " should be contiguous on last dimension")
 
-template <typename T, typename I>
+// Items are ordered by work in their valid region: `frame_cost` is extra per-frame work independent of target length
+template <typename I>
+static std::vector<size_t> ctc_loss_schedule(const I* inl_data, const I* tgl_data, size_t batch_size, size_t frame_cost = 0) {
+  std::vector<size_t> costs(batch_size);
+  for (size_t b = 0; b < batch_size; b++) {
+    costs[b] = size_t(inl_data[b]) * (size_t(tgl_data[b]) + 1 + frame_cost);
+  }
+  return ctc::schedule_by_cost(costs);
+}
+
+// Publishes per-call counters: outputs allocated by the call, and `(T, N, 2S+1)` lattice cells within sequence lengths
+template <typename I>
+static void ctc_loss_stats(
+  ctc::StatsCounter calls,
+  const I* inl_data,
+  const I* tgl_data,
+  size_t batch_size,
+  size_t max_input_length,
+  size_t max_target_length,
+  size_t bytes_allocated
+) {
+  size_t valid_cells = 0;
+  for (size_t b = 0; b < batch_size; b++) valid_cells += size_t(inl_data[b]) * (size_t(tgl_data[b]) * 2 + 1);
+  size_t total_cells = batch_size * max_input_length * (max_target_length * 2 + 1);
+  ctc::stats_add(calls, 1);
+  ctc::stats_add(ctc::StatsCounter::bytes_allocated, bytes_allocated);
+  ctc::stats_add(ctc::StatsCounter::valid_cells, valid_cells);
+  ctc::stats_add(ctc::StatsCounter::padded_cells, total_cells - std::min(valid_cells, total_cells));
+}
+
+/**
+ *  Fills rows `[t0, t1)` of `num_channels` elements, with single fill when rows are adjacent (e.g. `batch_first`).
+ **/
+template <typename T>
+static void ctc_fill_rows(T* data, size_t stride_T, size_t t0, size_t t1, size_t num_channels, T value) {
+  if (t0 >= t1) return;
+  if (stride_T == num_channels) {
+    std::fill_n(&data[stride_T * t0], (t1 - t0) * num_channels, value);
+    return;
+  }
+  for (size_t t = t0; t < t1; t++) std::fill_n(&data[stride_T * t], num_channels, value);
+}
+
+/**
+ *  Rows of `width` floats, each readable two elements before and after (`-inf` padding), as row kernels expect.
+ **/
+struct CTCRowBuffer {
+  size_t stride;
+  std::vector<float> buf;
+
+  CTCRowBuffer(size_t width, size_t num_rows) : stride(width + 4), buf(stride * num_rows, neginf<float>) {}
+
+  float* row(size_t i) { return &buf[stride * i + 2]; }
+
+  void fill(float value) { std::fill(buf.begin(), buf.end(), value); }
+};
+
+// Lowest log-probability of emission kept by linear-space recurrences relative to the largest one of its frame,
+// `exp` of which is a normal `float`
+static constexpr float kLinearMinLog = -87.f;
+
+// Highest log-probability taken as rounding of `0` by linear-space recurrences (`float16` epsilon)
+static constexpr float kLinearRoundLog = 0x1p-10f;
+
+// Linear-space rows are rescaled by powers of two, so that scaling is exact and its logarithm is `exponent * ln(2)`
+static constexpr double kLn2 = 0.693147180559945309417;
+
+// Exponent `e` of normal positive `x`, such that `2^e <= x < 2^(e+1)`
+static inline int ctc_exponent(float x) { return ((CTC_FLOAT_AS_INT(x) >> 23) & 0xff) - 127; }
+
+// 2^e, for `e` within normal range
+static inline float ctc_exp2(int e) { return CTC_INT_AS_FLOAT((e + 127) << 23); }
+
+/**
+ *  Per-sequence working set of whole-row CPU kernels.
+ *
+ *  Holds classes of extended label sequence (`blank, l0, blank, l1, ..., blank`), transition masks
+ *  and two padded rows of alpha (or beta), all in `float` with `-inf` padding. Layout of extended positions
+ *  matches `log_alpha` rows, so row `k` is stored as-is, followed by one `-inf` cell.
+ *
+ *  Gradient only has non-trivial terms for classes present in the sequence, so positions are also grouped
+ *  by slots of unique classes (`slot_class`), where per-frame occupancy is collected. Passes reading the same
+ *  frames more than once gather emissions of slots into dense time-major rows (`slot_emit`) first, and expand
+ *  them into positions, so scattered reads of class rows happen once per frame.
+ *
+ *  Row operations take slice `[k0, k1)` of positions, so that threads of a team can share a row.
+ *
+ *  Linear-space recurrences use the same rows and emissions holding probabilities, with `0` instead of `-inf`.
+ **/
+struct CTCRowState {
+  size_t num_pos;
+  size_t width;
+  std::vector<size_t> labels;
+  std::vector<size_t> slot_class;
+  std::vector<size_t> slot_of;
+  std::vector<size_t> slot_begin; // Positions of slot `i` are `slot_pos[slot_begin[i] : slot_begin[i+1]]`
+  std::vector<size_t> slot_pos;
+  std::vector<float> slot_occ;
+  std::vector<float> slot_emit;
+  std::vector<float> buf;
+  float* emit;
+  float* skip_a;
+  float* skip_b;
+  float* occ;
+  float* scratch;
+  CTCRowBuffer rows;
+
+  static size_t row_width(size_t target_length) {
+    return (target_length * 2 + 1 + ctc::kRowAlign - 1) / ctc::kRowAlign * ctc::kRowAlign;
+  }
+
+  template <typename I>
+  CTCRowState(const I* tgt_batch_data, size_t target_length, I blank) :
+    num_pos(target_length * 2 + 1),
+    width(row_width(target_length)),
+    labels(num_pos),
+    slot_of(num_pos),
+    slot_pos(num_pos),
+    buf(width * 5, neginf<float>),
+    rows(width, 2)
+  {
+    emit   = &buf[0];
+    skip_a = &buf[width];
+    skip_b = &buf[width * 2];
+    occ    = &buf[width * 3];
+    scratch = &buf[width * 4];
+    std::fill(occ, occ + width, 0.f);
+
+    for (size_t k = 0; k < num_pos; k++) {
+      labels[k] = size_t((k & 1) ? tgt_batch_data[k / 2] : blank);
+    }
+    for (size_t k = 1; k < num_pos; k += 2) {
+      if (k >= 2 && labels[k] != labels[k-2]) skip_a[k] = 0;
+      if (k + 2 < num_pos && labels[k] != labels[k+2]) skip_b[k] = 0;
+    }
+
+    slot_class.assign(labels.begin(), labels.end());
+    std::sort(slot_class.begin(), slot_class.end());
+    slot_class.erase(std::unique(slot_class.begin(), slot_class.end()), slot_class.end());
+    slot_occ.resize(slot_class.size());
+
+    // Counting sort of positions by slot, keeping them in ascending order within slot
+    slot_begin.assign(slot_class.size() + 1, 0);
+    for (size_t k = 0; k < num_pos; k++) {
+      slot_of[k] = std::lower_bound(slot_class.begin(), slot_class.end(), labels[k]) - slot_class.begin();
+      slot_begin[slot_of[k] + 1]++;
+    }
+    for (size_t i = 0; i < slot_class.size(); i++) slot_begin[i+1] += slot_begin[i];
+    std::vector<size_t> fill(slot_begin.begin(), slot_begin.end() - 1);
+    for (size_t k = 0; k < num_pos; k++) slot_pos[fill[slot_of[k]]++] = k;
+  }
+
+  float* row(size_t t) { return rows.row(t & 1); }
+
+  // `log_norm` is subtracted from inputs, to take log-probabilities from logits
+  template <typename T>
+  void gather(const T* logp_time_data, size_t logp_stride_C, float log_norm = 0, size_t k0 = 0, size_t k1 = SIZE_MAX) {
+    k1 = std::min(k1, num_pos);
+    for (size_t k = k0; k < k1; k++) emit[k] = float(logp_time_data[logp_stride_C * labels[k]]) - log_norm;
+  }
+
+  // Keeps rows of slot emissions for `num_frames` frames
+  void reserve_frames(size_t num_frames) { slot_emit.resize(num_frames * slot_class.size()); }
+
+  const float* slot_row(size_t i) const { return &slot_emit[slot_class.size() * i]; }
+
+  // Gathers emissions of slots `[i0, i1)` for frames `[t0, t1)` into rows `[0, t1 - t0)`, with normalizers `norm(t)`
+  template <typename T, typename F>
+  void gather_slots(
+    const T* logp_batch_data,
+    size_t logp_stride_T,
+    size_t logp_stride_C,
+    F&& norm,
+    size_t t0,
+    size_t t1,
+    size_t i0 = 0,
+    size_t i1 = SIZE_MAX
+  ) {
+    size_t num_slots = slot_class.size();
+    i1 = std::min(i1, num_slots);
+    for (size_t t = t0; t < t1; t++) {
+      const T* logp_time_data = &logp_batch_data[logp_stride_T * t];
+      float* dst = &slot_emit[num_slots * (t - t0)];
+      float log_norm = norm(t);
+      for (size_t i = i0; i < i1; i++) dst[i] = float(logp_time_data[logp_stride_C * slot_class[i]]) - log_norm;
+    }
+  }
+
+  // Emissions of positions from a row of `slot_emit`, same as `gather` of its frame
+  void expand(const float* slot_row, size_t k0 = 0, size_t k1 = SIZE_MAX) {
+    k1 = std::min(k1, num_pos);
+    for (size_t k = k0; k < k1; k++) emit[k] = slot_row[slot_of[k]];
+  }
+
+  // Converts emissions of `[k0, k1)` to probabilities divided by `2^shift`, zero outside band `[b0, b1)`, where
+  // `shift` is exponent of the largest emission in band, so that frames of any magnitude stay in `float` range.
+  // Emissions rounded above `0` (up to `kLinearRoundLog`) are clamped to `0`.
+  // Fails when emission in band is neither `-inf` nor within `kLinearMinLog` of the largest one.
+  bool emit_linear(const ctc::RowKernels& kernels, size_t k0, size_t k1, size_t b0, size_t b1, int& shift) {
+    size_t c0 = std::max(k0, b0);
+    size_t c1 = std::min({ k1, b1, num_pos });
+    shift = 0;
+    if (c0 >= c1) {
+      std::fill(emit + k0, emit + k1, 0.f);
+      return true;
+    }
+    for (size_t k = c0; k < c1; k++) emit[k] = (emit[k] > kLinearRoundLog) ? emit[k] : std::min(emit[k], 0.f);
+    float top = kernels.max(emit + c0, c1 - c0);
+    if (!std::isfinite(top)) {
+      std::fill(emit + k0, emit + k1, 0.f);
+      return top == neginf<float>;
+    }
+    bool invalid = false;
+    for (size_t k = c0; k < c1; k++) invalid |= (emit[k] < top + kLinearMinLog) & (emit[k] > neginf<float>);
+    if (invalid) return false;
+
+    // `exp(x - top) * exp(top - shift * ln(2))`, where the latter is within `[1, 2)`
+    shift = int(std::floor(top / kLn2));
+    kernels.scale_exp(emit + c0, -top, float(std::exp(top - shift * kLn2)), emit + c0, c1 - c0);
+    std::fill(emit + k0, emit + c0, 0.f);
+    std::fill(emit + c1, emit + std::max(c1, k1), 0.f);
+    return true;
+  }
+
+  // Fills rows and emissions with `zero` of recurrence (`-inf`, or `0` in linear space), and occupancy with `0`
+  void reset(float zero) {
+    rows.fill(zero);
+    std::fill(emit, emit + width, zero);
+    std::fill(occ, occ + width, 0.f);
+  }
+
+  void init_alpha(float* cur, size_t k0 = 0, size_t k1 = SIZE_MAX, float zero = neginf<float>) {
+    k1 = std::min(k1, width);
+    for (size_t k = k0; k < k1; k++) cur[k] = (k < std::min<size_t>(num_pos, 2)) ? emit[k] : zero;
+  }
+
+  void init_beta(float* cur, size_t k0 = 0, size_t k1 = SIZE_MAX, float zero = neginf<float>) {
+    k1 = std::min(k1, width);
+    for (size_t k = k0; k < k1; k++) cur[k] = (k < num_pos && k + 2 >= num_pos) ? emit[k] : zero;
+  }
+
+  template <typename T>
+  void store(const float* cur, T* dst, size_t k0 = 0, size_t k1 = SIZE_MAX) {
+    k1 = std::min(k1, num_pos + 1);
+    for (size_t k = k0; k < k1; k++) dst[k] = T(cur[k]);
+  }
+
+  // Stores linear-space row, holding probabilities `cur[k] * exp(log_scale)`, as log-probabilities
+  template <typename T>
+  void store_linear(const ctc::RowKernels& kernels, const float* cur, double log_scale, T* dst, size_t k0, size_t k1) {
+    k1 = std::min(k1, num_pos + 1);
+    if (k0 >= k1) return;
+    kernels.log(cur + k0, float(log_scale), scratch + k0, k1 - k0);
+    store(scratch, dst, k0, k1);
+  }
+
+  // Loads stored log-probabilities of band `[b0, b1)` into linear-space row relative to their maximum,
+  // which is returned; `[k0, k1)` is zero outside the band
+  template <typename T>
+  float load_linear(const ctc::RowKernels& kernels, const T* src, float* cur, size_t k0, size_t k1, size_t b0, size_t b1) {
+    load(src, cur, b0, b1);
+    float top = kernels.max(cur + b0, b1 - b0);
+    if (std::isfinite(top)) kernels.scale_exp(cur + b0, -top, 1, cur + b0, b1 - b0);
+    if (k0 < b0) std::fill(cur + k0, cur + std::min(k1, b0), 0.f);
+    if (b1 < k1) std::fill(cur + std::max(k0, b1), cur + k1, 0.f);
+    return top;
+  }
+
+  template <typename T>
+  void load(const T* src, float* cur, size_t k0 = 0, size_t k1 = SIZE_MAX) {
+    k1 = std::min(k1, num_pos + 1);
+    for (size_t k = k0; k < k1; k++) cur[k] = float(src[k]);
+  }
+
+  // Sums occupancy of slots `[i0, i1)` from `occ`, adding positions of every slot in ascending order
+  void collect(size_t i0, size_t i1) {
+    for (size_t i = i0; i < i1; i++) {
+      float sum = 0;
+      for (size_t j = slot_begin[i]; j < slot_begin[i+1]; j++) sum += occ[slot_pos[j]];
+      slot_occ[i] = sum;
+    }
+  }
+
+  // Sums occupancy `alpha * beta / (emit * p(l|x))` of extended positions into slots of their classes,
+  // with `emit` holding emissions of the frame
+  void accumulate(const ctc::RowKernels& kernels, const float* alpha, const float* beta, float nll) {
+    kernels.occupancy(alpha, beta, emit, nll, occ, width);
+    collect(0, slot_class.size());
+  }
+
+  float log_likelihood(const float* last) {
+    return (num_pos > 1) ? logaddexp(last[num_pos-2], last[num_pos-1]) : last[0];
+  }
+
+  // Same for linear-space row, scaled by `exp(log_scale)`
+  float log_likelihood_linear(const float* last, double log_scale) {
+    float p = (num_pos > 1) ? last[num_pos-2] + last[num_pos-1] : last[0];
+    return (p > 0) ? float(std::log(p) + log_scale) : neginf<float>;
+  }
+};
+
+/**
+ *  Feasible band of lattice rows of one sequence (see `_ctc_loss_band`).
+ *
+ *  Row kernels run over band of the frame widened to `kRowAlign` (`range`), split between ranks of a team,
+ *  and rows are kept `-inf` outside the band: cells computed around it are cleared by the rank which computed them,
+ *  cells left from band of the frame previously held by the same row are cleared by owners of fixed row slices.
+ **/
+struct CTCBand {
+  size_t num_pos;
+  size_t width;
+  size_t input_length;
+  size_t max_deviation;
+
+  std::pair<size_t, size_t> band(size_t t) const {
+    _ctc_band b = _ctc_loss_band(num_pos, input_length, max_deviation, t);
+    return { b.begin, b.end };
+  }
+
+  std::pair<size_t, size_t> range(size_t t) const {
+    auto [b0, b1] = band(t);
+    if (b0 >= b1) return { 0, 0 };
+    return { b0 / ctc::kRowAlign * ctc::kRowAlign, (b1 + ctc::kRowAlign - 1) / ctc::kRowAlign * ctc::kRowAlign };
+  }
+
+  // Part of `range(t)` computed by rank of `team`
+  std::pair<size_t, size_t> slice(const ctc::Team& team, size_t t) const {
+    auto [r0, r1] = range(t);
+    auto [s0, s1] = team.slice(r1 - r0, ctc::kRowAlign);
+    return { r0 + s0, r0 + s1 };
+  }
+
+  // Sets cells of `row` outside band of frame `t` to `value`, after this rank computed its slice of `range(t)`.
+  // Row held band of frame `prev` before (`SIZE_MAX` when it was never written).
+  void clear(float* row, const ctc::Team& team, size_t t, size_t prev, float value = neginf<float>) const {
+    auto fill = [&](size_t k0, size_t k1) {
+      if (k0 < k1) std::fill(row + k0, row + k1, value);
+    };
+    auto [b0, b1] = band(t);
+    auto [s0, s1] = slice(team, t);
+    fill(s0, std::min(s1, b0));
+    fill(std::max(s0, b1), s1);
+    if (prev == SIZE_MAX) return;
+    auto [r0, r1] = range(t);
+    auto [p0, p1] = band(prev);
+    auto [w0, w1] = team.slice(width, ctc::kRowAlign);
+    fill(std::max(p0, w0), std::min({ p1, r0, w1 }));
+    fill(std::max({ p0, r1, w0 }), std::min(p1, w1));
+  }
+};
+
+// Minimal slice of lattice row per thread of a team, below which barriers between steps cost more than they save
+static constexpr size_t kTeamSlice = 1024;
+
+/**
+ *  Runs `fn(b, max_team)` for every item of `order`, where rows are at most `max_width` positions.
+ *
+ *  Items are computed in parallel, unless there are fewer of them than threads: then they are computed
+ *  one by one, and `fn` splits rows of every item between `max_team` threads (see `ctc_loss_team`).
+ **/
+template <typename F>
+static void ctc_loss_for_each(const std::vector<size_t>& order, size_t max_width, F&& fn) {
+  auto& pool = ctc::ThreadPool::instance();
+  size_t max_team = std::min(pool.size(), max_width / kTeamSlice);
+  if (order.size() >= pool.size() || max_team < 2) {
+    return pool.parallel_for(order, [&](size_t b) { fn(b, size_t(1)); });
+  }
+  for (size_t b : order) fn(b, max_team);
+}
+
+// Number of threads sharing rows of `width` positions
+static size_t ctc_loss_team(size_t max_team, size_t width) {
+  return std::max<size_t>(1, std::min(max_team, width / kTeamSlice));
+}
+
+template <typename I>
+static size_t ctc_loss_max_width(const I* tgl_data, size_t batch_size) {
+  size_t max_target_length = 0;
+  for (size_t b = 0; b < batch_size; b++) max_target_length = std::max(max_target_length, size_t(tgl_data[b]));
+  return CTCRowState::row_width(max_target_length);
+}
+
+template <typename T, typename A, typename I>
 static void ctc_loss_impl(
   const array& log_probs,
   const array& targets,
   const array& input_lengths,
   const array& target_lengths,
   I blank,
+  bool need_grad,
+  size_t checkpoint,
+  size_t reduction,
+  bool zero_infinity,
+  bool batch_first,
+  bool from_logits,
+  size_t max_deviation,
+  bool linear_space,
   array& loss,
-  array& log_alpha
+  array& log_alpha,
+  array& log_norm
 ) {
-  size_t input_time_size   = log_probs.shape()[0];
-  size_t batch_size        = log_probs.shape()[1];
+  size_t axis_T            = batch_first ? 1 : 0;
+  size_t axis_B            = batch_first ? 0 : 1;
+  size_t input_time_size   = log_probs.shape()[axis_T];
+  size_t batch_size        = log_probs.shape()[axis_B];
+
+  bool stats = ctc::stats_enabled();
+  ctc::StatsLap call_lap(stats);
 
   loss.set_data(allocator::malloc_or_wait(loss.nbytes()));
   log_alpha.set_data(allocator::malloc_or_wait(log_alpha.nbytes()));
+  log_norm.set_data(allocator::malloc_or_wait(log_norm.nbytes()));
+  call_lap.lap(ctc::StatsPhase::alloc);
 
-  assert_contiguous(log_probs);
   assert_contiguous(targets);
   assert_contiguous(input_lengths);
   assert_contiguous(target_lengths);
   assert_contiguous(loss);
   assert_contiguous(log_alpha);
 
-  size_t logp_stride_T = log_probs.strides()[0];
-  size_t logp_stride_B = log_probs.strides()[1];
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
   size_t  tgt_stride_B = targets  .strides()[0];
   size_t loga_stride_T = log_alpha.strides()[0];
   size_t loga_stride_B = log_alpha.strides()[1];
+  size_t loga_time_mask = need_grad ? ~size_t(0) : size_t(1);
+  size_t norm_stride_T = from_logits ? log_norm.strides()[0] : 0;
+  size_t norm_stride_B = from_logits ? log_norm.strides()[1] : 0;
+  size_t num_channels  = log_probs.shape()[2];
 
   const T* logp_data = log_probs.data<T>();
   const I* tgt_data  = targets.data<I>();
   const I* inl_data  = input_lengths.data<I>();
   const I* tgl_data  = target_lengths.data<I>();
         T* loss_data = loss.data<T>();
-        T* loga_data = log_alpha.data<T>();
+        A* loga_data = log_alpha.data<A>();
+    float* norm_data = log_norm.data<float>();
 
-  for (size_t b = 0; b < batch_size; b++) {
-    for (size_t t = 0; t < inl_data[b]; t++) {
-      for (size_t c = 0; c <= tgl_data[b]; c++) {
-        _ctc_loss_calc_alpha(
-          tgl_data,
-          tgt_data,
-          logp_data,
-          loga_data,
-          tgt_stride_B,
-          logp_stride_T, logp_stride_B,
-          loga_stride_T, loga_stride_B,
-          blank,
-          t, b, c
-        );
+  auto& kernels = ctc::row_kernels();
+  std::vector<float> nll(batch_size);
+
+  if (stats) {
+    size_t bytes = loss.nbytes() + log_alpha.nbytes() + log_norm.nbytes();
+    ctc_loss_stats(ctc::StatsCounter::forward_calls, inl_data, tgl_data, batch_size, input_time_size, targets.shape()[1], bytes);
+  }
+
+  // Normalizing logits reads whole frames, so its cost is scheduled along with the lattice
+  // Linear-space recurrence keeps scale of rows in a single thread, so rows are not shared by teams
+  auto order = ctc_loss_schedule(inl_data, tgl_data, batch_size, from_logits ? num_channels : 0);
+  size_t max_width = linear_space ? 0 : ctc_loss_max_width(tgl_data, batch_size);
+  ctc_loss_for_each(order, max_width, [&](size_t b, size_t max_team) {
+    size_t input_length = size_t(inl_data[b]);
+    CTCRowState st(&tgt_data[tgt_stride_B * b], size_t(tgl_data[b]), blank);
+    CTCBand band { st.num_pos, st.width, input_length, max_deviation };
+
+    ctc::ThreadPool::instance().parallel_team(ctc_loss_team(max_team, st.width), [&](const ctc::Team& team) {
+      thread_local std::vector<float> buf;
+      ctc::StatsLap seq_lap(stats && team.rank == 0);
+
+      // Frames are normalized independently, so they are split between ranks by time
+      if (from_logits) {
+        for (size_t t = team.rank; t < input_length; t += team.size) {
+          const T* logp_time_data = &logp_data[logp_stride_T * t + logp_stride_B * b];
+          norm_data[norm_stride_T * t + norm_stride_B * b] =
+            ctc::log_sum_exp(kernels, ctc::dense_row(logp_time_data, logp_stride_C, num_channels, buf), num_channels);
+        }
+        team.sync();
       }
-    }
-    _ctc_loss_final(
-      tgl_data,
-      inl_data,
-      loga_data,
-      loss_data,
-      loga_stride_T, loga_stride_B,
-      b
-    );
+
+      // Linear space: row `t` holds alpha divided by `2^exponent`, accumulated from maxima of previous rows
+      // and shifts of emissions, and stored rows are converted back to log-probabilities. It returns without
+      // reaching barriers, so its teams are always of a single rank (`max_width` is zero).
+      auto alpha_linear = [&](float& log_likelihood) {
+        assert(team.size == 1);
+        int64_t exponent = 0;
+        float m = 0;
+        st.reset(0.f);
+        for (size_t t = 0; t < input_length; t++) {
+          float* cur = st.row(t);
+          float norm = from_logits ? norm_data[norm_stride_T * t + norm_stride_B * b] : 0;
+          auto [k0, k1] = band.slice(team, t);
+          auto [b0, b1] = band.band(t);
+          st.gather(&logp_data[logp_stride_T * t + logp_stride_B * b], logp_stride_C, norm, k0, k1);
+          int shift;
+          if (!st.emit_linear(kernels, k0, k1, b0, b1, shift)) return false;
+          exponent += shift;
+          if (t == 0) {
+            st.init_alpha(cur, k0, k1, 0.f);
+            m = kernels.max(cur + k0, k1 - k0);
+          } else {
+            int e = ctc_exponent(m);
+            exponent += e;
+            m = kernels.alpha_linear(st.row(t-1) + k0, st.emit + k0, st.skip_a + k0, ctc_exp2(-e), cur + k0, k1 - k0);
+          }
+          if (!(m > 0)) return false;
+          band.clear(cur, team, t, (t >= 2) ? t - 2 : SIZE_MAX, 0.f);
+          if (!need_grad) {
+            if (t + 2 >= input_length) {
+              st.store_linear(kernels, cur, exponent * kLn2, &loga_data[loga_stride_T * (t & loga_time_mask) + loga_stride_B * b], k0, k1);
+            }
+          } else if (t % checkpoint == 0) {
+            st.store_linear(kernels, cur, exponent * kLn2, &loga_data[loga_stride_T * (t / checkpoint) + loga_stride_B * b], k0, k1);
+          }
+        }
+        log_likelihood = st.log_likelihood_linear(st.row(input_length-1), exponent * kLn2);
+        return log_likelihood > neginf<float>;
+      };
+
+      float log_likelihood = neginf<float>;
+      bool linear = linear_space && input_length > 0;
+      if (linear && !alpha_linear(log_likelihood)) {
+        if (stats) ctc::stats_add(ctc::StatsCounter::linear_fallbacks, 1);
+        st.reset(neginf<float>);
+        linear = false;
+      }
+
+      // Cells off the band are never computed, and only the band (widened to `kRowAlign`) is stored
+      for (size_t t = 0; !linear && t < input_length; t++) {
+        float* cur = st.row(t);
+        float norm = from_logits ? norm_data[norm_stride_T * t + norm_stride_B * b] : 0;
+        auto [k0, k1] = band.slice(team, t);
+        st.gather(&logp_data[logp_stride_T * t + logp_stride_B * b], logp_stride_C, norm, k0, k1);
+        if (t == 0) {
+          st.init_alpha(cur, k0, k1);
+        } else {
+          kernels.alpha(st.row(t-1) + k0, st.emit + k0, st.skip_a + k0, cur + k0, k1 - k0);
+        }
+        band.clear(cur, team, t, (t >= 2) ? t - 2 : SIZE_MAX);
+        if (!need_grad) {
+          if (t + 2 >= input_length) {
+            st.store(cur, &loga_data[loga_stride_T * (t & loga_time_mask) + loga_stride_B * b], k0, k1);
+          }
+        } else if (t % checkpoint == 0) {
+          st.store(cur, &loga_data[loga_stride_T * (t / checkpoint) + loga_stride_B * b], k0, k1);
+        }
+        team.sync();
+      }
+      if (team.rank != 0) return;
+
+      if (from_logits) {
+        for (size_t t = input_length; t < input_time_size; t++) norm_data[norm_stride_T * t + norm_stride_B * b] = 0;
+      }
+      if (!linear && input_length > 0) log_likelihood = st.log_likelihood(st.row(input_length-1));
+      nll[b] = -log_likelihood;
+      if (_ctc_loss_zeroed(nll[b], zero_infinity)) nll[b] = 0;
+      seq_lap.lap(ctc::StatsPhase::alpha);
+    });
+  });
+
+  call_lap = ctc::StatsLap(stats);
+  if (reduction == ctc_reduction_none) {
+    for (size_t b = 0; b < batch_size; b++) loss_data[b] = T(nll[b]);
+    call_lap.lap(ctc::StatsPhase::final);
+    return;
   }
+  // Reduced in batch order, so result does not depend on thread count
+  float sum = 0;
+  for (size_t b = 0; b < batch_size; b++) {
+    sum += nll[b] * _ctc_loss_weight(reduction, size_t(tgl_data[b]), batch_size);
+  }
+  loss_data[0] = T(sum);
+  call_lap.lap(ctc::StatsPhase::final);
 }
 
-template <typename T, typename I>
+template <typename T, typename A, typename I>
 static void ctc_loss_vjp_impl(
   const array& log_probs,
   const array& targets,
   const array& input_lengths,
   const array& target_lengths,
   const array& log_alpha,
-  const array& nll,
   const array& ctg,
   I blank,
-  array& grad,
-  array& log_beta
+  size_t checkpoint,
+  size_t reduction,
+  bool zero_infinity,
+  bool batch_first,
+  bool from_logits,
+  size_t max_deviation,
+  bool linear_space,
+  const array& log_norm,
+  array& grad
 ) {
+  bool stats = ctc::stats_enabled();
+  ctc::StatsLap call_lap(stats);
+
   grad.set_data(allocator::malloc_or_wait(grad.nbytes()));
-  log_beta.set_data(allocator::malloc_or_wait(log_beta.nbytes()));
+  call_lap.lap(ctc::StatsPhase::alloc);
 
-  size_t max_input_length  = log_probs.shape()[0];
-  size_t batch_size        = log_probs.shape()[1];
+  size_t axis_T            = batch_first ? 1 : 0;
+  size_t axis_B            = batch_first ? 0 : 1;
+  size_t max_input_length  = log_probs.shape()[axis_T];
+  size_t batch_size        = log_probs.shape()[axis_B];
   size_t num_channels      = log_probs.shape()[2];
 
-  assert_contiguous(log_probs);
   assert_contiguous(targets);
   assert_contiguous(input_lengths);
   assert_contiguous(target_lengths);
   assert_contiguous(log_alpha);
-  assert_contiguous(nll);
   assert_contiguous(ctg);
   assert_contiguous(grad);
-  assert_contiguous(log_beta);
 
-  size_t logp_stride_T = log_probs.strides()[0];
-  size_t logp_stride_B = log_probs.strides()[1];
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
   size_t  tgt_stride_B = targets  .strides()[0];
   size_t loga_stride_T = log_alpha.strides()[0];
   size_t loga_stride_B = log_alpha.strides()[1];
-  size_t logb_stride_T = log_beta .strides()[0];
-  size_t logb_stride_B = log_beta .strides()[1];
-  size_t grad_stride_T = grad.strides()[0];
-  size_t grad_stride_B = grad.strides()[1];
+  size_t grad_stride_T = grad.strides()[axis_T];
+  size_t grad_stride_B = grad.strides()[axis_B];
+  size_t norm_stride_T = from_logits ? log_norm.strides()[0] : 0;
+  size_t norm_stride_B = from_logits ? log_norm.strides()[1] : 0;
 
   const T* logp_data = log_probs.data<T>();
   const I* tgt_data  = targets.data<I>();
   const I* inl_data  = input_lengths.data<I>();
   const I* tgl_data  = target_lengths.data<I>();
-  const T* loga_data = log_alpha.data<T>();
-  const T* nll_data  = nll.data<T>();
+  const A* loga_data = log_alpha.data<A>();
   const T* gro_data  = ctg.data<T>();
         T* grad_data = grad.data<T>();
-        T* logb_data = log_beta.data<T>();
+  const float* norm_data = log_norm.data<float>();
 
-  std::fill_n(grad_data, grad.data_size(), neginf<T>);
+  auto& kernels = ctc::row_kernels();
+  auto frame_norm = [&](size_t t, size_t b) {
+    return from_logits ? norm_data[norm_stride_T * t + norm_stride_B * b] : 0.f;
+  };
 
-  for (size_t b = 0; b < batch_size; b++) {
-    for (size_t t = inl_data[b]; t-- > 0;) {
-      for (size_t s = 0; s <= tgl_data[b]; s++) {
-        _ctc_loss_vjp_calc_beta(
-          inl_data,
-          tgl_data,
-          tgt_data,
-          logp_data,
-          logb_data,
-          tgt_stride_B,
-          logp_stride_T, logp_stride_B,
-          logb_stride_T, logb_stride_B,
-          blank,
-          t, b, s
-        );
+  if (stats) {
+    ctc_loss_stats(ctc::StatsCounter::backward_calls, inl_data, tgl_data, batch_size, max_input_length, targets.shape()[1], grad.nbytes());
+  }
+
+  // Single backward sweep per sequence: alpha rows come from stored lattice (recomputed between checkpoints),
+  // beta is kept in two rolling rows, and every gradient row is emitted as soon as its beta row is ready.
+  auto order = ctc_loss_schedule(inl_data, tgl_data, batch_size, num_channels);
+  size_t max_width = linear_space ? 0 : ctc_loss_max_width(tgl_data, batch_size);
+  ctc_loss_for_each(order, max_width, [&](size_t b, size_t max_team) {
+    size_t input_length = size_t(inl_data[b]);
+    CTCRowState st(&tgt_data[tgt_stride_B * b], size_t(tgl_data[b]), blank);
+    size_t alpha_rows = std::min(checkpoint, input_length);
+    CTCRowBuffer alpha(st.width, alpha_rows);
+    CTCBand band { st.num_pos, st.width, input_length, max_deviation };
+    st.reserve_frames(std::min(checkpoint, input_length));
+    float gr_b = float(gro_data[(reduction == ctc_reduction_none) ? b : 0]);
+    gr_b *= _ctc_loss_weight(reduction, size_t(tgl_data[b]), batch_size);
+
+    ctc::ThreadPool::instance().parallel_team(ctc_loss_team(max_team, st.width), [&](const ctc::Team& team) {
+      float nll_b = 0;
+      ctc::StatsLap seq_lap(stats && team.rank == 0);
+      // Backward sweep is timed per segment, as its beta and gradient steps alternate every frame
+      uint64_t alpha_ns = 0, beta_ns = 0;
+      // Frame previously held by a row reused every `step` frames, rows start as `-inf`
+      auto held = [&](size_t t, size_t step) { return (t + step < input_length) ? t + step : SIZE_MAX; };
+
+      // Gradient rows are split by classes, along with slots of these classes
+      auto [c0, c1] = team.slice(num_channels);
+      size_t i0 = std::lower_bound(st.slot_class.begin(), st.slot_class.end(), c0) - st.slot_class.begin();
+      size_t i1 = std::lower_bound(st.slot_class.begin(), st.slot_class.end(), c1) - st.slot_class.begin();
+
+      // Dense part `exp(lp)` for all classes, then posterior (occupancy of slot) is subtracted for classes
+      // of the sequence only. With logits `lp = x - norm`, and this is gradient with respect to logits
+      // (`softmax - posterior`).
+      auto grad_row = [&](size_t t, const float* slot_emit) {
+        const T* logp_time_data = &logp_data[logp_stride_T * t + logp_stride_B * b];
+              T* grad_time_data = &grad_data[grad_stride_T * t + grad_stride_B * b];
+        float norm = frame_norm(t, b);
+        for (size_t c = c0; c < c1; c++) {
+          grad_time_data[c] = T(std::exp(float(logp_time_data[logp_stride_C * c]) - norm) * gr_b);
+        }
+        for (size_t i = i0; i < i1; i++) {
+          grad_time_data[st.slot_class[i]] = T((std::exp(slot_emit[i]) - st.slot_occ[i]) * gr_b);
+        }
+      };
+
+      // Linear space: alpha rows of segment hold alpha divided by `exp(top) * 2^exponent[i]`, where `top` is
+      // maximum of checkpoint row, and beta row holds beta divided by `2^beta_exponent` (both exponents accumulate
+      // shifts of emissions). Occupancy takes both scales, so it matches log-space one, and gradient rows are
+      // the same. Teams are of a single rank, as for forward.
+      auto vjp_linear = [&]() {
+        assert(team.size == 1);
+        std::vector<int64_t> exponent(alpha_rows);
+        std::vector<float> row_max(alpha_rows);
+        int64_t beta_exponent = 0;
+        float beta_max = 0;
+        st.reset(0.f);
+        alpha.fill(0.f);
+        for (size_t seg = (input_length + checkpoint - 1) / checkpoint; seg-- > 0;) {
+          size_t t0 = seg * checkpoint;
+          size_t t1 = std::min(t0 + checkpoint, input_length);
+
+          auto [k0, k1] = band.slice(team, t0);
+          auto [b0, b1] = band.band(t0);
+          float top = st.load_linear(kernels, &loga_data[loga_stride_T * seg + loga_stride_B * b], alpha.row(0), k0, k1, b0, b1);
+          if (!std::isfinite(top)) return false;
+          band.clear(alpha.row(0), team, t0, held(t0, checkpoint), 0.f);
+          exponent[0] = 0;
+          row_max[0] = 1;
+          st.gather_slots(
+            &logp_data[logp_stride_B * b], logp_stride_T, logp_stride_C, [&](size_t t) { return frame_norm(t, b); },
+            t0, t1
+          );
+          for (size_t t = t0 + 1; t < t1; t++) {
+            size_t i = t - t0;
+            auto [k0, k1] = band.slice(team, t);
+            auto [b0, b1] = band.band(t);
+            st.expand(st.slot_row(i), k0, k1);
+            int shift;
+            if (!st.emit_linear(kernels, k0, k1, b0, b1, shift)) return false;
+            int e = ctc_exponent(row_max[i-1]);
+            row_max[i] = kernels.alpha_linear(
+              alpha.row(i-1) + k0, st.emit + k0, st.skip_a + k0, ctc_exp2(-e), alpha.row(i) + k0, k1 - k0
+            );
+            if (!(row_max[i] > 0)) return false;
+            exponent[i] = exponent[i-1] + e + shift;
+            band.clear(alpha.row(i), team, t, held(t, checkpoint), 0.f);
+          }
+          seq_lap.lap(alpha_ns);
+          if (t1 == input_length) {
+            float log_likelihood = st.log_likelihood_linear(alpha.row(t1 - t0 - 1), top + exponent[t1 - t0 - 1] * kLn2);
+            if (!(log_likelihood > neginf<float>)) return false;
+            nll_b = -log_likelihood;
+            if (_ctc_loss_zeroed(nll_b, zero_infinity)) {
+              ctc_fill_rows(&grad_data[grad_stride_B * b], grad_stride_T, 0, input_length, num_channels, T(0));
+              return true;
+            }
+          }
+
+          for (size_t t = t1; t-- > t0;) {
+            size_t i = t - t0;
+            const float* slot_emit = st.slot_row(i);
+            float* cur = st.row(t);
+            auto [k0, k1] = band.slice(team, t);
+            auto [b0, b1] = band.band(t);
+            st.expand(slot_emit, k0, k1);
+            int shift;
+            if (!st.emit_linear(kernels, k0, k1, b0, b1, shift)) return false;
+            beta_exponent += shift;
+            if (t == input_length-1) {
+              st.init_beta(cur, k0, k1, 0.f);
+              beta_max = kernels.max(cur + k0, k1 - k0);
+            } else {
+              int e = ctc_exponent(beta_max);
+              beta_exponent += e;
+              beta_max = kernels.beta_linear(st.row(t+1) + k0, st.emit + k0, st.skip_b + k0, ctc_exp2(-e), cur + k0, k1 - k0);
+            }
+            if (!(beta_max > 0)) return false;
+            band.clear(cur, team, t, held(t, 2), 0.f);
+
+            // Occupancy `alpha * beta / (emit * p(l|x))`, with alpha taken relative to its maximum,
+            // and shift of emission counted by both alpha and beta taken once
+            int e = ctc_exponent(row_max[i]);
+            double occ_scale = std::exp(top + double(exponent[i] + e + beta_exponent - shift) * kLn2 + nll_b);
+            if (!(occ_scale * beta_max < FLT_MAX)) return false;
+            kernels.occupancy_linear(
+              alpha.row(i) + k0, cur + k0, st.emit + k0, ctc_exp2(-e), float(occ_scale), st.occ + k0, k1 - k0
+            );
+            band.clear(st.occ, team, t, held(t, 1), 0.f);
+            st.collect(i0, i1);
+            grad_row(t, slot_emit);
+          }
+          seq_lap.lap(beta_ns);
+        }
+        return true;
+      };
+
+      bool linear = linear_space && input_length > 0;
+      if (linear && !vjp_linear()) {
+        if (stats) ctc::stats_add(ctc::StatsCounter::linear_fallbacks, 1);
+        st.reset(neginf<float>);
+        alpha.fill(neginf<float>);
+        linear = false;
       }
-      _ctc_loss_vjp_grad_step(
-        tgl_data,
-        tgt_data,
-        loga_data,
-        logb_data,
-        grad_data,
-        tgt_stride_B,
-        loga_stride_T, loga_stride_B,
-        logb_stride_T, logb_stride_B,
-        grad_stride_T, grad_stride_B,
-        blank,
-        t, b
-      );
-      for (size_t c = 0; c < num_channels; c++) {
-        _ctc_loss_vjp_final(
-          inl_data,
-          logp_data,
-          nll_data,
-          gro_data,
-          grad_data,
-          logp_stride_T, logp_stride_B,
-          grad_stride_T, grad_stride_B,
-          t, b, c
+
+      // Emissions of segment are gathered once for alpha, beta and gradient, every rank gathering its own slots
+      for (size_t seg = (input_length + checkpoint - 1) / checkpoint; !linear && seg-- > 0;) {
+        size_t t0 = seg * checkpoint;
+        size_t t1 = std::min(t0 + checkpoint, input_length);
+
+        auto [k0, k1] = band.slice(team, t0);
+        st.load(&loga_data[loga_stride_T * seg + loga_stride_B * b], alpha.row(0), k0, k1);
+        band.clear(alpha.row(0), team, t0, held(t0, checkpoint));
+        st.gather_slots(
+          &logp_data[logp_stride_B * b], logp_stride_T, logp_stride_C, [&](size_t t) { return frame_norm(t, b); },
+          t0, t1, i0, i1
         );
+        team.sync();
+        for (size_t t = t0 + 1; t < t1; t++) {
+          auto [k0, k1] = band.slice(team, t);
+          st.expand(st.slot_row(t - t0), k0, k1);
+          kernels.alpha(alpha.row(t - t0 - 1) + k0, st.emit + k0, st.skip_a + k0, alpha.row(t - t0) + k0, k1 - k0);
+          band.clear(alpha.row(t - t0), team, t, held(t, checkpoint));
+          team.sync();
+        }
+        seq_lap.lap(alpha_ns);
+        // Likelihood is taken from `float` alpha rather than from loss, which may be stored in half precision
+        if (t1 == input_length) {
+          nll_b = -st.log_likelihood(alpha.row(t1 - t0 - 1));
+          if (_ctc_loss_zeroed(nll_b, zero_infinity)) {
+            if (team.rank == 0) ctc_fill_rows(&grad_data[grad_stride_B * b], grad_stride_T, 0, input_length, num_channels, T(0));
+            break;
+          }
+        }
+
+        for (size_t t = t1; t-- > t0;) {
+          const float* slot_emit = st.slot_row(t - t0);
+          float* cur = st.row(t);
+          auto [k0, k1] = band.slice(team, t);
+          st.expand(slot_emit, k0, k1);
+          if (t == input_length-1) {
+            st.init_beta(cur, k0, k1);
+          } else {
+            kernels.beta(st.row(t+1) + k0, st.emit + k0, st.skip_b + k0, cur + k0, k1 - k0);
+          }
+          band.clear(cur, team, t, held(t, 2));
+          team.sync();
+
+          // Occupancy is zero off the band
+          kernels.occupancy(alpha.row(t - t0) + k0, cur + k0, st.emit + k0, nll_b, st.occ + k0, k1 - k0);
+          band.clear(st.occ, team, t, held(t, 1), 0.f);
+          team.sync();
+          st.collect(i0, i1);
+          grad_row(t, slot_emit);
+        }
+        seq_lap.lap(beta_ns);
       }
-    }
-    for (int t = inl_data[b]; t < max_input_length; t++) {
-      std::fill_n(&grad_data[grad_stride_T * t + grad_stride_B * b], num_channels, 0);
-    }
-  }
+      if (team.rank != 0) return;
+
+      // Padding frames
+      ctc_fill_rows(&grad_data[grad_stride_B * b], grad_stride_T, input_length, max_input_length, num_channels, T(0));
+      seq_lap.lap(ctc::StatsPhase::vjp_final);
+      if (stats) {
+        ctc::stats_add(ctc::StatsPhase::alpha, alpha_ns);
+        ctc::stats_add(ctc::StatsPhase::beta, beta_ns);
+      }
+    });
+  });
 }
 
-template <typename T>
+template <typename T, typename A>
 static void ctc_loss_impl_i(
   const array& log_probs,
   const array& targets,
   const array& input_lengths,
   const array& target_lengths,
   uint64_t blank,
+  bool need_grad,
+  size_t checkpoint,
+  size_t reduction,
+  bool zero_infinity,
+  bool batch_first,
+  bool from_logits,
+  size_t max_deviation,
+  bool linear_space,
   array& loss,
-  array& log_alpha
+  array& log_alpha,
+  array& log_norm
 ) {
   if (targets.dtype() == uint64 || targets.dtype() == int64) {
-    return ctc_loss_impl<T, uint64_t>(log_probs, targets, input_lengths, target_lengths, blank, loss, log_alpha);
+    return ctc_loss_impl<T, A, uint64_t>(log_probs, targets, input_lengths, target_lengths, blank, need_grad, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, loss, log_alpha, log_norm);
   }
   if (targets.dtype() == uint32 || targets.dtype() == int32) {
-    return ctc_loss_impl<T, uint32_t>(log_probs, targets, input_lengths, target_lengths, blank, loss, log_alpha);
+    return ctc_loss_impl<T, A, uint32_t>(log_probs, targets, input_lengths, target_lengths, blank, need_grad, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, loss, log_alpha, log_norm);
   }
   if (targets.dtype() == uint16 || targets.dtype() == int16) {
-    return ctc_loss_impl<T, uint16_t>(log_probs, targets, input_lengths, target_lengths, blank, loss, log_alpha);
+    return ctc_loss_impl<T, A, uint16_t>(log_probs, targets, input_lengths, target_lengths, blank, need_grad, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, loss, log_alpha, log_norm);
   }
   if (targets.dtype() == uint8 || targets.dtype() == int8) {
-    return ctc_loss_impl<T, uint8_t>(log_probs, targets, input_lengths, target_lengths, blank, loss, log_alpha);
+    return ctc_loss_impl<T, A, uint8_t>(log_probs, targets, input_lengths, target_lengths, blank, need_grad, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, loss, log_alpha, log_norm);
   }
   throw std::runtime_error("CTCLoss is only supported for integral targets.");
 }
 
-template <typename T>
+template <typename T, typename A>
 static void ctc_loss_vjp_impl_i(
   const array& log_probs,
   const array& targets,
   const array& input_lengths,
   const array& target_lengths,
   const array& log_alpha,
-  const array& nll,
   const array& ctg,
   uint64_t blank,
-  array& grad,
-  array& log_beta
+  size_t checkpoint,
+  size_t reduction,
+  bool zero_infinity,
+  bool batch_first,
+  bool from_logits,
+  size_t max_deviation,
+  bool linear_space,
+  const array& log_norm,
+  array& grad
 ) {
   if (targets.dtype() == uint64 || targets.dtype() == int64) {
-    return ctc_loss_vjp_impl<T, uint64_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank, grad, log_beta);
+    return ctc_loss_vjp_impl<T, A, uint64_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, log_norm, grad);
   }
   if (targets.dtype() == uint32 || targets.dtype() == int32) {
-    return ctc_loss_vjp_impl<T, uint32_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank, grad, log_beta);
+    return ctc_loss_vjp_impl<T, A, uint32_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, log_norm, grad);
   }
   if (targets.dtype() == uint16 || targets.dtype() == int16) {
-    return ctc_loss_vjp_impl<T, uint16_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank, grad, log_beta);
+    return ctc_loss_vjp_impl<T, A, uint16_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, log_norm, grad);
   }
   if (targets.dtype() == uint8 || targets.dtype() == int8) {
-    return ctc_loss_vjp_impl<T, uint8_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank, grad, log_beta);
+    return ctc_loss_vjp_impl<T, A, uint8_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, log_norm, grad);
   }
   throw std::runtime_error("CTCLossVJP is only supported for integral targets.");
 }
 
+// Alpha is stored either in `float` or in the input type
+template <typename T>
+static void ctc_loss_impl_a(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  bool need_grad,
+  size_t checkpoint,
+  size_t reduction,
+  bool zero_infinity,
+  bool batch_first,
+  bool from_logits,
+  size_t max_deviation,
+  bool linear_space,
+  array& loss,
+  array& log_alpha,
+  array& log_norm
+) {
+  if (log_alpha.dtype() == float32) {
+    return ctc_loss_impl_i<T, float>(log_probs, targets, input_lengths, target_lengths, blank, need_grad, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, loss, log_alpha, log_norm);
+  }
+  return ctc_loss_impl_i<T, T>(log_probs, targets, input_lengths, target_lengths, blank, need_grad, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, loss, log_alpha, log_norm);
+}
+
+template <typename T>
+static void ctc_loss_vjp_impl_a(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  const array& log_alpha,
+  const array& ctg,
+  uint64_t blank,
+  size_t checkpoint,
+  size_t reduction,
+  bool zero_infinity,
+  bool batch_first,
+  bool from_logits,
+  size_t max_deviation,
+  bool linear_space,
+  const array& log_norm,
+  array& grad
+) {
+  if (log_alpha.dtype() == float32) {
+    return ctc_loss_vjp_impl_i<T, float>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, log_norm, grad);
+  }
+  return ctc_loss_vjp_impl_i<T, T>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank, checkpoint, reduction, zero_infinity, batch_first, from_logits, max_deviation, linear_space, log_norm, grad);
+}
+
 void CTCLoss::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
   auto& log_probs      = inputs[0];
   auto& targets        = inputs[1];
@@ -233,15 +982,16 @@ void CTCLoss::eval_cpu(const std::vector<array>& inputs, std::vector<array>& out
   auto& target_lengths = inputs[3];
   auto& loss           = outarr[0];
   auto& log_alpha      = outarr[1];
+  auto& log_norm       = outarr[2];
 
   if (loss.dtype() == float32) {
-    return ctc_loss_impl_i<float>(log_probs, targets, input_lengths, target_lengths, blank_, loss, log_alpha);
+    return ctc_loss_impl_a<float>(log_probs, targets, input_lengths, target_lengths, blank_, need_grad_, checkpoint_, size_t(reduction_), zero_infinity_, batch_first_, from_logits_, max_deviation_, linear_space_, loss, log_alpha, log_norm);
   }
   if (loss.dtype() == float16) {
-    return ctc_loss_impl_i<float16_t>(log_probs, targets, input_lengths, target_lengths, blank_, loss, log_alpha);
+    return ctc_loss_impl_a<float16_t>(log_probs, targets, input_lengths, target_lengths, blank_, need_grad_, checkpoint_, size_t(reduction_), zero_infinity_, batch_first_, from_logits_, max_deviation_, linear_space_, loss, log_alpha, log_norm);
   }
   if (loss.dtype() == bfloat16) {
-    return ctc_loss_impl_i<bfloat16_t>(log_probs, targets, input_lengths, target_lengths, blank_, loss, log_alpha);
+    return ctc_loss_impl_a<bfloat16_t>(log_probs, targets, input_lengths, target_lengths, blank_, need_grad_, checkpoint_, size_t(reduction_), zero_infinity_, batch_first_, from_logits_, max_deviation_, linear_space_, loss, log_alpha, log_norm);
   }
   throw std::runtime_error("CTCLoss is only supported for floating point types.");
 }
@@ -252,22 +1002,675 @@ void CTCLossVJP::eval_cpu(const std::vector<array>& inputs, std::vector<array>&
   auto& input_lengths  = inputs[2];
   auto& target_lengths = inputs[3];
   auto& log_alpha      = inputs[4];
-  auto& nll            = inputs[5];
-  auto& ctg            = inputs[6];
+  auto& ctg            = inputs[5];
+  auto& log_norm       = inputs[6];
   auto& grad           = outarr[0];
 
-  array log_beta (log_alpha.shape(), log_alpha.dtype(), nullptr, {});
-
   if (grad.dtype() == float32) {
-    return ctc_loss_vjp_impl_i<float>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank_, grad, log_beta);
+    return ctc_loss_vjp_impl_a<float>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank_, checkpoint_, size_t(reduction_), zero_infinity_, batch_first_, from_logits_, max_deviation_, linear_space_, log_norm, grad);
   }
   if (grad.dtype() == float16) {
-    return ctc_loss_vjp_impl_i<float16_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank_, grad, log_beta);
+    return ctc_loss_vjp_impl_a<float16_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank_, checkpoint_, size_t(reduction_), zero_infinity_, batch_first_, from_logits_, max_deviation_, linear_space_, log_norm, grad);
   }
   if (grad.dtype() == bfloat16) {
-    return ctc_loss_vjp_impl_i<bfloat16_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg, blank_, grad, log_beta);
+    return ctc_loss_vjp_impl_a<bfloat16_t>(log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, blank_, checkpoint_, size_t(reduction_), zero_infinity_, batch_first_, from_logits_, max_deviation_, linear_space_, log_norm, grad);
   }
   throw std::runtime_error("CTCLossVJP is only supported for floating point types.");
 }
 
+template <typename T, typename I>
+static void ctc_greedy_decode_impl(
+  const array& log_probs,
+  const array& input_lengths,
+  uint64_t blank,
+  bool batch_first,
+  array& labels,
+  array& lengths
+) {
+  assert_contiguous(input_lengths);
+
+  labels.set_data(allocator::malloc_or_wait(labels.nbytes()));
+  lengths.set_data(allocator::malloc_or_wait(lengths.nbytes()));
+
+  size_t axis_T            = batch_first ? 1 : 0;
+  size_t axis_B            = batch_first ? 0 : 1;
+  size_t max_input_length  = log_probs.shape()[axis_T];
+  size_t batch_size        = log_probs.shape()[axis_B];
+  size_t num_channels      = log_probs.shape()[2];
+
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
+  size_t labels_stride_B = labels.strides()[0];
+
+  const T* logp_data = log_probs.data<T>();
+  const I* inl_data = input_lengths.data<I>();
+  int32_t* labels_data = labels.data<int32_t>();
+  int32_t* lengths_data = lengths.data<int32_t>();
+
+  std::vector<size_t> costs(batch_size);
+  for (size_t b = 0; b < batch_size; b++) costs[b] = size_t(inl_data[b]);
+
+  ctc::ThreadPool::instance().parallel_for(ctc::schedule_by_cost(costs), [&](size_t b) {
+    _ctc_greedy_decode<T, I>(
+      inl_data, logp_data,
+      labels_data, lengths_data,
+      logp_stride_T, logp_stride_B, logp_stride_C,
+      labels_stride_B,
+      num_channels,
+      max_input_length,
+      size_t(blank),
+      b
+    );
+  });
+}
+
+template <typename T>
+static void ctc_greedy_decode_impl_i(
+  const array& log_probs,
+  const array& input_lengths,
+  uint64_t blank,
+  bool batch_first,
+  array& labels,
+  array& lengths
+) {
+  if (input_lengths.dtype() == uint64 || input_lengths.dtype() == int64) {
+    return ctc_greedy_decode_impl<T, uint64_t>(log_probs, input_lengths, blank, batch_first, labels, lengths);
+  }
+  if (input_lengths.dtype() == uint32 || input_lengths.dtype() == int32) {
+    return ctc_greedy_decode_impl<T, uint32_t>(log_probs, input_lengths, blank, batch_first, labels, lengths);
+  }
+  if (input_lengths.dtype() == uint16 || input_lengths.dtype() == int16) {
+    return ctc_greedy_decode_impl<T, uint16_t>(log_probs, input_lengths, blank, batch_first, labels, lengths);
+  }
+  if (input_lengths.dtype() == uint8 || input_lengths.dtype() == int8) {
+    return ctc_greedy_decode_impl<T, uint8_t>(log_probs, input_lengths, blank, batch_first, labels, lengths);
+  }
+  throw std::runtime_error("CTCGreedyDecode is only supported for integral input lengths.");
+}
+
+void CTCGreedyDecode::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs     = inputs[0];
+  auto& input_lengths = inputs[1];
+  auto& labels        = outarr[0];
+  auto& lengths       = outarr[1];
+
+  if (log_probs.dtype() == float32) {
+    return ctc_greedy_decode_impl_i<float>(log_probs, input_lengths, blank_, batch_first_, labels, lengths);
+  }
+  if (log_probs.dtype() == float16) {
+    return ctc_greedy_decode_impl_i<float16_t>(log_probs, input_lengths, blank_, batch_first_, labels, lengths);
+  }
+  if (log_probs.dtype() == bfloat16) {
+    return ctc_greedy_decode_impl_i<bfloat16_t>(log_probs, input_lengths, blank_, batch_first_, labels, lengths);
+  }
+  throw std::runtime_error("CTCGreedyDecode is only supported for floating point types.");
+}
+
+template <typename T, typename I>
+static void ctc_forced_align_impl(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  bool batch_first,
+  array& labels,
+  array& segments,
+  array& scores
+) {
+  assert_contiguous(targets);
+  assert_contiguous(input_lengths);
+  assert_contiguous(target_lengths);
+
+  labels.set_data(allocator::malloc_or_wait(labels.nbytes()));
+  segments.set_data(allocator::malloc_or_wait(segments.nbytes()));
+  scores.set_data(allocator::malloc_or_wait(scores.nbytes()));
+
+  size_t axis_T            = batch_first ? 1 : 0;
+  size_t axis_B            = batch_first ? 0 : 1;
+  size_t max_input_length  = log_probs.shape()[axis_T];
+  size_t batch_size        = log_probs.shape()[axis_B];
+  size_t max_target_length = targets.shape()[1];
+
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
+  size_t  tgt_stride_B = targets.strides()[0];
+  size_t labels_stride_B = labels.strides()[0];
+  size_t   segm_stride_B = segments.strides()[0];
+
+  const T* logp_data = log_probs.data<T>();
+  const I* tgt_data = targets.data<I>();
+  const I* inl_data = input_lengths.data<I>();
+  const I* tgl_data = target_lengths.data<I>();
+  int32_t* labels_data = labels.data<int32_t>();
+  int32_t* segm_data = segments.data<int32_t>();
+  float* scores_data = scores.data<float>();
+
+  ctc::ThreadPool::instance().parallel_for(ctc_loss_schedule(inl_data, tgl_data, batch_size), [&](size_t b) {
+    size_t input_length = size_t(inl_data[b]);
+    size_t num_cells = size_t(tgl_data[b]) + 1;
+
+    // Two rolling rows of scores and 2-bit backpointers of every position, reused across batch items
+    static thread_local std::vector<float> delta;
+    static thread_local std::vector<uint8_t> backptr;
+    delta.resize(num_cells * 4);
+    backptr.resize(std::max<size_t>(input_length, 1) * num_cells);
+
+    for (size_t t = 0; t < input_length; t++) {
+      for (size_t c = 0; c < num_cells; c++) {
+        _ctc_align_calc_delta<T, I>(
+          tgl_data, tgt_data, logp_data,
+          delta.data(), backptr.data(),
+          tgt_stride_B,
+          logp_stride_T, logp_stride_B, logp_stride_C,
+          num_cells * 2, 0,
+          num_cells, 0,
+          I(blank),
+          t, b, c
+        );
+      }
+    }
+    scores_data[b] = _ctc_align_backtrack<I>(
+      inl_data, tgl_data, tgt_data,
+      delta.data(), backptr.data(),
+      labels_data, segm_data,
+      tgt_stride_B,
+      num_cells * 2, 0,
+      num_cells, 0,
+      labels_stride_B, segm_stride_B,
+      max_input_length, max_target_length,
+      I(blank),
+      b
+    );
+  });
+}
+
+template <typename T>
+static void ctc_forced_align_impl_i(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  bool batch_first,
+  array& labels,
+  array& segments,
+  array& scores
+) {
+  if (targets.dtype() == uint64 || targets.dtype() == int64) {
+    return ctc_forced_align_impl<T, uint64_t>(log_probs, targets, input_lengths, target_lengths, blank, batch_first, labels, segments, scores);
+  }
+  if (targets.dtype() == uint32 || targets.dtype() == int32) {
+    return ctc_forced_align_impl<T, uint32_t>(log_probs, targets, input_lengths, target_lengths, blank, batch_first, labels, segments, scores);
+  }
+  if (targets.dtype() == uint16 || targets.dtype() == int16) {
+    return ctc_forced_align_impl<T, uint16_t>(log_probs, targets, input_lengths, target_lengths, blank, batch_first, labels, segments, scores);
+  }
+  if (targets.dtype() == uint8 || targets.dtype() == int8) {
+    return ctc_forced_align_impl<T, uint8_t>(log_probs, targets, input_lengths, target_lengths, blank, batch_first, labels, segments, scores);
+  }
+  throw std::runtime_error("CTCForcedAlign is only supported for integral targets.");
+}
+
+void CTCForcedAlign::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs      = inputs[0];
+  auto& targets        = inputs[1];
+  auto& input_lengths  = inputs[2];
+  auto& target_lengths = inputs[3];
+  auto& labels         = outarr[0];
+  auto& segments       = outarr[1];
+  auto& scores         = outarr[2];
+
+  if (log_probs.dtype() == float32) {
+    return ctc_forced_align_impl_i<float>(log_probs, targets, input_lengths, target_lengths, blank_, batch_first_, labels, segments, scores);
+  }
+  if (log_probs.dtype() == float16) {
+    return ctc_forced_align_impl_i<float16_t>(log_probs, targets, input_lengths, target_lengths, blank_, batch_first_, labels, segments, scores);
+  }
+  if (log_probs.dtype() == bfloat16) {
+    return ctc_forced_align_impl_i<bfloat16_t>(log_probs, targets, input_lengths, target_lengths, blank_, batch_first_, labels, segments, scores);
+  }
+  throw std::runtime_error("CTCForcedAlign is only supported for floating point types.");
+}
+
+template <typename T, typename I>
+static void ctc_posteriors_impl(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  I blank,
+  size_t top_k,
+  bool batch_first,
+  std::vector<array>& outarr
+) {
+  assert_contiguous(targets);
+  assert_contiguous(input_lengths);
+  assert_contiguous(target_lengths);
+
+  for (auto& out : outarr) out.set_data(allocator::malloc_or_wait(out.nbytes()));
+
+  size_t axis_T            = batch_first ? 1 : 0;
+  size_t axis_B            = batch_first ? 0 : 1;
+  size_t max_input_length  = log_probs.shape()[axis_T];
+  size_t batch_size        = log_probs.shape()[axis_B];
+  size_t num_channels      = log_probs.shape()[2];
+  size_t row_size          = top_k ? top_k : num_channels;
+
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
+  size_t  tgt_stride_B = targets.strides()[0];
+  size_t  out_stride_T = outarr[0].strides()[axis_T];
+  size_t  out_stride_B = outarr[0].strides()[axis_B];
+
+  const T* logp_data = log_probs.data<T>();
+  const I* tgt_data  = targets.data<I>();
+  const I* inl_data  = input_lengths.data<I>();
+  const I* tgl_data  = target_lengths.data<I>();
+     float* post_data = outarr[0].data<float>();
+   int32_t* cls_data  = top_k ? outarr[1].data<int32_t>() : nullptr;
+
+  auto& kernels = ctc::row_kernels();
+
+  // Full alpha lattice of sequence is kept in `float`, beta is kept in two rolling rows,
+  // and every output row is written as soon as its beta row is ready.
+  ctc::ThreadPool::instance().parallel_for(ctc_loss_schedule(inl_data, tgl_data, batch_size), [&](size_t b) {
+    size_t input_length = size_t(inl_data[b]);
+    CTCRowState st(&tgt_data[tgt_stride_B * b], size_t(tgl_data[b]), blank);
+    CTCRowBuffer alpha(st.width, input_length);
+    std::vector<size_t> order(st.slot_class.size());
+    st.reserve_frames(input_length);
+    st.gather_slots(&logp_data[logp_stride_B * b], logp_stride_T, logp_stride_C, [](size_t) { return 0.f; }, 0, input_length);
+    float* post_batch_data = &post_data[out_stride_B * b];
+    int32_t* cls_batch_data = top_k ? &cls_data[out_stride_B * b] : nullptr;
+
+    auto clear_rows = [&](size_t t0) {
+      ctc_fill_rows(post_batch_data, out_stride_T, t0, max_input_length, row_size, 0.f);
+      if (top_k) ctc_fill_rows(cls_batch_data, out_stride_T, t0, max_input_length, row_size, int32_t(blank));
+    };
+
+    for (size_t t = 0; t < input_length; t++) {
+      st.expand(st.slot_row(t));
+      if (t == 0) {
+        st.init_alpha(alpha.row(0));
+      } else {
+        kernels.alpha(alpha.row(t-1), st.emit, st.skip_a, alpha.row(t), st.width);
+      }
+    }
+    float nll = (input_length > 0) ? -st.log_likelihood(alpha.row(input_length-1)) : -neginf<float>;
+    if (std::isinf(nll)) return clear_rows(0);
+    clear_rows(input_length);
+
+    for (size_t t = input_length; t-- > 0;) {
+      const float* slot_emit = st.slot_row(t);
+      float* post_time_data = &post_batch_data[out_stride_T * t];
+      float* cur = st.row(t);
+      st.expand(slot_emit);
+      if (t == input_length-1) {
+        st.init_beta(cur);
+      } else {
+        kernels.beta(st.row(t+1), st.emit, st.skip_b, cur, st.width);
+      }
+
+      st.accumulate(kernels, alpha.row(t), cur, nll);
+
+      if (!top_k) {
+        std::fill_n(post_time_data, num_channels, 0.f);
+        for (size_t i = 0; i < st.slot_class.size(); i++) post_time_data[st.slot_class[i]] = st.slot_occ[i];
+        continue;
+      }
+
+      // Ties are broken by class, so sparse output does not depend on sort implementation
+      int32_t* cls_time_data = &cls_batch_data[out_stride_T * t];
+      size_t num_top = std::min(top_k, order.size());
+      for (size_t i = 0; i < order.size(); i++) order[i] = i;
+      std::partial_sort(order.begin(), order.begin() + num_top, order.end(), [&](size_t x, size_t y) {
+        return (st.slot_occ[x] != st.slot_occ[y]) ? st.slot_occ[x] > st.slot_occ[y] : x < y;
+      });
+      for (size_t k = 0; k < top_k; k++) {
+        post_time_data[k] = (k < num_top) ? st.slot_occ[order[k]] : 0.f;
+        cls_time_data[k]  = (k < num_top) ? int32_t(st.slot_class[order[k]]) : int32_t(blank);
+      }
+    }
+  });
+}
+
+template <typename T>
+static void ctc_posteriors_impl_i(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  size_t top_k,
+  bool batch_first,
+  std::vector<array>& outarr
+) {
+  if (targets.dtype() == uint64 || targets.dtype() == int64) {
+    return ctc_posteriors_impl<T, uint64_t>(log_probs, targets, input_lengths, target_lengths, blank, top_k, batch_first, outarr);
+  }
+  if (targets.dtype() == uint32 || targets.dtype() == int32) {
+    return ctc_posteriors_impl<T, uint32_t>(log_probs, targets, input_lengths, target_lengths, blank, top_k, batch_first, outarr);
+  }
+  if (targets.dtype() == uint16 || targets.dtype() == int16) {
+    return ctc_posteriors_impl<T, uint16_t>(log_probs, targets, input_lengths, target_lengths, blank, top_k, batch_first, outarr);
+  }
+  if (targets.dtype() == uint8 || targets.dtype() == int8) {
+    return ctc_posteriors_impl<T, uint8_t>(log_probs, targets, input_lengths, target_lengths, blank, top_k, batch_first, outarr);
+  }
+  throw std::runtime_error("CTCPosteriors is only supported for integral targets.");
+}
+
+void CTCPosteriors::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs      = inputs[0];
+  auto& targets        = inputs[1];
+  auto& input_lengths  = inputs[2];
+  auto& target_lengths = inputs[3];
+
+  if (log_probs.dtype() == float32) {
+    return ctc_posteriors_impl_i<float>(log_probs, targets, input_lengths, target_lengths, blank_, top_k_, batch_first_, outarr);
+  }
+  if (log_probs.dtype() == float16) {
+    return ctc_posteriors_impl_i<float16_t>(log_probs, targets, input_lengths, target_lengths, blank_, top_k_, batch_first_, outarr);
+  }
+  if (log_probs.dtype() == bfloat16) {
+    return ctc_posteriors_impl_i<bfloat16_t>(log_probs, targets, input_lengths, target_lengths, blank_, top_k_, batch_first_, outarr);
+  }
+  throw std::runtime_error("CTCPosteriors is only supported for floating point types.");
+}
+
+template <typename T, typename I>
+static void ctc_loss_chunk_impl(
+  const array& log_probs,
+  const array& targets,
+  const array& chunk_lengths,
+  const array& target_lengths,
+  const array& state,
+  I blank,
+  bool batch_first,
+  array& next_state,
+  array& loss
+) {
+  assert_contiguous(targets);
+  assert_contiguous(chunk_lengths);
+  assert_contiguous(target_lengths);
+
+  // Every row of state is loaded before the same row is stored,
+  // so next state takes over previous one when nothing else holds it
+  if (state.is_donatable() && state.flags().row_contiguous) {
+    next_state.copy_shared_buffer(state);
+  } else {
+    next_state.set_data(allocator::malloc_or_wait(next_state.nbytes()));
+  }
+  loss.set_data(allocator::malloc_or_wait(loss.nbytes()));
+
+  size_t axis_T     = batch_first ? 1 : 0;
+  size_t axis_B     = batch_first ? 0 : 1;
+  size_t batch_size = log_probs.shape()[axis_B];
+  size_t state_size = next_state.shape()[1];
+
+  size_t  logp_stride_T = log_probs.strides()[axis_T];
+  size_t  logp_stride_B = log_probs.strides()[axis_B];
+  size_t  logp_stride_C = log_probs.strides()[2];
+  size_t   tgt_stride_B = targets.strides()[0];
+  size_t state_stride_B = state.strides()[0];
+  size_t state_stride_K = state.strides()[1];
+
+  const T* logp_data  = log_probs.data<T>();
+  const I* tgt_data   = targets.data<I>();
+  const I* chl_data   = chunk_lengths.data<I>();
+  const I* tgl_data   = target_lengths.data<I>();
+  const float* state_data = state.data<float>();
+        float* next_data  = next_state.data<float>();
+        float* loss_data  = loss.data<float>();
+
+  auto& kernels = ctc::row_kernels();
+
+  // Same steps as `ctc_loss` from its second frame, so chained chunks give the same rows
+  ctc::ThreadPool::instance().parallel_for(ctc_loss_schedule(chl_data, tgl_data, batch_size), [&](size_t b) {
+    size_t chunk_length = size_t(chl_data[b]);
+    CTCRowState st(&tgt_data[tgt_stride_B * b], size_t(tgl_data[b]), blank);
+
+    float* prev = st.row(0);
+    for (size_t k = 0; k < st.num_pos; k++) prev[k] = state_data[state_stride_B * b + state_stride_K * k];
+
+    for (size_t t = 0; t < chunk_length; t++) {
+      st.gather(&logp_data[logp_stride_T * t + logp_stride_B * b], logp_stride_C);
+      kernels.alpha(st.row(t), st.emit, st.skip_a, st.row(t+1), st.width);
+    }
+
+    float* cur = st.row(chunk_length);
+    float* next_batch_data = &next_data[state_size * b];
+    st.store(cur, next_batch_data);
+    std::fill(&next_batch_data[st.num_pos], &next_batch_data[state_size], neginf<float>);
+    loss_data[b] = -st.log_likelihood(cur);
+  });
+}
+
+template <typename T>
+static void ctc_loss_chunk_impl_i(
+  const array& log_probs,
+  const array& targets,
+  const array& chunk_lengths,
+  const array& target_lengths,
+  const array& state,
+  uint64_t blank,
+  bool batch_first,
+  array& next_state,
+  array& loss
+) {
+  if (targets.dtype() == uint64 || targets.dtype() == int64) {
+    return ctc_loss_chunk_impl<T, uint64_t>(log_probs, targets, chunk_lengths, target_lengths, state, blank, batch_first, next_state, loss);
+  }
+  if (targets.dtype() == uint32 || targets.dtype() == int32) {
+    return ctc_loss_chunk_impl<T, uint32_t>(log_probs, targets, chunk_lengths, target_lengths, state, blank, batch_first, next_state, loss);
+  }
+  if (targets.dtype() == uint16 || targets.dtype() == int16) {
+    return ctc_loss_chunk_impl<T, uint16_t>(log_probs, targets, chunk_lengths, target_lengths, state, blank, batch_first, next_state, loss);
+  }
+  if (targets.dtype() == uint8 || targets.dtype() == int8) {
+    return ctc_loss_chunk_impl<T, uint8_t>(log_probs, targets, chunk_lengths, target_lengths, state, blank, batch_first, next_state, loss);
+  }
+  throw std::runtime_error("CTCLossChunk is only supported for integral targets.");
+}
+
+void CTCLossChunk::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs      = inputs[0];
+  auto& targets        = inputs[1];
+  auto& chunk_lengths  = inputs[2];
+  auto& target_lengths = inputs[3];
+  auto& state          = inputs[4];
+  auto& next_state     = outarr[0];
+  auto& loss           = outarr[1];
+
+  if (log_probs.dtype() == float32) {
+    return ctc_loss_chunk_impl_i<float>(log_probs, targets, chunk_lengths, target_lengths, state, blank_, batch_first_, next_state, loss);
+  }
+  if (log_probs.dtype() == float16) {
+    return ctc_loss_chunk_impl_i<float16_t>(log_probs, targets, chunk_lengths, target_lengths, state, blank_, batch_first_, next_state, loss);
+  }
+  if (log_probs.dtype() == bfloat16) {
+    return ctc_loss_chunk_impl_i<bfloat16_t>(log_probs, targets, chunk_lengths, target_lengths, state, blank_, batch_first_, next_state, loss);
+  }
+  throw std::runtime_error("CTCLossChunk is only supported for floating point types.");
+}
+
+/**
+ *  Back-propagates cotangents of next state and loss through chunk frames.
+ *
+ *  Alpha rows of the chunk are recomputed by the same steps as forward pass. Every step is
+ *  `alpha[t+1][k] = emit[t][k] + logaddexp(alpha[t][k], alpha[t][k-1], alpha[t][k-2] + skip[k])`,
+ *  so gradient `g` of row `t+1` gives gradient of emission at `k` as is, and spreads to previous row with weights
+ *  `exp(alpha[t][j] + emit[t][k] - alpha[t+1][k])`. Unreachable cells (`-inf`) pass no gradient.
+ **/
+template <typename T, typename I>
+static void ctc_loss_chunk_vjp_impl(
+  const array& log_probs,
+  const array& targets,
+  const array& chunk_lengths,
+  const array& target_lengths,
+  const array& state,
+  const array& ctg_state,
+  const array& ctg_loss,
+  I blank,
+  bool batch_first,
+  array& grad,
+  array& grad_state
+) {
+  assert_contiguous(targets);
+  assert_contiguous(chunk_lengths);
+  assert_contiguous(target_lengths);
+
+  grad.set_data(allocator::malloc_or_wait(grad.nbytes()));
+  grad_state.set_data(allocator::malloc_or_wait(grad_state.nbytes()));
+
+  size_t axis_T       = batch_first ? 1 : 0;
+  size_t axis_B       = batch_first ? 0 : 1;
+  size_t batch_size   = log_probs.shape()[axis_B];
+  size_t max_chunk_length = log_probs.shape()[axis_T];
+  size_t num_channels = log_probs.shape()[2];
+  size_t state_size   = grad_state.shape()[1];
+
+  size_t  logp_stride_T = log_probs.strides()[axis_T];
+  size_t  logp_stride_B = log_probs.strides()[axis_B];
+  size_t  logp_stride_C = log_probs.strides()[2];
+  size_t  grad_stride_T = grad.strides()[axis_T];
+  size_t  grad_stride_B = grad.strides()[axis_B];
+  size_t   tgt_stride_B = targets.strides()[0];
+  size_t state_stride_B = state.strides()[0];
+  size_t state_stride_K = state.strides()[1];
+  size_t  ctgs_stride_B = ctg_state.strides()[0];
+  size_t  ctgs_stride_K = ctg_state.strides()[1];
+  size_t  ctgl_stride_B = ctg_loss.strides()[0];
+
+  const T* logp_data  = log_probs.data<T>();
+  const I* tgt_data   = targets.data<I>();
+  const I* chl_data   = chunk_lengths.data<I>();
+  const I* tgl_data   = target_lengths.data<I>();
+  const float* state_data = state.data<float>();
+  const float* ctgs_data  = ctg_state.data<float>();
+  const float* ctgl_data  = ctg_loss.data<float>();
+        T* grad_data  = grad.data<T>();
+        float* grst_data  = grad_state.data<float>();
+
+  auto& kernels = ctc::row_kernels();
+
+  ctc::ThreadPool::instance().parallel_for(ctc_loss_schedule(chl_data, tgl_data, batch_size), [&](size_t b) {
+    size_t chunk_length = size_t(chl_data[b]);
+    CTCRowState st(&tgt_data[tgt_stride_B * b], size_t(tgl_data[b]), blank);
+    CTCRowBuffer alpha(st.width, chunk_length + 1);
+
+    float* prev = alpha.row(0);
+    for (size_t k = 0; k < st.num_pos; k++) prev[k] = state_data[state_stride_B * b + state_stride_K * k];
+
+    for (size_t t = 0; t < chunk_length; t++) {
+      st.gather(&logp_data[logp_stride_T * t + logp_stride_B * b], logp_stride_C);
+      kernels.alpha(alpha.row(t), st.emit, st.skip_a, alpha.row(t+1), st.width);
+    }
+
+    // Gradient of the last row: cotangent of next state, and of loss through its final positions
+    std::vector<float> g_next(st.num_pos), g_prev(st.num_pos);
+    const float* last = alpha.row(chunk_length);
+    float log_likelihood = st.log_likelihood(last);
+    for (size_t k = 0; k < st.num_pos; k++) g_next[k] = ctgs_data[ctgs_stride_B * b + ctgs_stride_K * k];
+    if (std::isfinite(log_likelihood)) {
+      for (size_t k = (st.num_pos > 1) ? st.num_pos - 2 : 0; k < st.num_pos; k++) {
+        g_next[k] -= ctgl_data[ctgl_stride_B * b] * std::exp(last[k] - log_likelihood);
+      }
+    }
+
+    T* grad_batch_data = &grad_data[grad_stride_B * b];
+    ctc_fill_rows(grad_batch_data, grad_stride_T, 0, max_chunk_length, num_channels, T(0));
+
+    for (size_t t = chunk_length; t-- > 0;) {
+      const float* a = alpha.row(t);
+      const float* a_next = alpha.row(t+1);
+      st.gather(&logp_data[logp_stride_T * t + logp_stride_B * b], logp_stride_C);
+      std::fill(g_prev.begin(), g_prev.end(), 0.f);
+      std::fill(st.slot_occ.begin(), st.slot_occ.end(), 0.f);
+      for (size_t k = 0; k < st.num_pos; k++) {
+        if (g_next[k] == 0 || a_next[k] == neginf<float>) continue;
+        float g = g_next[k];
+        float e = st.emit[k] - a_next[k];
+        st.slot_occ[st.slot_of[k]] += g;
+        g_prev[k] += g * std::exp(a[k] + e);
+        if (k >= 1) g_prev[k-1] += g * std::exp(a[k-1] + e);
+        if (k >= 2) g_prev[k-2] += g * std::exp(a[k-2] + st.skip_a[k] + e);
+      }
+      T* grad_time_data = &grad_batch_data[grad_stride_T * t];
+      for (size_t i = 0; i < st.slot_class.size(); i++) grad_time_data[st.slot_class[i]] = T(st.slot_occ[i]);
+      std::swap(g_next, g_prev);
+    }
+
+    float* grst_batch_data = &grst_data[state_size * b];
+    std::copy(g_next.begin(), g_next.end(), grst_batch_data);
+    std::fill(&grst_batch_data[st.num_pos], &grst_batch_data[state_size], 0.f);
+  });
+}
+
+template <typename T>
+static void ctc_loss_chunk_vjp_impl_i(
+  const array& log_probs,
+  const array& targets,
+  const array& chunk_lengths,
+  const array& target_lengths,
+  const array& state,
+  const array& ctg_state,
+  const array& ctg_loss,
+  uint64_t blank,
+  bool batch_first,
+  array& grad,
+  array& grad_state
+) {
+  if (targets.dtype() == uint64 || targets.dtype() == int64) {
+    return ctc_loss_chunk_vjp_impl<T, uint64_t>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank, batch_first, grad, grad_state);
+  }
+  if (targets.dtype() == uint32 || targets.dtype() == int32) {
+    return ctc_loss_chunk_vjp_impl<T, uint32_t>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank, batch_first, grad, grad_state);
+  }
+  if (targets.dtype() == uint16 || targets.dtype() == int16) {
+    return ctc_loss_chunk_vjp_impl<T, uint16_t>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank, batch_first, grad, grad_state);
+  }
+  if (targets.dtype() == uint8 || targets.dtype() == int8) {
+    return ctc_loss_chunk_vjp_impl<T, uint8_t>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank, batch_first, grad, grad_state);
+  }
+  throw std::runtime_error("CTCLossChunkVJP is only supported for integral targets.");
+}
+
+void CTCLossChunkVJP::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs      = inputs[0];
+  auto& targets        = inputs[1];
+  auto& chunk_lengths  = inputs[2];
+  auto& target_lengths = inputs[3];
+  auto& state          = inputs[4];
+  auto& ctg_state      = inputs[5];
+  auto& ctg_loss       = inputs[6];
+  auto& grad           = outarr[0];
+  auto& grad_state     = outarr[1];
+
+  if (log_probs.dtype() == float32) {
+    return ctc_loss_chunk_vjp_impl_i<float>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank_, batch_first_, grad, grad_state);
+  }
+  if (log_probs.dtype() == float16) {
+    return ctc_loss_chunk_vjp_impl_i<float16_t>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank_, batch_first_, grad, grad_state);
+  }
+  if (log_probs.dtype() == bfloat16) {
+    return ctc_loss_chunk_vjp_impl_i<bfloat16_t>(log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss, blank_, batch_first_, grad, grad_state);
+  }
+  throw std::runtime_error("CTCLossChunkVJP is only supported for floating point types.");
+}
+
+void ctc_set_num_threads(int num_threads) {
+  if (num_threads < 0) throw std::invalid_argument("Number of threads should be non-negative.");
+  if (num_threads == 0) num_threads = std::max<int>(1, std::thread::hardware_concurrency());
+  ctc::ThreadPool::instance().resize(num_threads);
+}
+
+int ctc_get_num_threads() {
+  return int(ctc::ThreadPool::instance().size());
+}
+
 } // namespace mlx::core
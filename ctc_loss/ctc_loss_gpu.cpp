@@ -1,6 +1,7 @@
 // Copyright © 2024 Yury Popov (@djphoenix).
 
 #include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_stats.h"
 
 #ifdef _METAL_
 #include "mlx/backend/metal/device.h"
@@ -10,7 +11,7 @@
 namespace mlx::core {
 
 #define assert_contiguous(a) \
-  if (a.strides()[a.ndim()-1] != 1) throw std::runtime_error(#a " should be contiguous on last dimension")
+  if (a.ndim() > 0 && a.strides()[a.ndim()-1] != 1) throw std::runtime_error(#a " should be contiguous on last dimension")
 
 #ifdef _METAL_
 
@@ -63,57 +64,96 @@ void CTCLoss::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out
   auto& target_lengths = inputs[3];
   auto& loss           = outarr[0];
   auto& log_alpha      = outarr[1];
+  auto& log_norm       = outarr[2];
 
-  size_t batch_size     = log_probs.shape()[1];
+  size_t axis_T         = batch_first_ ? 1 : 0;
+  size_t axis_B         = batch_first_ ? 0 : 1;
+  size_t batch_size     = log_probs.shape()[axis_B];
   size_t max_target_len = targets.shape()[1];
 
   log_alpha.set_data(allocator::malloc_or_wait(log_alpha.nbytes()));
   loss.set_data(allocator::malloc_or_wait(loss.nbytes()));
+  log_norm.set_data(allocator::malloc_or_wait(log_norm.nbytes()));
+
+  // Lengths may still be written by GPU, so only calls and allocations are counted
+  if (ctc::stats_enabled()) {
+    ctc::stats_add(ctc::StatsCounter::forward_calls, 1);
+    ctc::stats_add(ctc::StatsCounter::bytes_allocated, log_alpha.nbytes() + loss.nbytes() + log_norm.nbytes());
+  }
 
-  assert_contiguous(log_probs);
   assert_contiguous(targets);
   assert_contiguous(input_lengths);
   assert_contiguous(target_lengths);
   assert_contiguous(loss);
   assert_contiguous(log_alpha);
 
-  size_t logp_stride_T = log_probs.strides()[0];
-  size_t logp_stride_B = log_probs.strides()[1];
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
   size_t  tgt_stride_B = targets  .strides()[0];
   size_t loga_stride_T = log_alpha.strides()[0];
   size_t loga_stride_B = log_alpha.strides()[1];
+  size_t loga_time_mask = need_grad_ ? ~size_t(0) : size_t(1);
+  size_t norm_stride_T = from_logits_ ? log_norm.strides()[0] : 0;
+  size_t norm_stride_B = from_logits_ ? log_norm.strides()[1] : 0;
   
   std::string data_type = type_to_name(log_probs);
+  std::string loga_type = type_to_name(log_alpha);
   std::string indx_type = type_to_name(targets);
 
+  if (from_logits_) {
+    dispatch_kernel(
+      stream(),
+      "ctc_loss_log_norm_" + data_type + "_" + indx_type,
+      MTL::Size(batch_size, log_probs.shape()[axis_T], 1),
+      {
+        log_probs,
+        input_lengths,
+      },
+      { log_norm },
+      logp_stride_T, logp_stride_B, logp_stride_C,
+      norm_stride_T, norm_stride_B,
+      size_t(log_probs.shape()[2])
+    );
+  }
+
+  // Normalizers are only read with `from_logits`, otherwise any buffer is bound in their place
   dispatch_kernel(
     stream(),
-    "ctc_loss_alpha_" + data_type + "_" + indx_type,
+    "ctc_loss_alpha_" + data_type + "_" + loga_type + "_" + indx_type,
     MTL::Size(max_target_len + 1, batch_size, 1),
     {
       log_probs,
       targets,
       target_lengths,
       input_lengths,
+      from_logits_ ? log_norm : log_probs,
     },
     { log_alpha },
     blank_,
     tgt_stride_B,
     loga_stride_T, loga_stride_B,
-    logp_stride_T, logp_stride_B
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    loga_time_mask,
+    norm_stride_T, norm_stride_B,
+    from_logits_,
+    max_deviation_
   );
 
+  // Reduced loss is summed by single thread
   dispatch_kernel(
     stream(),
-    "ctc_loss_final_" + data_type + "_" + indx_type,
-    MTL::Size(batch_size, 1, 1),
+    "ctc_loss_final_" + data_type + "_" + loga_type + "_" + indx_type,
+    MTL::Size((reduction_ == CTCReduction::none) ? batch_size : 1, 1, 1),
     {
       target_lengths,
       input_lengths,
       log_alpha,
     },
     { loss },
-    loga_stride_T, loga_stride_B
+    loga_stride_T, loga_stride_B,
+    loga_time_mask,
+    size_t(reduction_), zero_infinity_, batch_size
   );
 }
 
@@ -127,69 +167,84 @@ void CTCLossVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>&
   auto& input_lengths  = inputs[2];
   auto& target_lengths = inputs[3];
   auto& log_alpha      = inputs[4];
-  auto& nll            = inputs[5];
-  auto& ctg            = inputs[6];
+  auto& ctg            = inputs[5];
+  auto& log_norm       = inputs[6];
   auto& grad           = outarr[0];
 
   array log_beta (log_alpha.shape(), log_alpha.dtype(), nullptr, {});
 
-  size_t max_input_length = log_probs.shape()[0];
-  size_t batch_size       = log_probs.shape()[1];
+  size_t axis_T           = batch_first_ ? 1 : 0;
+  size_t axis_B           = batch_first_ ? 0 : 1;
+  size_t max_input_length = log_probs.shape()[axis_T];
+  size_t batch_size       = log_probs.shape()[axis_B];
   size_t max_target_len   = targets  .shape()[1];
   size_t num_channels     = log_probs.shape()[2];
 
   grad.set_data(allocator::malloc_or_wait(grad.nbytes()));
   log_beta.set_data(allocator::malloc_or_wait(log_beta.nbytes()));
 
-  assert_contiguous(log_probs);
+  if (ctc::stats_enabled()) {
+    ctc::stats_add(ctc::StatsCounter::backward_calls, 1);
+    ctc::stats_add(ctc::StatsCounter::bytes_allocated, grad.nbytes() + log_beta.nbytes());
+  }
+
   assert_contiguous(targets);
   assert_contiguous(input_lengths);
   assert_contiguous(target_lengths);
   assert_contiguous(log_alpha);
-  assert_contiguous(nll);
   assert_contiguous(ctg);
   assert_contiguous(grad);
   assert_contiguous(log_beta);
 
-  size_t logp_stride_T = log_probs.strides()[0];
-  size_t logp_stride_B = log_probs.strides()[1];
+  size_t logp_stride_T = log_probs.strides()[axis_T];
+  size_t logp_stride_B = log_probs.strides()[axis_B];
+  size_t logp_stride_C = log_probs.strides()[2];
   size_t  tgt_stride_B = targets  .strides()[0];
   size_t loga_stride_T = log_alpha.strides()[0];
   size_t loga_stride_B = log_alpha.strides()[1];
   size_t logb_stride_T = log_beta .strides()[0];
   size_t logb_stride_B = log_beta .strides()[1];
-  size_t grad_stride_T = grad.strides()[0];
-  size_t grad_stride_B = grad.strides()[1];
+  size_t grad_stride_T = grad.strides()[axis_T];
+  size_t grad_stride_B = grad.strides()[axis_B];
+  size_t norm_stride_T = from_logits_ ? log_norm.strides()[0] : 0;
+  size_t norm_stride_B = from_logits_ ? log_norm.strides()[1] : 0;
+  const array& norm    = from_logits_ ? log_norm : log_probs;
   
   std::string data_type = type_to_name(log_probs);
+  std::string loga_type = type_to_name(log_alpha);
   std::string indx_type = type_to_name(targets);
 
   dispatch_fill_z(stream(), grad);
 
   dispatch_kernel(
     stream(),
-    "ctc_loss_vjp_" + data_type + "_" + indx_type,
+    "ctc_loss_vjp_" + data_type + "_" + loga_type + "_" + indx_type,
     MTL::Size(max_target_len + 1, batch_size, 1),
     {
       log_probs,
       targets,
       target_lengths,
       input_lengths,
+      norm,
     },
     { log_beta },
     blank_,
     tgt_stride_B,
     logb_stride_T, logb_stride_B,
-    logp_stride_T, logp_stride_B
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    norm_stride_T, norm_stride_B,
+    from_logits_,
+    max_deviation_
   );
 
   dispatch_kernel(
     stream(),
-    "ctc_loss_vjp_grad_step_" + data_type + "_" + indx_type,
+    "ctc_loss_vjp_grad_step_" + data_type + "_" + loga_type + "_" + indx_type,
     MTL::Size(batch_size, max_input_length, 1),
     {
       targets,
       target_lengths,
+      input_lengths,
       log_alpha,
       log_beta,
     },
@@ -202,19 +257,93 @@ void CTCLossVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>&
 
   dispatch_kernel(
     stream(),
-    "ctc_loss_vjp_final_" + data_type + "_" + indx_type,
+    "ctc_loss_vjp_final_" + data_type + "_" + loga_type + "_" + indx_type,
     MTL::Size(num_channels, batch_size, max_input_length),
     {
       log_probs,
       input_lengths,
-      nll, ctg,
+      target_lengths,
+      log_alpha,
+      ctg,
+      norm,
     },
     { grad },
-    logp_stride_T, logp_stride_B,
-    grad_stride_T, grad_stride_B
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    loga_stride_T, loga_stride_B,
+    grad_stride_T, grad_stride_B,
+    size_t(reduction_), zero_infinity_, batch_size,
+    norm_stride_T, norm_stride_B,
+    from_logits_
+  );
+}
+
+void CTCGreedyDecode::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& log_probs     = inputs[0];
+  auto& input_lengths = inputs[1];
+  auto& labels        = outarr[0];
+  auto& lengths       = outarr[1];
+
+  size_t axis_T           = batch_first_ ? 1 : 0;
+  size_t axis_B           = batch_first_ ? 0 : 1;
+  size_t max_input_length = log_probs.shape()[axis_T];
+  size_t batch_size       = log_probs.shape()[axis_B];
+  size_t num_channels     = log_probs.shape()[2];
+
+  labels.set_data(allocator::malloc_or_wait(labels.nbytes()));
+  lengths.set_data(allocator::malloc_or_wait(lengths.nbytes()));
+
+  assert_contiguous(input_lengths);
+
+  size_t logp_stride_T   = log_probs.strides()[axis_T];
+  size_t logp_stride_B   = log_probs.strides()[axis_B];
+  size_t logp_stride_C   = log_probs.strides()[2];
+  size_t labels_stride_B = labels.strides()[0];
+
+  dispatch_kernel(
+    stream(),
+    "ctc_greedy_decode_" + type_to_name(log_probs) + "_" + type_to_name(input_lengths),
+    MTL::Size(batch_size, 1, 1),
+    {
+      log_probs,
+      input_lengths,
+    },
+    { labels, lengths },
+    size_t(blank_),
+    logp_stride_T, logp_stride_B, logp_stride_C,
+    labels_stride_B,
+    num_channels,
+    max_input_length
   );
 }
 
+void CTCBeamSearch::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("CTCBeamSearch is only supported on CPU.");
+}
+
+void CTCForcedAlign::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("CTCForcedAlign is only supported on CPU.");
+}
+
+void CTCPosteriors::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("CTCPosteriors is only supported on CPU.");
+}
+
+void CTCLossChunk::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("CTCLossChunk is only supported on CPU.");
+}
+
+void CTCLossChunkVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("CTCLossChunkVJP is only supported on CPU.");
+}
+
+void RNNTLoss::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("RNNTLoss is only supported on CPU.");
+}
+
+void RNNTLossVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  throw std::runtime_error("RNNTLossVJP is only supported on CPU.");
+}
+
 #else // Metal is not available
 
 void CTCLoss::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
@@ -225,6 +354,38 @@ void CTCLossVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>&
   throw std::runtime_error("CTCLossVJP has no GPU implementation.");
 }
 
+void CTCGreedyDecode::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("CTCGreedyDecode has no GPU implementation.");
+}
+
+void CTCBeamSearch::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("CTCBeamSearch has no GPU implementation.");
+}
+
+void CTCForcedAlign::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("CTCForcedAlign has no GPU implementation.");
+}
+
+void CTCPosteriors::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("CTCPosteriors has no GPU implementation.");
+}
+
+void CTCLossChunk::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("CTCLossChunk has no GPU implementation.");
+}
+
+void CTCLossChunkVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("CTCLossChunkVJP has no GPU implementation.");
+}
+
+void RNNTLoss::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("RNNTLoss has no GPU implementation.");
+}
+
+void RNNTLossVJP::eval_gpu(const std::vector<array>& inputs, std::vector<array>& out) {
+  throw std::runtime_error("RNNTLossVJP has no GPU implementation.");
+}
+
 #endif
 
 } // namespace mlx::core
@@ -6,102 +6,180 @@
 #define MTL_CONSTP
 #endif
 
-template <typename T>
-static MTL_CONSTP const T neginf = -stdlib::numeric_limits<T>::infinity();
-
-template <typename T>
-static inline T logaddexp(T x, T y) {
-  if (x == neginf<T>) return y;
-  if (y == neginf<T>) return x;
-  T maxval = stdlib::max(x, y);
-  T minval = stdlib::min(x, y);
-  if (minval == 0) return neginf<T>;
-  return maxval + stdlib::log(T(1) + stdlib::exp(minval - maxval));
-};
+#include "ctc_logmath.h"
+
+// Recurrences accumulate in `float` for any input type `T`, alpha and beta are stored as `A` (`float` or `T`)
 
-template <typename T>
-static inline T logaddexp(T x, T y, T z) {
-  if (x == neginf<T>) return logaddexp(y, z);
-  if (y == neginf<T>) return logaddexp(x, z);
-  if (z == neginf<T>) return logaddexp(x, y);
-  T maxval = stdlib::max(x, stdlib::max(y, z));
-  return maxval + stdlib::log(stdlib::exp(x - maxval) + stdlib::exp(y - maxval) + stdlib::exp(z - maxval));
+// Extended positions `[begin, end)` of frame `t`, out of `num_pos`, which can lie on a complete path
+struct _ctc_band {
+  size_t begin;
+  size_t end;
 };
 
-template<typename T, typename I>
+// Positions are reachable from the first frame (`k <= 2t+1`) and still reach the last positions within remaining
+// frames (`k >= num_pos - 2(T-t)`), other cells are `-inf` in both alpha and beta. With non-zero `max_deviation`,
+// band is also limited to `2 * max_deviation` positions around diagonal from `(0, 0)` to `(T-1, num_pos-1)`,
+// which drops paths (approximate loss) but keeps alpha and beta consistent.
+static inline _ctc_band _ctc_loss_band(size_t num_pos, size_t input_length, size_t max_deviation, size_t t) {
+  size_t rest  = 2 * (input_length - t);
+  size_t begin = (num_pos > rest) ? num_pos - rest : 0;
+  size_t end   = stdlib::min(num_pos, 2 * t + 2);
+  if (max_deviation > 0) {
+    size_t diag = (input_length > 1) ? t * (num_pos - 1) / (input_length - 1) : 0;
+    size_t dev  = 2 * max_deviation;
+    begin = stdlib::max(begin, (diag > dev) ? diag - dev : size_t(0));
+    end   = stdlib::min(end, diag + dev + 1);
+  }
+  return _ctc_band{ begin, stdlib::max(begin, end) };
+}
+
+static inline bool _ctc_in_band(_ctc_band band, size_t k) {
+  return k >= band.begin && k < band.end;
+}
+
+template<typename T, typename A, typename I>
 static inline void _ctc_loss_calc_alpha(
   MTL_DEVICEP const I* target_lengths,
   MTL_DEVICEP const I* targets,
   MTL_DEVICEP const T* log_probs,
-  MTL_DEVICEP       T* log_alpha,
+  MTL_DEVICEP       A* log_alpha,
   size_t tgt_stride_B,
-  size_t logp_stride_T, size_t logp_stride_B,
+  size_t logp_stride_T, size_t logp_stride_B, size_t logp_stride_C,
   size_t loga_stride_T, size_t loga_stride_B,
+  size_t loga_time_mask, // `~0` for full alpha, `1` for two rolling rows
+  float log_norm,        // Log-normalizer of frame `t` for logits, `0` for log-probabilities
   I blank,
+  size_t input_length,
+  size_t max_deviation,  // See `_ctc_loss_band`, `0` for exact lattice
   size_t t, size_t b, size_t c
 ) {
   size_t target_length = size_t(target_lengths[b]);
 
   MTL_DEVICEP const I* tgt_batch_data = &targets  [tgt_stride_B * b];
   MTL_DEVICEP const T* logp_time_data = &log_probs[logp_stride_T * (t  ) + logp_stride_B * b];
-  MTL_DEVICEP const T* loga_prev_data = &log_alpha[loga_stride_T * (t-1) + loga_stride_B * b];
-  MTL_DEVICEP       T* loga_time_data = &log_alpha[loga_stride_T * (t  ) + loga_stride_B * b];
+  MTL_DEVICEP const A* loga_prev_data = &log_alpha[loga_stride_T * ((t-1) & loga_time_mask) + loga_stride_B * b];
+  MTL_DEVICEP       A* loga_time_data = &log_alpha[loga_stride_T * ((t  ) & loga_time_mask) + loga_stride_B * b];
+
+  // Cells off the band are `-inf`, they are written without reading emissions or previous row
+  _ctc_band band = _ctc_loss_band(target_length * 2 + 1, input_length, max_deviation, t);
+  if (c*2+2 <= band.begin || c*2 >= band.end) {
+    loga_time_data[c*2+0] = neginf<A>;
+    loga_time_data[c*2+1] = neginf<A>;
+    return;
+  }
 
   I ctp = tgt_batch_data[c % target_length];
   I ptp = tgt_batch_data[c-1];
 
-  T p0 = logp_time_data[blank];
-  T p1 = logp_time_data[ctp];
+  float p0 = float(logp_time_data[logp_stride_C * blank]) - log_norm;
+  float p1 = float(logp_time_data[logp_stride_C * ctp]) - log_norm;
+  float r0 = neginf<float>;
+  float r1 = neginf<float>;
   if (t == 0) {
     if (c == 0) {
-      loga_time_data[0] = p0;
-      loga_time_data[1] = p1;
-    } else {
-      loga_time_data[c*2+0] = neginf<T>;
-      loga_time_data[c*2+1] = neginf<T>;
+      r0 = p0;
+      r1 = p1;
     }
   } else {
-    T a0 = loga_prev_data[c*2+0];
-    T a1 = loga_prev_data[c*2+1];
+    float a0 = float(loga_prev_data[c*2+0]);
+    float a1 = float(loga_prev_data[c*2+1]);
     if (c == 0) {
-      loga_time_data[0] = p0 + a0;
-      loga_time_data[1] = p1 + logaddexp(a0, a1);
+      r0 = p0 + a0;
+      r1 = p1 + logaddexp(a0, a1);
     } else {
-      T an = loga_prev_data[c*2-1];
-      loga_time_data[c*2+0] = p0 + logaddexp(a0, an);
-      loga_time_data[c*2+1] = p1 + ((ctp != ptp) ? logaddexp(a1, a0, an) : logaddexp(a1, a0));
+      float an = float(loga_prev_data[c*2-1]);
+      r0 = p0 + logaddexp(a0, an);
+      r1 = p1 + ((ctp != ptp) ? logaddexp(a1, a0, an) : logaddexp(a1, a0));
     }
   }
+  loga_time_data[c*2+0] = _ctc_in_band(band, c*2+0) ? A(r0) : neginf<A>;
+  loga_time_data[c*2+1] = _ctc_in_band(band, c*2+1) ? A(r1) : neginf<A>;
 }
 
-template<typename T, typename I>
-static inline void _ctc_loss_final(
+template<typename A, typename I>
+static inline float _ctc_loss_log_likelihood(
   MTL_DEVICEP const I* target_lengths,
   MTL_DEVICEP const I* input_lengths,
-  MTL_DEVICEP const T* log_alpha,
-  MTL_DEVICEP       T* loss,
+  MTL_DEVICEP const A* log_alpha,
   size_t loga_stride_T,
   size_t loga_stride_B,
+  size_t loga_time_mask,
   size_t b
 ) {
   size_t target_length = size_t(target_lengths[b]);
   size_t input_length = size_t(input_lengths[b]);
-  T a0 = log_alpha[loga_stride_T * (input_length-1) + loga_stride_B * b + (target_length*2-1)];
-  T a1 = log_alpha[loga_stride_T * (input_length-1) + loga_stride_B * b + (target_length*2  )];
-  loss[b] = -logaddexp(a0, a1);
+  size_t last_t = (input_length-1) & loga_time_mask;
+  float a0 = float(log_alpha[loga_stride_T * last_t + loga_stride_B * b + (target_length*2-1)]);
+  float a1 = float(log_alpha[loga_stride_T * last_t + loga_stride_B * b + (target_length*2  )]);
+  return logaddexp(a0, a1);
 }
 
-template<typename T, typename I>
+// Reduction modes, values of `CTCReduction`
+static MTL_CONSTP const size_t ctc_reduction_none = 0;
+static MTL_CONSTP const size_t ctc_reduction_sum  = 1;
+static MTL_CONSTP const size_t ctc_reduction_mean = 2;
+
+// Weight of sample loss in reduced output: `mean` divides by target length (at least 1) and batch size
+static inline float _ctc_loss_weight(size_t reduction, size_t target_length, size_t batch_size) {
+  if (reduction != ctc_reduction_mean) return 1;
+  return 1.0f / float((target_length > 0 ? target_length : 1) * batch_size);
+}
+
+// Infinite loss (impossible alignment) is treated as zero with `zero_infinity`, along with its gradient
+static inline bool _ctc_loss_zeroed(float nll, bool zero_infinity) {
+  return zero_infinity && nll == -neginf<float>;
+}
+
+template<typename T, typename A, typename I>
+static inline void _ctc_loss_final(
+  MTL_DEVICEP const I* target_lengths,
+  MTL_DEVICEP const I* input_lengths,
+  MTL_DEVICEP const A* log_alpha,
+  MTL_DEVICEP       T* loss,
+  size_t loga_stride_T,
+  size_t loga_stride_B,
+  size_t loga_time_mask,
+  size_t reduction,
+  bool zero_infinity,
+  size_t batch_size,
+  size_t b
+) {
+  if (reduction == ctc_reduction_none) {
+    float nll = -_ctc_loss_log_likelihood(
+      target_lengths, input_lengths, log_alpha,
+      loga_stride_T, loga_stride_B, loga_time_mask,
+      b
+    );
+    loss[b] = T(_ctc_loss_zeroed(nll, zero_infinity) ? 0 : nll);
+    return;
+  }
+  // Reduced loss is computed by single thread in batch order
+  float sum = 0;
+  for (size_t i = 0; i < batch_size; i++) {
+    float nll = -_ctc_loss_log_likelihood(
+      target_lengths, input_lengths, log_alpha,
+      loga_stride_T, loga_stride_B, loga_time_mask,
+      i
+    );
+    if (_ctc_loss_zeroed(nll, zero_infinity)) continue;
+    sum += nll * _ctc_loss_weight(reduction, size_t(target_lengths[i]), batch_size);
+  }
+  loss[0] = T(sum);
+}
+
+template<typename T, typename A, typename I>
 static inline void _ctc_loss_vjp_calc_beta(
   MTL_DEVICEP const I* input_lengths,
   MTL_DEVICEP const I* target_lengths,
   MTL_DEVICEP const I* targets,
   MTL_DEVICEP const T* log_probs,
-  MTL_DEVICEP       T* log_beta,
+  MTL_DEVICEP       A* log_beta,
   size_t tgt_stride_B,
-  size_t logp_stride_T, size_t logp_stride_B,
+  size_t logp_stride_T, size_t logp_stride_B, size_t logp_stride_C,
   size_t logb_stride_T, size_t logb_stride_B,
+  float log_norm,
   I blank,
+  size_t max_deviation,
   size_t t, size_t b, size_t s
 ) {
   size_t input_length  = size_t(input_lengths[b]);
@@ -109,48 +187,56 @@ static inline void _ctc_loss_vjp_calc_beta(
 
   MTL_DEVICEP const I* tgt_batch_data = &targets  [tgt_stride_B * b];
   MTL_DEVICEP const T* logp_time_data = &log_probs[logp_stride_T *  t    + logp_stride_B * b];
-  MTL_DEVICEP       T* logb_time_data = &log_beta [logb_stride_T *  t    + logb_stride_B * b];
+  MTL_DEVICEP       A* logb_time_data = &log_beta [logb_stride_T *  t    + logb_stride_B * b];
+
+  _ctc_band band = _ctc_loss_band(target_length * 2 + 1, input_length, max_deviation, t);
+  if (s*2+2 <= band.begin || s*2 >= band.end) {
+    logb_time_data[s*2+0] = neginf<A>;
+    logb_time_data[s*2+1] = neginf<A>;
+    return;
+  }
 
   I ctp = tgt_batch_data[(s  )%target_length];
   I ntp = tgt_batch_data[(s+1)%target_length];
-  T p0  = logp_time_data[blank];
-  T p1  = logp_time_data[ctp];
+  float p0 = float(logp_time_data[logp_stride_C * blank]) - log_norm;
+  float p1 = float(logp_time_data[logp_stride_C * ctp]) - log_norm;
+  float r0 = neginf<float>;
+  float r1 = neginf<float>;
 
   if (t == input_length-1) {
     if (s == target_length-1) {
-      logb_time_data[s*2+0] = neginf<T>;
-      logb_time_data[s*2+1] = p1;
+      r1 = p1;
     } else if (s == target_length) {
-      logb_time_data[s*2+0] = p0;
-      logb_time_data[s*2+1] = neginf<T>;
-    } else {
-      logb_time_data[s*2+0] = neginf<T>;
-      logb_time_data[s*2+1] = neginf<T>;
+      r0 = p0;
     }
-    return;
-  }
-
-  MTL_DEVICEP const T* logb_prev_data = &log_beta [logb_stride_T * (t+1) + logb_stride_B * b];
+  } else {
+    MTL_DEVICEP const A* logb_prev_data = &log_beta [logb_stride_T * (t+1) + logb_stride_B * b];
 
-  T lb0 = logb_prev_data[s*2+0];
-  T lb1 = logb_prev_data[s*2+1];
-  logb_time_data[s*2+0] = p0 + logaddexp(lb0, lb1);
+    float lb0 = float(logb_prev_data[s*2+0]);
+    float lb1 = float(logb_prev_data[s*2+1]);
+    r0 = p0 + logaddexp(lb0, lb1);
 
-  if (s < target_length) {
-    T lb2 = logb_prev_data[s*2+2];
-    T lb3 = logb_prev_data[s*2+3];
-    logb_time_data[s*2+1] = p1 + ((ctp != ntp) ? logaddexp(lb1, lb2, lb3) : logaddexp(lb1, lb2));
-  } else {
-    logb_time_data[s*2+1] = p1 + lb1;
+    if (s < target_length) {
+      float lb2 = float(logb_prev_data[s*2+2]);
+      float lb3 = float(logb_prev_data[s*2+3]);
+      r1 = p1 + ((ctp != ntp) ? logaddexp(lb1, lb2, lb3) : logaddexp(lb1, lb2));
+    } else {
+      r1 = p1 + lb1;
+    }
   }
+  logb_time_data[s*2+0] = _ctc_in_band(band, s*2+0) ? A(r0) : neginf<A>;
+  logb_time_data[s*2+1] = _ctc_in_band(band, s*2+1) ? A(r1) : neginf<A>;
 }
 
-template<typename T, typename I>
+// Scatters log-posterior `alpha + beta - log p(l|x)` of every position into its class,
+// so values kept in `T` stay close to zero for significant terms
+template<typename T, typename A, typename I>
 static inline void _ctc_loss_vjp_grad_step(
+  MTL_DEVICEP const I* input_lengths,
   MTL_DEVICEP const I* target_lengths,
   MTL_DEVICEP const I* targets,
-  MTL_DEVICEP const T* log_alpha,
-  MTL_DEVICEP const T* log_beta,
+  MTL_DEVICEP const A* log_alpha,
+  MTL_DEVICEP const A* log_beta,
   MTL_DEVICEP       T* grad,
   size_t tgt_stride_B,
   size_t loga_stride_T, size_t loga_stride_B,
@@ -159,33 +245,50 @@ static inline void _ctc_loss_vjp_grad_step(
   I blank,
   size_t t, size_t b
 ) {
+  // Padding frames are zeroed by final step, lattice is not computed there
+  if (t >= size_t(input_lengths[b])) return;
+
   MTL_DEVICEP const I* tgt_batch_data = &targets  [tgt_stride_B * b];
-  MTL_DEVICEP const T* loga_time_data = &log_alpha[loga_stride_T * t + loga_stride_B * b];
-  MTL_DEVICEP const T* logb_time_data = &log_beta [logb_stride_T * t + logb_stride_B * b];
+  MTL_DEVICEP const A* loga_time_data = &log_alpha[loga_stride_T * t + loga_stride_B * b];
+  MTL_DEVICEP const A* logb_time_data = &log_beta [logb_stride_T * t + logb_stride_B * b];
   MTL_DEVICEP       T* grad_time_data = &grad     [grad_stride_T * t + grad_stride_B * b];
   size_t target_length = size_t(target_lengths[b]);
 
-  T lcab0 = grad_time_data[blank];
+  float nll = -_ctc_loss_log_likelihood(
+    target_lengths, input_lengths, log_alpha,
+    loga_stride_T, loga_stride_B, ~size_t(0),
+    b
+  );
+
+  float lcab0 = float(grad_time_data[blank]);
   for (size_t s = 0; s <= target_length; s++) {
     I ctp = tgt_batch_data[s%target_length];
     MTL_DEVICEP T& lcab1 = grad_time_data[ctp];
-    lcab0 = logaddexp<T>(lcab0, loga_time_data[s*2+0] + logb_time_data[s*2+0]);
-    lcab1 = logaddexp<T>(lcab1, loga_time_data[s*2+1] + logb_time_data[s*2+1]);
+    lcab0 = logaddexp(lcab0, float(loga_time_data[s*2+0]) + float(logb_time_data[s*2+0]) + nll);
+    lcab1 = T(logaddexp(float(lcab1), float(loga_time_data[s*2+1]) + float(logb_time_data[s*2+1]) + nll));
   }
-  grad_time_data[blank] = lcab0;
+  grad_time_data[blank] = T(lcab0);
 }
 
-template<typename T, typename I>
+template<typename T, typename A, typename I>
 static inline void _ctc_loss_vjp_final(
   MTL_DEVICEP const I* input_lengths,
+  MTL_DEVICEP const I* target_lengths,
   MTL_DEVICEP const T* log_probs,
-  MTL_DEVICEP const T* loss,
+  MTL_DEVICEP const A* log_alpha,
   MTL_DEVICEP const T* grad_out,
   MTL_DEVICEP       T* grad,
   size_t logp_stride_T,
   size_t logp_stride_B,
+  size_t logp_stride_C,
+  size_t loga_stride_T,
+  size_t loga_stride_B,
   size_t grad_stride_T,
   size_t grad_stride_B,
+  size_t reduction,
+  bool zero_infinity,
+  size_t batch_size,
+  float log_norm,
   size_t t, size_t b, size_t c
 ) {
   size_t input_length  = size_t(input_lengths[b]);
@@ -193,12 +296,193 @@ static inline void _ctc_loss_vjp_final(
   MTL_DEVICEP       T* grad_time_data = &grad     [grad_stride_T * t + grad_stride_B * b];
 
   if (t < input_length) {
-    T nll = loss[b];
-    T gr  = grad_out[b];
-    T lp  = logp_time_data[c];
-    T res = grad_time_data[c];
-    grad_time_data[c] = (stdlib::exp(lp)-stdlib::exp(res + nll - lp)) * gr;
+    if (zero_infinity) {
+      float nll = -_ctc_loss_log_likelihood(
+        target_lengths, input_lengths, log_alpha,
+        loga_stride_T, loga_stride_B, ~size_t(0),
+        b
+      );
+      if (_ctc_loss_zeroed(nll, zero_infinity)) {
+        grad_time_data[c] = 0;
+        return;
+      }
+    }
+    float gr  = float(grad_out[(reduction == ctc_reduction_none) ? b : 0]);
+    float lp  = float(logp_time_data[logp_stride_C * c]) - log_norm;
+    float res = float(grad_time_data[c]);
+    gr *= _ctc_loss_weight(reduction, size_t(target_lengths[b]), batch_size);
+    grad_time_data[c] = T((_ctc_exp(lp)-_ctc_exp(res - lp)) * gr);
   } else {
     grad_time_data[c] = 0;
   }
 }
+
+// Log-normalizer `log(sum(exp(x)))` of frame of logits, `0` on padding frames
+template<typename T, typename I>
+static inline void _ctc_loss_calc_log_norm(
+  MTL_DEVICEP const I* input_lengths,
+  MTL_DEVICEP const T* logits,
+  MTL_DEVICEP float* log_norm,
+  size_t logp_stride_T, size_t logp_stride_B, size_t logp_stride_C,
+  size_t norm_stride_T, size_t norm_stride_B,
+  size_t num_channels,
+  size_t t, size_t b
+) {
+  MTL_DEVICEP const T* logp_time_data = &logits[logp_stride_T * t + logp_stride_B * b];
+  MTL_DEVICEP float& norm = log_norm[norm_stride_T * t + norm_stride_B * b];
+  if (t >= size_t(input_lengths[b])) {
+    norm = 0;
+    return;
+  }
+  float maxval = neginf<float>;
+  for (size_t c = 0; c < num_channels; c++) maxval = stdlib::max(maxval, float(logp_time_data[logp_stride_C * c]));
+  float sum = 0;
+  for (size_t c = 0; c < num_channels; c++) sum += _ctc_exp(float(logp_time_data[logp_stride_C * c]) - maxval);
+  norm = maxval + _ctc_log(sum);
+}
+
+// Best path of one sequence: argmax class of every frame, with repeats collapsed and blanks removed.
+// `blank` is a class index, independent of type of `input_lengths`.
+template<typename T, typename I>
+static inline void _ctc_greedy_decode(
+  MTL_DEVICEP const I* input_lengths,
+  MTL_DEVICEP const T* log_probs,
+  MTL_DEVICEP int32_t* labels,
+  MTL_DEVICEP int32_t* lengths,
+  size_t logp_stride_T, size_t logp_stride_B, size_t logp_stride_C,
+  size_t labels_stride_B,
+  size_t num_channels,
+  size_t max_input_length,
+  size_t blank,
+  size_t b
+) {
+  size_t input_length = size_t(input_lengths[b]);
+  MTL_DEVICEP int32_t* labels_batch_data = &labels[labels_stride_B * b];
+
+  size_t num_labels = 0;
+  size_t prev = blank;
+  for (size_t t = 0; t < input_length; t++) {
+    MTL_DEVICEP const T* logp_time_data = &log_probs[logp_stride_T * t + logp_stride_B * b];
+    size_t best = 0;
+    float best_lp = float(logp_time_data[0]);
+    for (size_t c = 1; c < num_channels; c++) {
+      float lp = float(logp_time_data[logp_stride_C * c]);
+      if (lp > best_lp) {
+        best = c;
+        best_lp = lp;
+      }
+    }
+    if (best != blank && best != prev) labels_batch_data[num_labels++] = int32_t(best);
+    prev = best;
+  }
+  lengths[b] = int32_t(num_labels);
+  for (size_t k = num_labels; k < max_input_length; k++) labels_batch_data[k] = int32_t(blank);
+}
+
+// Viterbi (max-product) form of `_ctc_loss_calc_alpha`: `delta` holds best path scores in two rolling rows,
+// and byte `c` of backpointer row keeps 2-bit moves of both positions of cell `c`: `0` - stay, `1` - from `k-1`,
+// `2` - from `k-2` (bits 0-1 for blank position `2c`, bits 2-3 for label position `2c+1`)
+template<typename T, typename I>
+static inline void _ctc_align_calc_delta(
+  MTL_DEVICEP const I* target_lengths,
+  MTL_DEVICEP const I* targets,
+  MTL_DEVICEP const T* log_probs,
+  MTL_DEVICEP float* delta,
+  MTL_DEVICEP uint8_t* backptr,
+  size_t tgt_stride_B,
+  size_t logp_stride_T, size_t logp_stride_B, size_t logp_stride_C,
+  size_t delta_stride_T, size_t delta_stride_B,
+  size_t bptr_stride_T, size_t bptr_stride_B,
+  I blank,
+  size_t t, size_t b, size_t c
+) {
+  size_t target_length = size_t(target_lengths[b]);
+
+  MTL_DEVICEP const I* tgt_batch_data = &targets  [tgt_stride_B * b];
+  MTL_DEVICEP const T* logp_time_data = &log_probs[logp_stride_T * t + logp_stride_B * b];
+  MTL_DEVICEP const float* dlt_prev_data = &delta[delta_stride_T * ((t-1) & 1) + delta_stride_B * b];
+  MTL_DEVICEP       float* dlt_time_data = &delta[delta_stride_T * ((t  ) & 1) + delta_stride_B * b];
+
+  // Last cell has only blank position
+  bool has_label = c < target_length;
+  I ctp = has_label ? tgt_batch_data[c] : blank;
+
+  float p0 = float(logp_time_data[logp_stride_C * blank]);
+  float p1 = has_label ? float(logp_time_data[logp_stride_C * ctp]) : neginf<float>;
+  uint8_t moves = 0;
+  if (t == 0) {
+    dlt_time_data[c*2+0] = (c == 0) ? p0 : neginf<float>;
+    dlt_time_data[c*2+1] = (c == 0) ? p1 : neginf<float>;
+  } else {
+    float a0 = dlt_prev_data[c*2+0];
+    float a1 = dlt_prev_data[c*2+1];
+    float an = (c > 0) ? dlt_prev_data[c*2-1] : neginf<float>;
+
+    // Blank: stay or come from previous label
+    float d0 = a0;
+    if (an > d0) { d0 = an; moves |= 1; }
+
+    // Label: stay, come from blank, or skip blank between different labels
+    float d1 = a1;
+    uint8_t m1 = 0;
+    if (a0 > d1) { d1 = a0; m1 = 1; }
+    if (c > 0 && ctp != tgt_batch_data[c-1] && an > d1) { d1 = an; m1 = 2; }
+    moves |= m1 << 2;
+
+    dlt_time_data[c*2+0] = p0 + d0;
+    dlt_time_data[c*2+1] = p1 + d1;
+  }
+  backptr[bptr_stride_T * t + bptr_stride_B * b + c] = moves;
+}
+
+// Best path from backpointers: label of every frame (blank on padding), `[start, end)` frames of every target
+template<typename I>
+static inline float _ctc_align_backtrack(
+  MTL_DEVICEP const I* input_lengths,
+  MTL_DEVICEP const I* target_lengths,
+  MTL_DEVICEP const I* targets,
+  MTL_DEVICEP const float* delta,
+  MTL_DEVICEP const uint8_t* backptr,
+  MTL_DEVICEP int32_t* labels,
+  MTL_DEVICEP int32_t* segments,
+  size_t tgt_stride_B,
+  size_t delta_stride_T, size_t delta_stride_B,
+  size_t bptr_stride_T, size_t bptr_stride_B,
+  size_t labels_stride_B, size_t segm_stride_B,
+  size_t max_input_length, size_t max_target_length,
+  I blank,
+  size_t b
+) {
+  size_t input_length = size_t(input_lengths[b]);
+  size_t target_length = size_t(target_lengths[b]);
+  MTL_DEVICEP const I* tgt_batch_data = &targets[tgt_stride_B * b];
+  MTL_DEVICEP int32_t* labels_batch_data = &labels[labels_stride_B * b];
+  MTL_DEVICEP int32_t* segm_batch_data = &segments[segm_stride_B * b];
+
+  for (size_t t = 0; t < max_input_length; t++) labels_batch_data[t] = int32_t(blank);
+  for (size_t s = 0; s < max_target_length * 2; s++) segm_batch_data[s] = -1;
+  if (input_length == 0) return (target_length == 0) ? 0 : neginf<float>;
+
+  // Path ends in final blank or last label
+  MTL_DEVICEP const float* dlt_last_data = &delta[delta_stride_T * ((input_length-1) & 1) + delta_stride_B * b];
+  size_t k = target_length * 2;
+  float score = dlt_last_data[k];
+  if (target_length > 0 && dlt_last_data[k-1] > score) {
+    k = k - 1;
+    score = dlt_last_data[k];
+  }
+  if (score == neginf<float>) return score;
+
+  for (size_t t = input_length; t-- > 0;) {
+    if (k & 1) {
+      size_t s = k / 2;
+      int32_t ft = int32_t(t);
+      labels_batch_data[t] = int32_t(tgt_batch_data[s]);
+      if (segm_batch_data[s*2+1] < 0) segm_batch_data[s*2+1] = ft + 1;
+      segm_batch_data[s*2+0] = ft;
+    }
+    uint8_t moves = backptr[bptr_stride_T * t + bptr_stride_B * b + k / 2];
+    k -= (moves >> ((k & 1) * 2)) & 3;
+  }
+  return score;
+}
@@ -1,31 +1,156 @@
 // Copyright © 2024 Yury Popov (@djphoenix).
 
+#include <cmath>
+#include <limits>
+
 #include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_lm.h"
 
 namespace mlx::core {
 
-array ctc_loss(
+static size_t ctc_loss_checkpoint(
+  size_t input_time_size,
+  size_t row_bytes,
+  int checkpoint_interval,
+  size_t memory_budget
+) {
+  if (checkpoint_interval > 0) {
+    return std::min<size_t>(checkpoint_interval, std::max<size_t>(input_time_size, 1));
+  }
+  if (checkpoint_interval < 0) {
+    return std::max<size_t>(1, std::ceil(std::sqrt(double(input_time_size))));
+  }
+  // Empty batch has zero-sized rows, which fit any budget
+  if (memory_budget > 0 && row_bytes > 0) {
+    size_t num_rows = std::max<size_t>(1, memory_budget / row_bytes);
+    return std::max<size_t>(1, (input_time_size + num_rows - 1) / num_rows);
+  }
+  return 1;
+}
+
+static CTCReduction ctc_loss_reduction(const std::string& reduction) {
+  if (reduction == "none") return CTCReduction::none;
+  if (reduction == "sum" ) return CTCReduction::sum;
+  if (reduction == "mean") return CTCReduction::mean;
+  throw std::invalid_argument("[ctc_loss] reduction should be one of \"none\", \"sum\" or \"mean\".");
+}
+
+static array ctc_loss_op(
   const array& log_probs,
   const array& targets,
   const array& input_lengths,
   const array& target_lengths,
   uint64_t blank,
+  const std::string& reduction,
+  bool zero_infinity,
+  bool batch_first,
+  std::optional<bool> need_grad,
+  int checkpoint_interval,
+  size_t memory_budget,
+  std::optional<Dtype> alpha_dtype,
+  int max_deviation,
+  bool linear_space,
+  bool from_logits,
   StreamOrDevice s
 ) {
   auto out_dtype         = log_probs.dtype();
-  auto input_time_size   = log_probs.shape()[0];
-  auto batch_size        = log_probs.shape()[1];
+  auto loga_dtype        = alpha_dtype.value_or(float32);
+  auto input_time_size   = log_probs.shape()[batch_first ? 1 : 0];
+  auto batch_size        = log_probs.shape()[batch_first ? 0 : 1];
   auto input_target_size = targets.shape()[1];
+  auto reduction_mode    = ctc_loss_reduction(reduction);
+
+  if (loga_dtype != float32 && loga_dtype != out_dtype) {
+    throw std::invalid_argument("[ctc_loss] alpha_dtype should be float32 or dtype of log_probs.");
+  }
+  if (max_deviation < 0) {
+    throw std::invalid_argument("[ctc_loss] max_deviation should be non-negative.");
+  }
+
+  // Linear-space recurrences have no GPU kernels, so the request fails before the graph is built
+  auto stream = to_stream(s);
+  if (linear_space && stream.device.type == Device::gpu) {
+    throw std::invalid_argument("[ctc_loss] linear_space is only supported on CPU.");
+  }
 
-  // Output: loss, log_alpha
+  // Gradient can only be requested by function transformation, which traces its inputs
+  bool grad = need_grad.value_or(log_probs.is_tracer());
+
+  // Checkpoints only matter for gradient, as loss-only forward keeps two rolling rows anyway
+  size_t row_bytes = size_t(batch_size) * (input_target_size * 2 + 2) * size_of(loga_dtype);
+  size_t checkpoint = grad ? ctc_loss_checkpoint(input_time_size, row_bytes, checkpoint_interval, memory_budget) : 1;
+  // Recomputation between checkpoints has no GPU kernels either
+  if (checkpoint > 1 && stream.device.type == Device::gpu) {
+    throw std::invalid_argument("[ctc_loss] alpha checkpointing is only supported on CPU.");
+  }
+  int alpha_rows = grad ? (input_time_size + checkpoint - 1) / checkpoint : 2;
+
+  std::vector<int> loss_shape;
+  if (reduction_mode == CTCReduction::none) loss_shape.push_back(batch_size);
+
+  // Output: loss, log_alpha (full lattice, checkpoints every `checkpoint` steps, or two rolling rows),
+  // log-normalizers of frames (empty for log-probabilities). CPU only writes feasible band of alpha rows.
   return array::make_arrays(
-    { { batch_size }, { input_time_size, batch_size, input_target_size * 2 + 2 } },
-    { out_dtype, out_dtype },
-    std::make_shared<CTCLoss>(to_stream(s), blank),
+    {
+      loss_shape,
+      { alpha_rows, batch_size, input_target_size * 2 + 2 },
+      { from_logits ? input_time_size : 0, batch_size },
+    },
+    { out_dtype, loga_dtype, float32 },
+    std::make_shared<CTCLoss>(
+      stream, blank, grad, checkpoint, reduction_mode, zero_infinity, batch_first, from_logits, max_deviation,
+      linear_space
+    ),
     { log_probs, targets, input_lengths, target_lengths }
   )[0];
 }
 
+array ctc_loss(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  const std::string& reduction,
+  bool zero_infinity,
+  bool batch_first,
+  std::optional<bool> need_grad,
+  int checkpoint_interval,
+  size_t memory_budget,
+  std::optional<Dtype> alpha_dtype,
+  int max_deviation,
+  bool linear_space,
+  StreamOrDevice s
+) {
+  return ctc_loss_op(
+    log_probs, targets, input_lengths, target_lengths, blank, reduction, zero_infinity, batch_first,
+    need_grad, checkpoint_interval, memory_budget, alpha_dtype, max_deviation, linear_space, false, s
+  );
+}
+
+array ctc_loss_from_logits(
+  const array& logits,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  const std::string& reduction,
+  bool zero_infinity,
+  bool batch_first,
+  std::optional<bool> need_grad,
+  int checkpoint_interval,
+  size_t memory_budget,
+  std::optional<Dtype> alpha_dtype,
+  int max_deviation,
+  bool linear_space,
+  StreamOrDevice s
+) {
+  return ctc_loss_op(
+    logits, targets, input_lengths, target_lengths, blank, reduction, zero_infinity, batch_first,
+    need_grad, checkpoint_interval, memory_budget, alpha_dtype, max_deviation, linear_space, true, s
+  );
+}
+
 std::vector<array> CTCLoss::vjp(
   const std::vector<array>& primals,
   const std::vector<array>& cotangents,
@@ -36,14 +161,289 @@ std::vector<array> CTCLoss::vjp(
   auto &targets        = primals[1];
   auto &input_lengths  = primals[2];
   auto &target_lengths = primals[3];
-  auto &nll            = outputs[0];
   auto &log_alpha      = outputs[1];
+  auto &log_norm       = outputs[2];
   auto &ctg            = cotangents[0];
 
+  if (!need_grad_) {
+    throw std::invalid_argument("[ctc_loss] Gradient is not available for loss computed with need_grad=false.");
+  }
+
   return { array(
     log_probs.shape(), log_probs.dtype(),
-    std::make_shared<CTCLossVJP>(stream(), blank_),
-    { log_probs, targets, input_lengths, target_lengths, log_alpha, nll, ctg }
+    std::make_shared<CTCLossVJP>(
+      stream(), blank_, checkpoint_, reduction_, zero_infinity_, batch_first_, from_logits_, max_deviation_,
+      linear_space_
+    ),
+    { log_probs, targets, input_lengths, target_lengths, log_alpha, ctg, log_norm }
+  ) };
+}
+
+std::vector<array> ctc_greedy_decode(
+  const array& log_probs,
+  const array& input_lengths,
+  uint64_t blank,
+  bool batch_first,
+  StreamOrDevice s
+) {
+  auto input_time_size = log_probs.shape()[batch_first ? 1 : 0];
+  auto batch_size      = log_probs.shape()[batch_first ? 0 : 1];
+
+  // Output: labels (padded with blank), lengths
+  return array::make_arrays(
+    { { batch_size, input_time_size }, { batch_size } },
+    { int32, int32 },
+    std::make_shared<CTCGreedyDecode>(to_stream(s), blank, batch_first),
+    { log_probs, input_lengths }
+  );
+}
+
+std::vector<array> ctc_beam_search_decode(
+  const array& log_probs,
+  const array& input_lengths,
+  uint64_t blank,
+  int beam_width,
+  int top_k,
+  int num_best,
+  bool batch_first,
+  std::shared_ptr<const ctc::NGramModel> lm,
+  const std::vector<std::string>& alphabet,
+  int word_delimiter,
+  float lm_weight,
+  float word_bonus,
+  StreamOrDevice s
+) {
+  auto input_time_size = log_probs.shape()[batch_first ? 1 : 0];
+  auto batch_size      = log_probs.shape()[batch_first ? 0 : 1];
+
+  if (beam_width < 1) {
+    throw std::invalid_argument("[ctc_beam_search_decode] beam_width should be positive.");
+  }
+  if (top_k < 0) {
+    throw std::invalid_argument("[ctc_beam_search_decode] top_k should be non-negative.");
+  }
+  if (num_best < 1 || num_best > beam_width) {
+    throw std::invalid_argument("[ctc_beam_search_decode] num_best should be in range [1, beam_width].");
+  }
+
+  std::shared_ptr<const ctc::LMFusion> fusion;
+  if (lm) {
+    int num_channels = log_probs.shape()[2];
+    if (alphabet.size() != size_t(num_channels)) {
+      throw std::invalid_argument("[ctc_beam_search_decode] alphabet should have a string for every class.");
+    }
+    if (word_delimiter < 0 || word_delimiter >= num_channels || uint64_t(word_delimiter) == blank) {
+      throw std::invalid_argument("[ctc_beam_search_decode] word_delimiter should be a non-blank class.");
+    }
+    fusion = std::make_shared<ctc::LMFusion>(lm, alphabet, size_t(word_delimiter), lm_weight, word_bonus);
+  }
+
+  // Search is sequential per item and branchy, so it is scheduled on CPU unless asked otherwise
+  auto stream = std::holds_alternative<std::monostate>(s) ? default_stream(Device::cpu) : to_stream(s);
+
+  // Output: labels (padded with blank), lengths, scores
+  return array::make_arrays(
+    { { batch_size, num_best, input_time_size }, { batch_size, num_best }, { batch_size, num_best } },
+    { int32, int32, float32 },
+    std::make_shared<CTCBeamSearch>(stream, blank, beam_width, top_k, num_best, batch_first, fusion),
+    { log_probs, input_lengths }
+  );
+}
+
+std::vector<array> ctc_forced_align(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  bool batch_first,
+  StreamOrDevice s
+) {
+  auto input_time_size   = log_probs.shape()[batch_first ? 1 : 0];
+  auto batch_size        = log_probs.shape()[batch_first ? 0 : 1];
+  auto input_target_size = targets.shape()[1];
+
+  // Backtracking is sequential per item, so it is scheduled on CPU unless asked otherwise
+  auto stream = std::holds_alternative<std::monostate>(s) ? default_stream(Device::cpu) : to_stream(s);
+
+  // Output: frame labels, target segments, path scores
+  return array::make_arrays(
+    { { batch_size, input_time_size }, { batch_size, input_target_size, 2 }, { batch_size } },
+    { int32, int32, float32 },
+    std::make_shared<CTCForcedAlign>(stream, blank, batch_first),
+    { log_probs, targets, input_lengths, target_lengths }
+  );
+}
+
+std::vector<array> ctc_posteriors(
+  const array& log_probs,
+  const array& targets,
+  const array& input_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  int top_k,
+  bool batch_first,
+  StreamOrDevice s
+) {
+  auto input_time_size = log_probs.shape()[batch_first ? 1 : 0];
+  auto batch_size      = log_probs.shape()[batch_first ? 0 : 1];
+  auto num_channels    = log_probs.shape()[2];
+
+  if (top_k < 0) {
+    throw std::invalid_argument("[ctc_posteriors] top_k should be non-negative.");
+  }
+
+  std::vector<int> shape = batch_first ?
+    std::vector<int>{ batch_size, input_time_size, top_k ? top_k : num_channels } :
+    std::vector<int>{ input_time_size, batch_size, top_k ? top_k : num_channels };
+
+  // Lattice sweeps are sequential per item, so they are scheduled on CPU unless asked otherwise
+  auto stream = std::holds_alternative<std::monostate>(s) ? default_stream(Device::cpu) : to_stream(s);
+  auto prim = std::make_shared<CTCPosteriors>(stream, blank, size_t(top_k), batch_first);
+
+  // Output: posteriors (dense), or posteriors with their classes (sparse)
+  if (top_k == 0) {
+    return array::make_arrays({ shape }, { float32 }, prim, { log_probs, targets, input_lengths, target_lengths });
+  }
+  return array::make_arrays(
+    { shape, shape },
+    { float32, int32 },
+    prim,
+    { log_probs, targets, input_lengths, target_lengths }
+  );
+}
+
+std::vector<array> ctc_loss_chunk(
+  const array& log_probs,
+  const array& targets,
+  const array& chunk_lengths,
+  const array& target_lengths,
+  const std::optional<array>& state,
+  uint64_t blank,
+  bool batch_first,
+  StreamOrDevice s
+) {
+  auto batch_size        = log_probs.shape()[batch_first ? 0 : 1];
+  auto input_target_size = targets.shape()[1];
+  std::vector<int> state_shape = { batch_size, input_target_size * 2 + 2 };
+
+  // Recurrences are sequential per item, so chunks are scheduled on CPU unless asked otherwise
+  auto stream = std::holds_alternative<std::monostate>(s) ? default_stream(Device::cpu) : to_stream(s);
+
+  if (state && (state->dtype() != float32 || state->shape() != state_shape)) {
+    throw std::invalid_argument("[ctc_loss_chunk] state should be float32 of size (N, 2S+2).");
+  }
+
+  // Alpha of virtual frame before the input: the only path starts at first position with probability 1
+  auto prev = state ? *state : concatenate(
+    {
+      zeros({ batch_size, 1 }, float32, stream),
+      full({ batch_size, input_target_size * 2 + 1 }, array(-std::numeric_limits<float>::infinity()), stream),
+    },
+    1,
+    stream
+  );
+
+  // Output: alpha row after the chunk, loss of frames consumed so far
+  return array::make_arrays(
+    { state_shape, { batch_size } },
+    { float32, float32 },
+    std::make_shared<CTCLossChunk>(stream, blank, batch_first),
+    { log_probs, targets, chunk_lengths, target_lengths, prev }
+  );
+}
+
+std::vector<array> CTCLossChunk::vjp(
+  const std::vector<array>& primals,
+  const std::vector<array>& cotangents,
+  const std::vector<int>  & argnums,
+  const std::vector<array>& outputs
+) {
+  auto &log_probs      = primals[0];
+  auto &targets        = primals[1];
+  auto &chunk_lengths  = primals[2];
+  auto &target_lengths = primals[3];
+  auto &state          = primals[4];
+  auto &ctg_state      = cotangents[0];
+  auto &ctg_loss       = cotangents[1];
+
+  // Gradients of log-probabilities and of previous state, so that chained chunks back-propagate through states
+  auto grads = array::make_arrays(
+    { log_probs.shape(), state.shape() },
+    { log_probs.dtype(), float32 },
+    std::make_shared<CTCLossChunkVJP>(stream(), blank_, batch_first_),
+    { log_probs, targets, chunk_lengths, target_lengths, state, ctg_state, ctg_loss }
+  );
+
+  std::vector<array> vjps;
+  for (auto arg : argnums) {
+    if (arg == 0) {
+      vjps.push_back(grads[0]);
+    } else if (arg == 4) {
+      vjps.push_back(grads[1]);
+    } else {
+      vjps.push_back(zeros_like(primals[arg], stream()));
+    }
+  }
+  return vjps;
+}
+
+array rnnt_loss(
+  const array& logits,
+  const array& targets,
+  const array& logit_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  const std::string& reduction,
+  bool fused_log_softmax,
+  StreamOrDevice s
+) {
+  if (logits.ndim() != 4 || targets.ndim() != 2 || logits.shape()[2] != targets.shape()[1] + 1) {
+    throw std::invalid_argument("[rnnt_loss] logits should be (N, T, U+1, C) for (N, U) targets.");
+  }
+
+  auto out_dtype       = logits.dtype();
+  auto batch_size      = logits.shape()[0];
+  auto input_time_size = logits.shape()[1];
+  auto target_size     = logits.shape()[2];
+  auto reduction_mode  = ctc_loss_reduction(reduction);
+
+  // Lattice is small next to `logits`, so it is always kept for backward pass
+  std::vector<int> loss_shape;
+  if (reduction_mode == CTCReduction::none) loss_shape.push_back(batch_size);
+  std::vector<int> lattice_shape = { batch_size, input_time_size, target_size };
+  std::vector<int> norm_shape = { batch_size, input_time_size, fused_log_softmax ? target_size : 0 };
+
+  // Lattice recurrences are sequential per item, so loss is scheduled on CPU unless asked otherwise
+  auto stream = std::holds_alternative<std::monostate>(s) ? default_stream(Device::cpu) : to_stream(s);
+
+  // Output: loss, log_alpha, log-softmax normalizers of every lattice node (empty without `fused_log_softmax`)
+  return array::make_arrays(
+    { loss_shape, lattice_shape, norm_shape },
+    { out_dtype, float32, float32 },
+    std::make_shared<RNNTLoss>(stream, blank, reduction_mode, fused_log_softmax),
+    { logits, targets, logit_lengths, target_lengths }
+  )[0];
+}
+
+std::vector<array> RNNTLoss::vjp(
+  const std::vector<array>& primals,
+  const std::vector<array>& cotangents,
+  const std::vector<int>  & argnums,
+  const std::vector<array>& outputs
+) {
+  auto &logits         = primals[0];
+  auto &targets        = primals[1];
+  auto &logit_lengths  = primals[2];
+  auto &target_lengths = primals[3];
+  auto &log_alpha      = outputs[1];
+  auto &log_norm       = outputs[2];
+  auto &ctg            = cotangents[0];
+
+  return { array(
+    logits.shape(), logits.dtype(),
+    std::make_shared<RNNTLossVJP>(stream(), blank_, reduction_, fused_log_softmax_),
+    { logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg }
   ) };
 }
 
@@ -0,0 +1,117 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "ctc_loss/ctc_loss_simd.h"
+
+namespace mlx::core::ctc {
+namespace {
+
+#if defined(__ARM_NEON)
+
+struct Vec {
+  using F = float32x4_t;
+  using I = int32x4_t;
+  using M = uint32x4_t;
+  static constexpr size_t width = 4;
+
+  static inline F load(const float* p) { return vld1q_f32(p); }
+  static inline void store(float* p, F a) { vst1q_f32(p, a); }
+  static inline F set(float v) { return vdupq_n_f32(v); }
+  static inline F add(F a, F b) { return vaddq_f32(a, b); }
+  static inline F sub(F a, F b) { return vsubq_f32(a, b); }
+  static inline F mul(F a, F b) { return vmulq_f32(a, b); }
+  static inline F div(F a, F b) { return vdivq_f32(a, b); }
+  static inline F fma(F a, F b, F c) { return vfmaq_f32(c, a, b); }
+  static inline F max(F a, F b) { return vmaxq_f32(a, b); }
+  static inline F min(F a, F b) { return vminq_f32(a, b); }
+  static inline M lt(F a, F b) { return vcltq_f32(a, b); }
+  static inline M eq(F a, F b) { return vceqq_f32(a, b); }
+  static inline F select(M m, F a, F b) { return vbslq_f32(m, a, b); }
+  static inline I round_i(F a) { return vcvtnq_s32_f32(a); }
+  static inline F to_f(I a) { return vcvtq_f32_s32(a); }
+  static inline I as_i(F a) { return vreinterpretq_s32_f32(a); }
+  static inline F as_f(I a) { return vreinterpretq_f32_s32(a); }
+  static inline I add_i(I a, I b) { return vaddq_s32(a, b); }
+  static inline I sub_i(I a, I b) { return vsubq_s32(a, b); }
+  static inline I and_i(I a, I b) { return vandq_s32(a, b); }
+  static inline I or_i(I a, I b) { return vorrq_s32(a, b); }
+  static inline I set_i(int32_t v) { return vdupq_n_s32(v); }
+  template <int N> static inline I shl_i(I a) { return vshlq_n_s32(a, N); }
+  template <int N> static inline I shr_i(I a) { return vshrq_n_s32(a, N); }
+};
+
+static constexpr const char* base_isa = "neon";
+
+#else // Scalar fallback
+
+struct Vec {
+  using F = float;
+  using I = int32_t;
+  using M = bool;
+  static constexpr size_t width = 1;
+
+  static inline F load(const float* p) { return *p; }
+  static inline void store(float* p, F a) { *p = a; }
+  static inline F set(float v) { return v; }
+  static inline F add(F a, F b) { return a + b; }
+  static inline F sub(F a, F b) { return a - b; }
+  static inline F mul(F a, F b) { return a * b; }
+  static inline F div(F a, F b) { return a / b; }
+  static inline F fma(F a, F b, F c) { return a * b + c; }
+  static inline F max(F a, F b) { return a > b ? a : b; }
+  static inline F min(F a, F b) { return a < b ? a : b; }
+  static inline M lt(F a, F b) { return a < b; }
+  static inline M eq(F a, F b) { return a == b; }
+  static inline F select(M m, F a, F b) { return m ? a : b; }
+  static inline I round_i(F a) { return I(std::nearbyint(a)); }
+  static inline F to_f(I a) { return F(a); }
+  static inline I as_i(F a) { I r; std::memcpy(&r, &a, sizeof(r)); return r; }
+  static inline F as_f(I a) { F r; std::memcpy(&r, &a, sizeof(r)); return r; }
+  static inline I add_i(I a, I b) { return a + b; }
+  static inline I sub_i(I a, I b) { return a - b; }
+  static inline I and_i(I a, I b) { return a & b; }
+  static inline I or_i(I a, I b) { return a | b; }
+  static inline I set_i(int32_t v) { return v; }
+  template <int N> static inline I shl_i(I a) { return I(uint32_t(a) << N); }
+  template <int N> static inline I shr_i(I a) { return a >> N; }
+};
+
+static constexpr const char* base_isa = "scalar";
+
+#endif
+
+} // namespace
+} // namespace mlx::core::ctc
+
+#include "ctc_loss/ctc_loss_simd_impl.h"
+
+namespace mlx::core::ctc {
+
+const RowKernels& row_kernels_base() {
+  static const RowKernels kernels {
+    base_isa, row_step<-1>, row_step<+1>, occupancy, dense_max, dense_sum_exp, dense_scale_exp,
+    row_step_linear<-1>, row_step_linear<+1>, occupancy_linear, dense_log,
+  };
+  return kernels;
+}
+
+const RowKernels& row_kernels() {
+  static const RowKernels& kernels = []() -> const RowKernels& {
+#if defined(MLX_CTC_X86_SIMD)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return row_kernels_avx512();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return row_kernels_avx2();
+#endif
+    return row_kernels_base();
+  }();
+  return kernels;
+}
+
+} // namespace mlx::core::ctc
@@ -0,0 +1,132 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+namespace mlx::core::ctc {
+
+/**
+ *  Whole time step kernels of CTC recurrences over extended label sequence (`2S+1` positions).
+ *
+ *  Rows are `float` and must be readable two elements before and after `[0, width)` (filled with `-inf`).
+ *  `width` is a multiple of `kRowAlign`, extra positions are computed as `-inf` as long as `emit` is `-inf` there.
+ *  `skip` is additive mask: `0` where transition from position `k-2` (alpha) or `k+2` (beta) is allowed,
+ *  `-inf` otherwise.
+ **/
+using ctc_row_fn = void (*)(
+  const float* prev,
+  const float* emit,
+  const float* skip,
+  float* out,
+  size_t width
+);
+
+using ctc_occupancy_fn = void (*)(
+  const float* alpha,
+  const float* beta,
+  const float* emit,
+  float shift,
+  float* out,
+  size_t width
+);
+
+/**
+ *  Linear-space variants of the same kernels: rows hold probabilities scaled by a per-row factor, `0` for `-inf`
+ *  (padding included), and `skip` is the same additive mask.
+ **/
+using ctc_linear_row_fn = float (*)(
+  const float* prev,
+  const float* emit,
+  const float* skip,
+  float scale,
+  float* out,
+  size_t width
+);
+
+using ctc_linear_occupancy_fn = void (*)(
+  const float* alpha,
+  const float* beta,
+  const float* emit,
+  float scale_a,
+  float scale_b,
+  float* out,
+  size_t width
+);
+
+/**
+ *  Dense row kernels over `size` contiguous floats (any `size`, no padding), e.g. class rows of logits.
+ **/
+using ctc_max_fn = float (*)(const float* x, size_t size);
+
+using ctc_sum_exp_fn = float (*)(const float* x, float shift, size_t size);
+
+using ctc_scale_exp_fn = void (*)(
+  const float* x,
+  float shift,
+  float scale,
+  float* out,
+  size_t size
+);
+
+using ctc_log_fn = void (*)(const float* x, float shift, float* out, size_t size);
+
+struct RowKernels {
+  const char* isa;
+  // out[k] = emit[k] + logaddexp(prev[k], prev[k-1], prev[k-2] + skip[k])
+  ctc_row_fn alpha;
+  // out[k] = emit[k] + logaddexp(next[k], next[k+1], next[k+2] + skip[k])
+  ctc_row_fn beta;
+  // out[k] = exp(alpha[k] + beta[k] - emit[k] + shift), i.e. state occupancy when `shift` is negative log-likelihood
+  // (emission is counted by both alpha and beta), `0` where `emit[k]` is `-inf`
+  ctc_occupancy_fn occupancy;
+  // max(x[i]), `-inf` for empty row
+  ctc_max_fn max;
+  // sum(exp(x[i] + shift)), where `x[i] + shift <= 0` (e.g. `shift` is negated maximum)
+  ctc_sum_exp_fn sum_exp;
+  // out[i] = scale * exp(x[i] + shift), where `x[i] + shift <= 0`; `out` may be `x`
+  ctc_scale_exp_fn scale_exp;
+  // out[k] = emit[k] * (prev[k] + prev[k-1] + (skip[k] == 0 ? prev[k-2] : 0)) * scale, returns max(out[k]),
+  // or `-1` when a cell with non-zero emission and predecessors fell below normal `float` range
+  ctc_linear_row_fn alpha_linear;
+  // Same with `next[k+1]` and `next[k+2]`
+  ctc_linear_row_fn beta_linear;
+  // out[k] = (alpha[k] * scale_a) * (beta[k] * scale_b) / emit[k], `0` where `emit[k]` is `0`
+  ctc_linear_occupancy_fn occupancy_linear;
+  // out[i] = log(x[i]) + shift, `-inf` where `x[i]` is below normal range; `out` may be `x`
+  ctc_log_fn log;
+};
+
+static constexpr size_t kRowAlign = 16;
+
+// Dense row of `size` elements with any stride as contiguous `float`, converted into `buf` unless it already is one
+template <typename T>
+inline const float* dense_row(const T* data, size_t stride, size_t size, std::vector<float>& buf) {
+  if constexpr (std::is_same_v<T, float>) {
+    if (stride == 1) return data;
+  }
+  buf.resize(size);
+  for (size_t i = 0; i < size; i++) buf[i] = float(data[stride * i]);
+  return buf.data();
+}
+
+// log(sum(exp(x[i]))) of dense row
+inline float log_sum_exp(const RowKernels& kernels, const float* x, size_t size) {
+  float maxval = kernels.max(x, size);
+  if (!std::isfinite(maxval)) return maxval;
+  return maxval + std::log(kernels.sum_exp(x, -maxval, size));
+}
+
+// Best kernels for the running CPU, detected once
+const RowKernels& row_kernels();
+
+const RowKernels& row_kernels_base();
+#if defined(MLX_CTC_X86_SIMD)
+const RowKernels& row_kernels_avx2();
+const RowKernels& row_kernels_avx512();
+#endif
+
+} // namespace mlx::core::ctc
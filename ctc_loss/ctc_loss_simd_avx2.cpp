@@ -0,0 +1,61 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+// Compiled with `-mavx2 -mfma`, selected at runtime by `row_kernels()`
+
+#include <cstdint>
+
+#include <immintrin.h>
+
+#include "ctc_loss/ctc_loss_simd.h"
+
+namespace mlx::core::ctc {
+namespace {
+
+struct Vec {
+  using F = __m256;
+  using I = __m256i;
+  using M = __m256;
+  static constexpr size_t width = 8;
+
+  static inline F load(const float* p) { return _mm256_loadu_ps(p); }
+  static inline void store(float* p, F a) { _mm256_storeu_ps(p, a); }
+  static inline F set(float v) { return _mm256_set1_ps(v); }
+  static inline F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static inline F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static inline F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static inline F div(F a, F b) { return _mm256_div_ps(a, b); }
+  static inline F fma(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+  static inline F max(F a, F b) { return _mm256_max_ps(a, b); }
+  static inline F min(F a, F b) { return _mm256_min_ps(a, b); }
+  static inline M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static inline M eq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static inline F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+  static inline I round_i(F a) { return _mm256_cvtps_epi32(a); }
+  static inline F to_f(I a) { return _mm256_cvtepi32_ps(a); }
+  static inline I as_i(F a) { return _mm256_castps_si256(a); }
+  static inline F as_f(I a) { return _mm256_castsi256_ps(a); }
+  static inline I add_i(I a, I b) { return _mm256_add_epi32(a, b); }
+  static inline I sub_i(I a, I b) { return _mm256_sub_epi32(a, b); }
+  static inline I and_i(I a, I b) { return _mm256_and_si256(a, b); }
+  static inline I or_i(I a, I b) { return _mm256_or_si256(a, b); }
+  static inline I set_i(int32_t v) { return _mm256_set1_epi32(v); }
+  template <int N> static inline I shl_i(I a) { return _mm256_slli_epi32(a, N); }
+  template <int N> static inline I shr_i(I a) { return _mm256_srai_epi32(a, N); }
+};
+
+} // namespace
+} // namespace mlx::core::ctc
+
+#include "ctc_loss/ctc_loss_simd_impl.h"
+
+namespace mlx::core::ctc {
+
+const RowKernels& row_kernels_avx2() {
+  static const RowKernels kernels {
+    "avx2", row_step<-1>, row_step<+1>, occupancy, dense_max, dense_sum_exp, dense_scale_exp,
+    row_step_linear<-1>, row_step_linear<+1>, occupancy_linear, dense_log,
+  };
+  return kernels;
+}
+
+} // namespace mlx::core::ctc
@@ -0,0 +1,219 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+// Generic row kernels, included by every ISA translation unit after definition of `struct Vec`:
+//   `F` / `I` / `M` - float, int32 and mask registers, `width` - floats per register,
+//   `load`, `store`, `set`, `add`, `sub`, `mul`, `div`, `fma` (a*b+c), `max`, `min`, `lt`, `eq`, `select(m, a, b)`,
+//   `round_i` (float -> nearest int), `to_f` (int -> float), `as_i` / `as_f` (bit casts),
+//   `add_i`, `sub_i`, `and_i`, `or_i`, `set_i`, `shl_i<N>`, `shr_i<N>`.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "ctc_loss/ctc_loss_simd.h"
+
+namespace mlx::core::ctc {
+namespace {
+
+using F = Vec::F;
+using I = Vec::I;
+using M = Vec::M;
+
+// Polynomials and their constants are those of scalar log-semiring math
+namespace stdlib = std;
+#include "ctc_loss/ctc_logmath.h"
+
+// exp(x) for x < 88, cephes polynomial (~1 ulp), exactly 0 below float range; scalar registers use scalar math
+template <typename V>
+static inline V exp_f(V x) {
+  if constexpr (std::is_same_v<V, float>) {
+    return _ctc_fast_exp(x);
+  } else {
+    F xc = Vec::max(x, Vec::set(_ctc_exp_min));
+    I n  = Vec::round_i(Vec::mul(xc, Vec::set(_ctc_log2e)));
+    F fn = Vec::to_f(n);
+    F r  = Vec::fma(fn, Vec::set(-_ctc_ln2_hi), xc);
+    r    = Vec::fma(fn, Vec::set(-_ctc_ln2_lo), r);
+    F p  = Vec::set(_ctc_exp_poly[0]);
+    for (int i = 1; i < 6; i++) p = Vec::fma(p, r, Vec::set(_ctc_exp_poly[i]));
+    F y = Vec::add(Vec::fma(p, Vec::mul(r, r), r), Vec::set(1.f));
+    F scale = Vec::as_f(Vec::shl_i<23>(Vec::add_i(n, Vec::set_i(127))));
+    return Vec::select(Vec::lt(x, Vec::set(_ctc_exp_min)), Vec::set(0.f), Vec::mul(y, scale));
+  }
+}
+
+// log(x) for normal positive x, cephes polynomial (~1 ulp)
+template <typename V>
+static inline V log_pos(V x) {
+  if constexpr (std::is_same_v<V, float>) {
+    return _ctc_fast_log(x);
+  } else {
+    I xi = Vec::as_i(x);
+    F e  = Vec::to_f(Vec::sub_i(Vec::shr_i<23>(xi), Vec::set_i(126)));
+    F m  = Vec::as_f(Vec::or_i(Vec::and_i(xi, Vec::set_i(0x007fffff)), Vec::set_i(0x3f000000)));
+    M small = Vec::lt(m, Vec::set(_ctc_sqrt_half));
+    e = Vec::select(small, Vec::sub(e, Vec::set(1.f)), e);
+    m = Vec::sub(Vec::select(small, Vec::add(m, m), m), Vec::set(1.f));
+    F z = Vec::mul(m, m);
+    F y = Vec::set(_ctc_log_poly[0]);
+    for (int i = 1; i < 9; i++) y = Vec::fma(y, m, Vec::set(_ctc_log_poly[i]));
+    y = Vec::mul(Vec::mul(y, m), z);
+    y = Vec::fma(e, Vec::set(_ctc_ln2_lo), y);
+    y = Vec::fma(z, Vec::set(-0.5f), y);
+    return Vec::fma(e, Vec::set(_ctc_ln2_hi), Vec::add(m, y));
+  }
+}
+
+// logaddexp(a, b, c) with two exponents and one logarithm: argument of log is always in [1, 3]
+static inline F logaddexp3(F a, F b, F c) {
+  const F ninf = Vec::set(-std::numeric_limits<float>::infinity());
+  F mx = Vec::max(a, Vec::max(b, c));
+  F mn = Vec::min(a, Vec::min(b, c));
+  F md = Vec::max(Vec::min(a, b), Vec::min(Vec::max(a, b), c));
+  M none = Vec::eq(mx, ninf);
+  F ms = Vec::select(none, Vec::set(0.f), mx);
+  F s = Vec::add(Vec::set(1.f), Vec::add(exp_f(Vec::sub(md, ms)), exp_f(Vec::sub(mn, ms))));
+  return Vec::select(none, ninf, Vec::add(mx, log_pos(s)));
+}
+
+template <int D>
+static void row_step(const float* prev, const float* emit, const float* skip, float* out, size_t width) {
+  for (size_t k = 0; k < width; k += Vec::width) {
+    F p0 = Vec::load(prev + k);
+    F p1 = Vec::load(prev + k + D);
+    F p2 = Vec::add(Vec::load(prev + k + 2 * D), Vec::load(skip + k));
+    Vec::store(out + k, Vec::add(Vec::load(emit + k), logaddexp3(p0, p1, p2)));
+  }
+}
+
+// Emission is subtracted before `exp`, so posterior does not underflow with emission; alpha and beta are `-inf`
+// wherever emission is, and such cells are zero
+static void occupancy(const float* alpha, const float* beta, const float* emit, float shift, float* out, size_t width) {
+  const F ninf = Vec::set(-std::numeric_limits<float>::infinity());
+  F sh = Vec::set(shift);
+  for (size_t k = 0; k < width; k += Vec::width) {
+    F e = Vec::load(emit + k);
+    F x = Vec::add(Vec::sub(Vec::add(Vec::load(alpha + k), Vec::load(beta + k)), e), sh);
+    Vec::store(out + k, Vec::select(Vec::eq(e, ninf), Vec::set(0.f), exp_f(x)));
+  }
+}
+
+// Horizontal reductions go through memory: they run once per row, outside of the hot loops
+static inline float reduce_max(F a) {
+  float v[Vec::width];
+  Vec::store(v, a);
+  float r = v[0];
+  for (size_t i = 1; i < Vec::width; i++) r = (v[i] > r) ? v[i] : r;
+  return r;
+}
+
+static inline float reduce_add(F a) {
+  float v[Vec::width];
+  Vec::store(v, a);
+  float r = v[0];
+  for (size_t i = 1; i < Vec::width; i++) r += v[i];
+  return r;
+}
+
+// Precision is lost where cell with non-zero emission and predecessors falls below normal range,
+// `min(emit, sum)` is kept for such cells, so that any positive lane reports underflow
+template <int D>
+static float row_step_linear(const float* prev, const float* emit, const float* skip, float scale, float* out, size_t width) {
+  const F zero = Vec::set(0.f);
+  const F tiny = Vec::set(std::numeric_limits<float>::min());
+  F sc   = Vec::set(scale);
+  F mx   = zero;
+  F lost = zero;
+  for (size_t k = 0; k < width; k += Vec::width) {
+    F e  = Vec::load(emit + k);
+    F p2 = Vec::select(Vec::eq(Vec::load(skip + k), zero), Vec::load(prev + k + 2 * D), zero);
+    F s  = Vec::add(Vec::add(Vec::load(prev + k), Vec::load(prev + k + D)), p2);
+    F r  = Vec::mul(e, Vec::mul(s, sc));
+    Vec::store(out + k, r);
+    mx   = Vec::max(mx, r);
+    lost = Vec::max(lost, Vec::select(Vec::lt(r, tiny), Vec::min(e, s), zero));
+  }
+  return (reduce_max(lost) > 0) ? -1.f : reduce_max(mx);
+}
+
+// Emission is divided out of scaled alpha first, so that product of two emissions never underflows
+static void occupancy_linear(
+  const float* alpha,
+  const float* beta,
+  const float* emit,
+  float scale_a,
+  float scale_b,
+  float* out,
+  size_t width
+) {
+  const F zero = Vec::set(0.f);
+  F sa = Vec::set(scale_a);
+  F sb = Vec::set(scale_b);
+  for (size_t k = 0; k < width; k += Vec::width) {
+    F e = Vec::load(emit + k);
+    M none = Vec::eq(e, zero);
+    F a = Vec::div(Vec::mul(Vec::load(alpha + k), sa), Vec::select(none, Vec::set(1.f), e));
+    Vec::store(out + k, Vec::select(none, zero, Vec::mul(a, Vec::mul(Vec::load(beta + k), sb))));
+  }
+}
+
+// Tail of dense row is processed as one register, padded with `-inf`
+static inline F load_tail(const float* x, size_t n) {
+  float v[Vec::width];
+  for (size_t i = 0; i < Vec::width; i++) v[i] = (i < n) ? x[i] : -std::numeric_limits<float>::infinity();
+  return Vec::load(v);
+}
+
+static float dense_max(const float* x, size_t size) {
+  F m = Vec::set(-std::numeric_limits<float>::infinity());
+  size_t i = 0;
+  for (; i + Vec::width <= size; i += Vec::width) m = Vec::max(m, Vec::load(x + i));
+  if (i < size) m = Vec::max(m, load_tail(x + i, size - i));
+  return reduce_max(m);
+}
+
+static float dense_sum_exp(const float* x, float shift, size_t size) {
+  F sh = Vec::set(shift);
+  F s  = Vec::set(0.f);
+  size_t i = 0;
+  for (; i + Vec::width <= size; i += Vec::width) s = Vec::add(s, exp_f(Vec::add(Vec::load(x + i), sh)));
+  if (i < size) s = Vec::add(s, exp_f(Vec::add(load_tail(x + i, size - i), sh)));
+  return reduce_add(s);
+}
+
+static void dense_scale_exp(const float* x, float shift, float scale, float* out, size_t size) {
+  F sh = Vec::set(shift);
+  F sc = Vec::set(scale);
+  size_t i = 0;
+  for (; i + Vec::width <= size; i += Vec::width) {
+    Vec::store(out + i, Vec::mul(sc, exp_f(Vec::add(Vec::load(x + i), sh))));
+  }
+  if (i < size) {
+    float v[Vec::width];
+    Vec::store(v, Vec::mul(sc, exp_f(Vec::add(load_tail(x + i, size - i), sh))));
+    for (size_t k = 0; i + k < size; k++) out[i + k] = v[k];
+  }
+}
+
+static void dense_log(const float* x, float shift, float* out, size_t size) {
+  const F tiny = Vec::set(std::numeric_limits<float>::min());
+  const F ninf = Vec::set(-std::numeric_limits<float>::infinity());
+  F sh = Vec::set(shift);
+  size_t i = 0;
+  for (; i + Vec::width <= size; i += Vec::width) {
+    F v = Vec::load(x + i);
+    Vec::store(out + i, Vec::select(Vec::lt(v, tiny), ninf, Vec::add(log_pos(v), sh)));
+  }
+  if (i < size) {
+    float v[Vec::width];
+    F t = load_tail(x + i, size - i);
+    Vec::store(v, Vec::select(Vec::lt(t, tiny), ninf, Vec::add(log_pos(t), sh)));
+    for (size_t k = 0; i + k < size; k++) out[i + k] = v[k];
+  }
+}
+
+static_assert(kRowAlign % Vec::width == 0, "Row alignment should be multiple of vector width");
+
+} // namespace
+} // namespace mlx::core::ctc
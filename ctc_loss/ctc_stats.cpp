@@ -0,0 +1,74 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#include <stdexcept>
+
+#include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_stats.h"
+
+namespace mlx::core {
+
+namespace ctc {
+
+#if defined(MLX_CTC_STATS)
+
+static std::atomic<uint64_t> phase_ns[size_t(StatsPhase::count)];
+static std::atomic<uint64_t> counters[size_t(StatsCounter::count)];
+
+void stats_add(StatsPhase phase, uint64_t ns) {
+  phase_ns[size_t(phase)].fetch_add(ns, std::memory_order_relaxed);
+}
+
+void stats_add(StatsCounter counter, uint64_t value) {
+  counters[size_t(counter)].fetch_add(value, std::memory_order_relaxed);
+}
+
+static uint64_t stats_get(StatsPhase phase) { return phase_ns[size_t(phase)].load(std::memory_order_relaxed); }
+static uint64_t stats_get(StatsCounter counter) { return counters[size_t(counter)].load(std::memory_order_relaxed); }
+
+#else // Instrumentation is compiled out
+
+static uint64_t stats_get(StatsPhase) { return 0; }
+static uint64_t stats_get(StatsCounter) { return 0; }
+
+#endif
+
+} // namespace ctc
+
+void ctc_set_stats_enabled(bool enabled) {
+#if defined(MLX_CTC_STATS)
+  ctc::stats_flag.store(enabled, std::memory_order_relaxed);
+#else
+  if (enabled) throw std::runtime_error("CTC stats are not compiled in (build with MLX_CTC_STATS).");
+#endif
+}
+
+bool ctc_get_stats_enabled() {
+  return ctc::stats_enabled();
+}
+
+CTCStats ctc_get_stats() {
+  using ctc::StatsPhase;
+  using ctc::StatsCounter;
+  return {
+    ctc::stats_get(StatsCounter::forward_calls),
+    ctc::stats_get(StatsCounter::backward_calls),
+    ctc::stats_get(StatsPhase::alloc),
+    ctc::stats_get(StatsPhase::alpha),
+    ctc::stats_get(StatsPhase::final),
+    ctc::stats_get(StatsPhase::beta),
+    ctc::stats_get(StatsPhase::vjp_final),
+    ctc::stats_get(StatsCounter::bytes_allocated),
+    ctc::stats_get(StatsCounter::valid_cells),
+    ctc::stats_get(StatsCounter::padded_cells),
+    ctc::stats_get(StatsCounter::linear_fallbacks),
+  };
+}
+
+void ctc_reset_stats() {
+#if defined(MLX_CTC_STATS)
+  for (auto& v : ctc::phase_ns) v.store(0, std::memory_order_relaxed);
+  for (auto& v : ctc::counters) v.store(0, std::memory_order_relaxed);
+#endif
+}
+
+} // namespace mlx::core
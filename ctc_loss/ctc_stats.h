@@ -0,0 +1,71 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace mlx::core::ctc {
+
+/**
+ *  Opt-in counters of CTC loss primitives.
+ *
+ *  Compiled in with `MLX_CTC_STATS`, and collected only while enabled at runtime. Primitives check the flag
+ *  once per call: disabled (or compiled out) collection leaves per-frame loops untouched, and enabled one
+ *  keeps per-sequence sums in locals, published by a few relaxed atomic adds per sequence.
+ **/
+enum class StatsPhase : size_t { alloc, alpha, final, beta, vjp_final, count };
+
+enum class StatsCounter : size_t { forward_calls, backward_calls, bytes_allocated, valid_cells, padded_cells, linear_fallbacks, count };
+
+#if defined(MLX_CTC_STATS)
+
+inline std::atomic<bool> stats_flag{false};
+
+inline bool stats_enabled() { return stats_flag.load(std::memory_order_relaxed); }
+
+void stats_add(StatsPhase phase, uint64_t ns);
+void stats_add(StatsCounter counter, uint64_t value);
+
+#else // Instrumentation is compiled out
+
+constexpr bool stats_enabled() { return false; }
+
+inline void stats_add(StatsPhase, uint64_t) {}
+inline void stats_add(StatsCounter, uint64_t) {}
+
+#endif
+
+/**
+ *  Splits elapsed time between phases: every `lap` adds time since previous lap (or construction) to `ns`.
+ *  Does not read the clock when stats are disabled.
+ **/
+class StatsLap {
+public:
+  explicit StatsLap(bool enabled) : enabled_(enabled) {
+    if (enabled_) last_ = std::chrono::steady_clock::now();
+  }
+
+  void lap(uint64_t& ns) {
+    if (!enabled_) return;
+    auto now = std::chrono::steady_clock::now();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+    last_ = now;
+  }
+
+  // Publishes time since previous lap directly, for phases measured once per call or sequence
+  void lap(StatsPhase phase) {
+    if (!enabled_) return;
+    uint64_t ns = 0;
+    lap(ns);
+    stats_add(phase, ns);
+  }
+
+private:
+  bool enabled_;
+  std::chrono::steady_clock::time_point last_;
+};
+
+} // namespace mlx::core::ctc
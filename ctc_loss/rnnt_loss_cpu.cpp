@@ -0,0 +1,458 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "ctc_loss/ctc_loss.h"
+#include "ctc_loss/ctc_loss_simd.h"
+#include "ctc_loss/thread_pool.h"
+
+namespace mlx::core {
+
+namespace stdlib = std;
+#include "ctc_loss/ctc_logmath.h"
+
+#define assert_contiguous(a) \
+  if (a.ndim() > 0 && a.strides()[a.ndim()-1] != 1) throw std::runtime_error(#a " should be contiguous on last dimension")
+
+/**
+ *  Lattice of one sequence: class rows of nodes `(t, u)` of joint network outputs.
+ *  Log-probabilities are `x - norm[t][u]` with fused log-softmax, or `x` itself when `norm` is `nullptr`.
+ **/
+template <typename T, typename I>
+struct RNNTLattice {
+  const T* data;
+  size_t stride_T;
+  size_t stride_U;
+  size_t stride_C;
+  const I* labels;
+  const float* norm;
+  size_t norm_stride_T;
+  size_t blank;
+  size_t input_length;
+  size_t target_length;
+
+  const T* row(size_t t, size_t u) const { return &data[stride_T * t + stride_U * u]; }
+
+  float log_prob(size_t t, size_t u, size_t c) const {
+    float x = float(row(t, u)[stride_C * c]);
+    return norm ? x - norm[norm_stride_T * t + u] : x;
+  }
+
+  float blank_lp(size_t t, size_t u) const { return log_prob(t, u, blank); }
+  float label_lp(size_t t, size_t u) const { return log_prob(t, u, size_t(labels[u])); }
+
+  /**
+   *  alpha[t][u] = logaddexp(alpha[t-1][u] + blank(t-1, u), alpha[t][u-1] + label(t, u-1))
+   *
+   *  Nodes are visited by anti-diagonals `t + u = d`: both dependencies lie on diagonal `d-1`,
+   *  so every diagonal is split between ranks of `team`, with one barrier after it. Returns log-likelihood.
+   **/
+  float alpha(float* out, size_t out_stride_T, const ctc::Team& team) const {
+    for (size_t d = 0; d < input_length + target_length; d++) {
+      size_t t0 = (d > target_length) ? d - target_length : 0;
+      size_t t1 = std::min(d, input_length - 1);
+      auto [i0, i1] = team.slice(t1 + 1 - t0);
+      for (size_t t = t0 + i0; t < t0 + i1; t++) {
+        size_t u = d - t;
+        float a_blank = (t > 0) ? out[out_stride_T * (t-1) + u] + blank_lp(t-1, u) : neginf<float>;
+        float a_label = (u > 0) ? out[out_stride_T * t + u-1] + label_lp(t, u-1) : neginf<float>;
+        out[out_stride_T * t + u] = (d == 0) ? 0 : logaddexp(a_blank, a_label);
+      }
+      team.sync();
+    }
+    return out[out_stride_T * (input_length-1) + target_length] + blank_lp(input_length-1, target_length);
+  }
+
+  /**
+   *  beta[t][u] = logaddexp(beta[t+1][u] + blank(t, u), beta[t][u+1] + label(t, u)), i.e. including emission
+   *  of node `(t, u)`, with final blank emitted from `(T-1, U)`. Visited by anti-diagonals in reverse.
+   **/
+  void beta(float* out, size_t out_stride_T, const ctc::Team& team) const {
+    for (size_t d = input_length + target_length; d-- > 0;) {
+      size_t t0 = (d > target_length) ? d - target_length : 0;
+      size_t t1 = std::min(d, input_length - 1);
+      auto [i0, i1] = team.slice(t1 + 1 - t0);
+      for (size_t t = t0 + i0; t < t0 + i1; t++) {
+        size_t u = d - t;
+        float b_blank = next_blank(out, out_stride_T, t, u) + blank_lp(t, u);
+        float b_label = (u < target_length) ? out[out_stride_T * t + u+1] + label_lp(t, u) : neginf<float>;
+        out[out_stride_T * t + u] = logaddexp(b_blank, b_label);
+      }
+      team.sync();
+    }
+  }
+
+  // Beta after blank emitted from `(t, u)`: next frame, or end of sequence from the last node
+  float next_blank(const float* beta, size_t beta_stride_T, size_t t, size_t u) const {
+    if (t + 1 < input_length) return beta[beta_stride_T * (t+1) + u];
+    return (u == target_length) ? 0 : neginf<float>;
+  }
+};
+
+template <typename I>
+static std::vector<size_t> rnnt_loss_schedule(const I* inl_data, const I* tgl_data, size_t batch_size) {
+  std::vector<size_t> costs(batch_size);
+  for (size_t b = 0; b < batch_size; b++) {
+    costs[b] = size_t(inl_data[b]) * (size_t(tgl_data[b]) + 1);
+  }
+  return ctc::schedule_by_cost(costs);
+}
+
+// Minimal slice of anti-diagonal per thread of a team, below which barriers between diagonals cost more than they save
+static constexpr size_t kRNNTTeamSlice = 256;
+
+/**
+ *  Runs `fn(b, team)` for every item of `order`.
+ *
+ *  Items are computed in parallel, unless there are fewer of them than threads: then they are computed
+ *  one by one, and anti-diagonals of every item (at most `min(T, U+1)` nodes) are split by a team.
+ **/
+template <typename I, typename F>
+static void rnnt_loss_for_each(const std::vector<size_t>& order, const I* inl_data, const I* tgl_data, F&& fn) {
+  auto& pool = ctc::ThreadPool::instance();
+  if (order.size() >= pool.size()) {
+    return pool.parallel_for(order, [&](size_t b) { fn(b, ctc::Team { 0, 1, nullptr }); });
+  }
+  for (size_t b : order) {
+    size_t diagonal = std::min(size_t(inl_data[b]), size_t(tgl_data[b]) + 1);
+    pool.parallel_team(diagonal / kRNNTTeamSlice, [&](const ctc::Team& team) { fn(b, team); });
+  }
+}
+
+template <typename T, typename I>
+static void rnnt_loss_impl(
+  const array& logits,
+  const array& targets,
+  const array& logit_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  CTCReduction reduction,
+  bool fused_log_softmax,
+  array& loss,
+  array& log_alpha,
+  array& log_norm
+) {
+  assert_contiguous(targets);
+  assert_contiguous(logit_lengths);
+  assert_contiguous(target_lengths);
+
+  loss.set_data(allocator::malloc_or_wait(loss.nbytes()));
+  log_alpha.set_data(allocator::malloc_or_wait(log_alpha.nbytes()));
+  log_norm.set_data(allocator::malloc_or_wait(log_norm.nbytes()));
+
+  size_t batch_size       = logits.shape()[0];
+  size_t max_input_length = logits.shape()[1];
+  size_t lattice_width    = logits.shape()[2];
+  size_t num_channels     = logits.shape()[3];
+
+  size_t logit_stride_B = logits.strides()[0];
+  size_t logit_stride_T = logits.strides()[1];
+  size_t logit_stride_U = logits.strides()[2];
+  size_t logit_stride_C = logits.strides()[3];
+  size_t   tgt_stride_B = targets.strides()[0];
+  size_t  loga_stride_B = log_alpha.strides()[0];
+  size_t  loga_stride_T = log_alpha.strides()[1];
+  size_t  norm_stride_B = fused_log_softmax ? log_norm.strides()[0] : 0;
+  size_t  norm_stride_T = fused_log_softmax ? log_norm.strides()[1] : 0;
+
+  const T* logit_data = logits.data<T>();
+  const I* tgt_data   = targets.data<I>();
+  const I* inl_data   = logit_lengths.data<I>();
+  const I* tgl_data   = target_lengths.data<I>();
+        T* loss_data  = loss.data<T>();
+    float* loga_data  = log_alpha.data<float>();
+    float* norm_data  = log_norm.data<float>();
+
+  auto& kernels = ctc::row_kernels();
+  auto& pool = ctc::ThreadPool::instance();
+
+  // Normalizers are the dense `O(TUC)` part, so they are spread over threads by frame for any batch size
+  if (fused_log_softmax) {
+    pool.parallel_for(batch_size * max_input_length, [&](size_t i) {
+      size_t b = i / max_input_length;
+      size_t t = i % max_input_length;
+      size_t num_nodes = (t < size_t(inl_data[b])) ? size_t(tgl_data[b]) + 1 : 0;
+      float* norm_time_data = &norm_data[norm_stride_B * b + norm_stride_T * t];
+      thread_local std::vector<float> buf;
+      for (size_t u = 0; u < num_nodes; u++) {
+        const T* row = &logit_data[logit_stride_B * b + logit_stride_T * t + logit_stride_U * u];
+        norm_time_data[u] = ctc::log_sum_exp(kernels, ctc::dense_row(row, logit_stride_C, num_channels, buf), num_channels);
+      }
+      std::fill(norm_time_data + num_nodes, norm_time_data + lattice_width, 0.f);
+    });
+  }
+
+  std::vector<float> nll(batch_size);
+  rnnt_loss_for_each(rnnt_loss_schedule(inl_data, tgl_data, batch_size), inl_data, tgl_data, [&](size_t b, const ctc::Team& team) {
+    size_t input_length = size_t(inl_data[b]);
+    float* loga_batch_data = &loga_data[loga_stride_B * b];
+    auto [f0, f1] = team.slice(loga_stride_B);
+    std::fill(loga_batch_data + f0, loga_batch_data + f1, neginf<float>);
+    if (input_length == 0) {
+      if (team.rank == 0) nll[b] = -neginf<float>;
+      return;
+    }
+    team.sync();
+    RNNTLattice<T, I> lattice {
+      &logit_data[logit_stride_B * b], logit_stride_T, logit_stride_U, logit_stride_C,
+      &tgt_data[tgt_stride_B * b],
+      fused_log_softmax ? &norm_data[norm_stride_B * b] : nullptr, norm_stride_T,
+      size_t(blank), input_length, size_t(tgl_data[b]),
+    };
+    float log_likelihood = lattice.alpha(loga_batch_data, loga_stride_T, team);
+    if (team.rank == 0) nll[b] = -log_likelihood;
+  });
+
+  if (reduction == CTCReduction::none) {
+    for (size_t b = 0; b < batch_size; b++) loss_data[b] = T(nll[b]);
+    return;
+  }
+  // Reduced in batch order, so result does not depend on thread count
+  float sum = 0;
+  for (size_t b = 0; b < batch_size; b++) sum += nll[b];
+  loss_data[0] = T((reduction == CTCReduction::mean) ? sum / float(batch_size) : sum);
+}
+
+template <typename T, typename I>
+static void rnnt_loss_vjp_impl(
+  const array& logits,
+  const array& targets,
+  const array& logit_lengths,
+  const array& target_lengths,
+  const array& log_alpha,
+  const array& log_norm,
+  const array& ctg,
+  uint64_t blank,
+  CTCReduction reduction,
+  bool fused_log_softmax,
+  array& grad
+) {
+  assert_contiguous(targets);
+  assert_contiguous(logit_lengths);
+  assert_contiguous(target_lengths);
+  assert_contiguous(log_alpha);
+  assert_contiguous(ctg);
+
+  // Every class row of `logits` is read before the same row of gradient is written,
+  // so gradient takes over `logits` buffer when nothing else holds it
+  if (logits.is_donatable() && logits.flags().row_contiguous) {
+    grad.copy_shared_buffer(logits);
+  } else {
+    grad.set_data(allocator::malloc_or_wait(grad.nbytes()));
+  }
+
+  size_t batch_size       = logits.shape()[0];
+  size_t max_input_length = logits.shape()[1];
+  size_t lattice_width    = logits.shape()[2];
+  size_t num_channels     = logits.shape()[3];
+
+  size_t logit_stride_B = logits.strides()[0];
+  size_t logit_stride_T = logits.strides()[1];
+  size_t logit_stride_U = logits.strides()[2];
+  size_t logit_stride_C = logits.strides()[3];
+  size_t   tgt_stride_B = targets.strides()[0];
+  size_t  loga_stride_B = log_alpha.strides()[0];
+  size_t  loga_stride_T = log_alpha.strides()[1];
+  size_t  norm_stride_B = fused_log_softmax ? log_norm.strides()[0] : 0;
+  size_t  norm_stride_T = fused_log_softmax ? log_norm.strides()[1] : 0;
+  size_t  grad_stride_B = grad.strides()[0];
+  size_t  grad_stride_T = grad.strides()[1];
+  size_t  grad_stride_U = grad.strides()[2];
+
+      const T* logit_data = logits.data<T>();
+      const I* tgt_data   = targets.data<I>();
+      const I* inl_data   = logit_lengths.data<I>();
+      const I* tgl_data   = target_lengths.data<I>();
+  const float* loga_data  = log_alpha.data<float>();
+  const float* norm_data  = log_norm.data<float>();
+      const T* gro_data   = ctg.data<T>();
+            T* grad_data  = grad.data<T>();
+
+  auto& kernels = ctc::row_kernels();
+  auto& pool = ctc::ThreadPool::instance();
+
+  // `float` rows are transformed in place (gradient rows are always contiguous), other types through a buffer
+  bool direct = std::is_same_v<T, float> && logit_stride_C == 1;
+
+  auto lattice_of = [&](size_t b) {
+    return RNNTLattice<T, I> {
+      &logit_data[logit_stride_B * b], logit_stride_T, logit_stride_U, logit_stride_C,
+      &tgt_data[tgt_stride_B * b],
+      fused_log_softmax ? &norm_data[norm_stride_B * b] : nullptr, norm_stride_T,
+      size_t(blank), size_t(inl_data[b]), size_t(tgl_data[b]),
+    };
+  };
+
+  // Beta lattice of the whole batch, as gradient rows of one frame depend on beta of the next one
+  size_t beta_stride_T = lattice_width;
+  size_t beta_stride_B = lattice_width * max_input_length;
+  std::vector<float> beta(beta_stride_B * batch_size);
+  std::vector<float> log_likelihood(batch_size, neginf<float>);
+  rnnt_loss_for_each(rnnt_loss_schedule(inl_data, tgl_data, batch_size), inl_data, tgl_data, [&](size_t b, const ctc::Team& team) {
+    auto lattice = lattice_of(b);
+    if (lattice.input_length == 0) return;
+    lattice.beta(&beta[beta_stride_B * b], beta_stride_T, team);
+    if (team.rank == 0) log_likelihood[b] = beta[beta_stride_B * b];
+  });
+
+  float weight = (reduction == CTCReduction::mean) ? 1.0f / float(batch_size) : 1.0f;
+
+  // Gradient rows are the dense part again, spread over threads by frame:
+  // d(-ln P)/d(lp_c) = -occupancy of emission `c` from node, and with fused log-softmax
+  // d(-ln P)/d(x_c) = occupancy(node) * softmax(x)_c - occupancy of emission `c`
+  pool.parallel_for(batch_size * max_input_length, [&](size_t i) {
+    size_t b = i / max_input_length;
+    size_t t = i % max_input_length;
+    T* grad_time_data = &grad_data[grad_stride_B * b + grad_stride_T * t];
+    auto lattice = lattice_of(b);
+    float log_p = log_likelihood[b];
+    size_t num_nodes = (t < lattice.input_length && std::isfinite(log_p)) ? lattice.target_length + 1 : 0;
+    float gr_b = float(gro_data[(reduction == CTCReduction::none) ? b : 0]) * weight;
+    const float* alpha = &loga_data[loga_stride_B * b];
+    const float* beta_batch = &beta[beta_stride_B * b];
+    thread_local std::vector<float> buf;
+
+    for (size_t u = 0; u < num_nodes; u++) {
+      const T* logit_row = lattice.row(t, u);
+      T* grad_row = &grad_time_data[grad_stride_U * u];
+      float a = alpha[loga_stride_T * t + u] - log_p;
+      float occ_blank = std::exp(a + lattice.blank_lp(t, u) + lattice.next_blank(beta_batch, beta_stride_T, t, u));
+      float occ_label = (u < lattice.target_length) ?
+        std::exp(a + lattice.label_lp(t, u) + beta_batch[beta_stride_T * t + u+1]) : 0.f;
+      size_t label = (u < lattice.target_length) ? size_t(lattice.labels[u]) : size_t(blank);
+
+      if (!fused_log_softmax) {
+        std::fill_n(grad_row, num_channels, T(0));
+        grad_row[blank] = T(-occ_blank * gr_b);
+        grad_row[label] = T(float(grad_row[label]) - occ_label * gr_b);
+        continue;
+      }
+
+      float shift = -lattice.norm[norm_stride_T * t + u];
+      float scale = (occ_blank + occ_label) * gr_b;
+      float* out;
+      if (direct) {
+        out = reinterpret_cast<float*>(grad_row);
+        kernels.scale_exp(reinterpret_cast<const float*>(logit_row), shift, scale, out, num_channels);
+      } else {
+        const float* row = ctc::dense_row(logit_row, logit_stride_C, num_channels, buf);
+        out = buf.data();
+        kernels.scale_exp(row, shift, scale, out, num_channels);
+      }
+      out[blank] -= occ_blank * gr_b;
+      out[label] -= occ_label * gr_b;
+      if (!direct) {
+        for (size_t c = 0; c < num_channels; c++) grad_row[c] = T(out[c]);
+      }
+    }
+    // Nodes beyond target length, padding frames and impossible sequences
+    for (size_t u = num_nodes; u < lattice_width; u++) {
+      std::fill_n(&grad_time_data[grad_stride_U * u], num_channels, T(0));
+    }
+  });
+}
+
+template <typename T>
+static void rnnt_loss_impl_i(
+  const array& logits,
+  const array& targets,
+  const array& logit_lengths,
+  const array& target_lengths,
+  uint64_t blank,
+  CTCReduction reduction,
+  bool fused_log_softmax,
+  array& loss,
+  array& log_alpha,
+  array& log_norm
+) {
+  if (targets.dtype() == uint64 || targets.dtype() == int64) {
+    return rnnt_loss_impl<T, uint64_t>(logits, targets, logit_lengths, target_lengths, blank, reduction, fused_log_softmax, loss, log_alpha, log_norm);
+  }
+  if (targets.dtype() == uint32 || targets.dtype() == int32) {
+    return rnnt_loss_impl<T, uint32_t>(logits, targets, logit_lengths, target_lengths, blank, reduction, fused_log_softmax, loss, log_alpha, log_norm);
+  }
+  if (targets.dtype() == uint16 || targets.dtype() == int16) {
+    return rnnt_loss_impl<T, uint16_t>(logits, targets, logit_lengths, target_lengths, blank, reduction, fused_log_softmax, loss, log_alpha, log_norm);
+  }
+  if (targets.dtype() == uint8 || targets.dtype() == int8) {
+    return rnnt_loss_impl<T, uint8_t>(logits, targets, logit_lengths, target_lengths, blank, reduction, fused_log_softmax, loss, log_alpha, log_norm);
+  }
+  throw std::runtime_error("RNNTLoss is only supported for integral targets.");
+}
+
+template <typename T>
+static void rnnt_loss_vjp_impl_i(
+  const array& logits,
+  const array& targets,
+  const array& logit_lengths,
+  const array& target_lengths,
+  const array& log_alpha,
+  const array& log_norm,
+  const array& ctg,
+  uint64_t blank,
+  CTCReduction reduction,
+  bool fused_log_softmax,
+  array& grad
+) {
+  if (targets.dtype() == uint64 || targets.dtype() == int64) {
+    return rnnt_loss_vjp_impl<T, uint64_t>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank, reduction, fused_log_softmax, grad);
+  }
+  if (targets.dtype() == uint32 || targets.dtype() == int32) {
+    return rnnt_loss_vjp_impl<T, uint32_t>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank, reduction, fused_log_softmax, grad);
+  }
+  if (targets.dtype() == uint16 || targets.dtype() == int16) {
+    return rnnt_loss_vjp_impl<T, uint16_t>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank, reduction, fused_log_softmax, grad);
+  }
+  if (targets.dtype() == uint8 || targets.dtype() == int8) {
+    return rnnt_loss_vjp_impl<T, uint8_t>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank, reduction, fused_log_softmax, grad);
+  }
+  throw std::runtime_error("RNNTLossVJP is only supported for integral targets.");
+}
+
+void RNNTLoss::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& logits         = inputs[0];
+  auto& targets        = inputs[1];
+  auto& logit_lengths  = inputs[2];
+  auto& target_lengths = inputs[3];
+  auto& loss           = outarr[0];
+  auto& log_alpha      = outarr[1];
+  auto& log_norm       = outarr[2];
+
+  if (logits.dtype() == float32) {
+    return rnnt_loss_impl_i<float>(logits, targets, logit_lengths, target_lengths, blank_, reduction_, fused_log_softmax_, loss, log_alpha, log_norm);
+  }
+  if (logits.dtype() == float16) {
+    return rnnt_loss_impl_i<float16_t>(logits, targets, logit_lengths, target_lengths, blank_, reduction_, fused_log_softmax_, loss, log_alpha, log_norm);
+  }
+  if (logits.dtype() == bfloat16) {
+    return rnnt_loss_impl_i<bfloat16_t>(logits, targets, logit_lengths, target_lengths, blank_, reduction_, fused_log_softmax_, loss, log_alpha, log_norm);
+  }
+  throw std::runtime_error("RNNTLoss is only supported for floating point types.");
+}
+
+void RNNTLossVJP::eval_cpu(const std::vector<array>& inputs, std::vector<array>& outarr) {
+  auto& logits         = inputs[0];
+  auto& targets        = inputs[1];
+  auto& logit_lengths  = inputs[2];
+  auto& target_lengths = inputs[3];
+  auto& log_alpha      = inputs[4];
+  auto& log_norm       = inputs[5];
+  auto& ctg            = inputs[6];
+  auto& grad           = outarr[0];
+
+  if (grad.dtype() == float32) {
+    return rnnt_loss_vjp_impl_i<float>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank_, reduction_, fused_log_softmax_, grad);
+  }
+  if (grad.dtype() == float16) {
+    return rnnt_loss_vjp_impl_i<float16_t>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank_, reduction_, fused_log_softmax_, grad);
+  }
+  if (grad.dtype() == bfloat16) {
+    return rnnt_loss_vjp_impl_i<bfloat16_t>(logits, targets, logit_lengths, target_lengths, log_alpha, log_norm, ctg, blank_, reduction_, fused_log_softmax_, grad);
+  }
+  throw std::runtime_error("RNNTLossVJP is only supported for floating point types.");
+}
+
+} // namespace mlx::core
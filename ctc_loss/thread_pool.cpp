@@ -0,0 +1,166 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#include <algorithm>
+#include <numeric>
+
+#include "ctc_loss/thread_pool.h"
+
+namespace mlx::core::ctc {
+
+// Set on pool workers, and on the calling thread while it runs items, so that nested calls run inline
+static thread_local bool in_pool = false;
+
+ThreadPool& ThreadPool::instance() {
+  static ThreadPool pool;
+  return pool;
+}
+
+ThreadPool::ThreadPool() {
+  resize(std::max<size_t>(1, std::thread::hardware_concurrency()));
+}
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+void ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_cv_.notify_all();
+  for (auto& w : workers_) w.join();
+  workers_.clear();
+  stopping_ = false;
+}
+
+void ThreadPool::resize(size_t num_threads) {
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  num_threads = std::max<size_t>(1, num_threads);
+  if (num_threads == size()) return;
+  stop();
+  for (size_t i = 1; i < num_threads; i++) {
+    workers_.emplace_back([this, seen = generation_] { worker_loop(seen); });
+  }
+}
+
+void SpinBarrier::wait() {
+  size_t generation = generation_.load(std::memory_order_acquire);
+  if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+    arrived_.store(0, std::memory_order_relaxed);
+    generation_.fetch_add(1, std::memory_order_release);
+    return;
+  }
+  for (size_t spins = 0; generation_.load(std::memory_order_acquire) == generation; spins++) {
+    if (spins >= 4096) std::this_thread::yield();
+  }
+}
+
+void ThreadPool::run_items() {
+  size_t n = order_->size();
+  for (size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < n;) {
+    try {
+      (*fn_)((*order_)[i]);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+      next_.store(n, std::memory_order_relaxed);
+    }
+    if (one_each_) break;
+  }
+}
+
+void ThreadPool::worker_loop(size_t seen) {
+  in_pool = true;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_cv_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_) return;
+      seen = generation_;
+    }
+    run_items();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--active_ == 0) done_cv_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::parallel_for(const std::vector<size_t>& order, const std::function<void(size_t)>& fn) {
+  // Nested calls run inline, as `run_mutex_` may be held by this very thread
+  if (in_pool || order.size() < 2) {
+    for (size_t i : order) fn(i);
+    return;
+  }
+  // Concurrent calls (e.g. from another stream) run inline instead of waiting for the pool
+  std::unique_lock<std::mutex> run_lock(run_mutex_, std::try_to_lock);
+  if (!run_lock.owns_lock() || workers_.empty()) {
+    for (size_t i : order) fn(i);
+    return;
+  }
+  dispatch(order, fn, false);
+}
+
+void ThreadPool::parallel_team(size_t team_size, const std::function<void(const Team&)>& fn) {
+  if (in_pool || team_size < 2) {
+    fn(Team { 0, 1, nullptr });
+    return;
+  }
+  std::unique_lock<std::mutex> run_lock(run_mutex_, std::try_to_lock);
+  if (!run_lock.owns_lock() || size() < 2) {
+    fn(Team { 0, 1, nullptr });
+    return;
+  }
+  team_size = std::min(team_size, size());
+
+  // Every thread claims at most one rank, so all ranks run at once
+  SpinBarrier barrier(team_size);
+  std::vector<size_t> ranks(team_size);
+  std::iota(ranks.begin(), ranks.end(), 0);
+  dispatch(ranks, [&](size_t rank) { fn(Team { rank, team_size, &barrier }); }, true);
+}
+
+// Runs `fn` on pool threads, with `run_mutex_` held by caller
+void ThreadPool::dispatch(const std::vector<size_t>& order, const std::function<void(size_t)>& fn, bool one_each) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    order_ = &order;
+    fn_ = &fn;
+    one_each_ = one_each;
+    error_ = nullptr;
+    next_.store(0, std::memory_order_relaxed);
+    active_ = workers_.size();
+    generation_++;
+  }
+  wake_cv_.notify_all();
+
+  in_pool = true;
+  run_items();
+  in_pool = false;
+
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return active_ == 0; });
+    order_ = nullptr;
+    fn_ = nullptr;
+    std::swap(error, error_);
+  }
+  if (error) std::rethrow_exception(error);
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& fn) {
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  parallel_for(order, fn);
+}
+
+std::vector<size_t> schedule_by_cost(const std::vector<size_t>& costs) {
+  std::vector<size_t> order(costs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+  return order;
+}
+
+} // namespace mlx::core::ctc
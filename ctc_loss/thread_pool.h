@@ -0,0 +1,112 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mlx::core::ctc {
+
+/**
+ *  Reusable barrier of fixed number of threads, spinning (then yielding) instead of sleeping,
+ *  as it separates steps of a few microseconds.
+ **/
+class SpinBarrier {
+public:
+  explicit SpinBarrier(size_t count) : count_(count) {}
+
+  void wait();
+
+private:
+  size_t count_;
+  std::atomic<size_t> arrived_ {0};
+  std::atomic<size_t> generation_ {0};
+};
+
+/**
+ *  Threads working on a single item in lockstep, as passed to `ThreadPool::parallel_team`.
+ *
+ *  Every rank computes its own slice of each step, and `sync` separates steps.
+ **/
+struct Team {
+  size_t rank;
+  size_t size;
+  SpinBarrier* barrier;
+
+  void sync() const {
+    if (size > 1) barrier->wait();
+  }
+
+  // Slice `[begin, end)` of `[0, n)` for this rank, with bounds in multiples of `align`
+  std::pair<size_t, size_t> slice(size_t n, size_t align = 1) const {
+    size_t units = (n + align - 1) / align;
+    return { std::min(n, units * rank / size * align), std::min(n, units * (rank + 1) / size * align) };
+  }
+};
+
+/**
+ *  Persistent worker pool used by the CPU kernels.
+ *
+ *  Work is split into independent items (usually batch entries), which are claimed by workers one by one,
+ *  so every item is always computed by exactly the same code as in serial loop. Single item can also be shared
+ *  by a team of threads, which split every step of its computation in slices.
+ **/
+class ThreadPool {
+public:
+  static ThreadPool& instance();
+
+  ~ThreadPool();
+
+  // Number of threads taking part in `parallel_for` (including the calling thread)
+  size_t size() const { return workers_.size() + 1; }
+  void resize(size_t num_threads);
+
+  // Runs `fn(order[i])` for every `i`, in order of claiming, blocking until all items are done
+  void parallel_for(const std::vector<size_t>& order, const std::function<void(size_t)>& fn);
+  void parallel_for(size_t n, const std::function<void(size_t)>& fn);
+
+  /**
+   *  Runs `fn` on `team_size` threads at once (at most `size()`), each with its own rank, blocking until all return.
+   *  Nested or concurrent calls run `fn` with a single rank. Ranks wait for each other in `Team::sync`,
+   *  so `fn` should not throw between barriers.
+   **/
+  void parallel_team(size_t team_size, const std::function<void(const Team&)>& fn);
+
+private:
+  ThreadPool();
+  void stop();
+  void worker_loop(size_t seen);
+  void run_items();
+  void dispatch(const std::vector<size_t>& order, const std::function<void(size_t)>& fn, bool one_each);
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_cv_;
+  std::condition_variable done_cv_;
+  size_t generation_ = 0;
+  size_t active_ = 0;
+  bool stopping_ = false;
+
+  const std::vector<size_t>* order_ = nullptr;
+  const std::function<void(size_t)>* fn_ = nullptr;
+  bool one_each_ = false; // Every thread claims at most one item
+  std::atomic<size_t> next_ {0};
+  std::exception_ptr error_;
+};
+
+/**
+ *  Returns batch indices sorted by descending cost (longest-processing-time-first),
+ *  which keeps the tail of dynamically claimed work short for ragged batches.
+ **/
+std::vector<size_t> schedule_by_cost(const std::vector<size_t>& costs);
+
+} // namespace mlx::core::ctc
@@ -9,6 +9,15 @@ def ctc_loss(
         target_lengths: mx.array,
         *,
         blank: int = 0,
+        reduction: str = 'none',
+        zero_infinity: bool = False,
+        batch_first: bool = False,
+        need_grad: bool | None = None,
+        checkpoint_interval: int = 0,
+        memory_budget: int = 0,
+        alpha_dtype: mx.Dtype | None = None,
+        max_deviation: int = 0,
+        linear_space: bool = False,
         stream: mx.Stream | mx.Device | None = None
     ) -> mx.array:
     """
@@ -22,9 +31,10 @@ def ctc_loss(
     Args:
         log_probs (array):
             The logarithmized probabilities of the outputs (e.g. obtained with `mlx::core::log_softmax`)
-            of size `(T, N, C)`, where
+            of size `(T, N, C)` (or `(N, T, C)` with `batch_first`), where
             `T = input length`, `N = batch size`, and
-            `C = number of classes` (including blank)
+            `C = number of classes` (including blank).
+            Any strides are accepted, so transposed views are consumed without copying.
         
         targets (array):
             Target sequences of size `(N, S)`, where
@@ -45,8 +55,480 @@ def ctc_loss(
         
         blank (int):
             blank label. Default `0`.
+        
+        reduction (str):
+            Reduction of per-sample losses: `'none'`, `'sum'`, or `'mean'`
+            (losses are divided by target lengths and then averaged over batch). Default `'none'`.
+        
+        zero_infinity (bool):
+            Zero infinite losses (impossible alignments) and their gradients. Default `False`.
+        
+        batch_first (bool):
+            `log_probs` (and its gradient) are `(N, T, C)`. Default `False`.
+        
+        need_grad (bool, optional):
+            Keep full alpha lattice for gradient computation.
+            With `False`, only two rolling rows of alpha are kept per sequence, and gradient is not available.
+            Default `None` keeps lattice only when called under function transformation (e.g. `value_and_grad`).
+        
+        checkpoint_interval (int):
+            Store alpha only every `checkpoint_interval` time steps, recomputing segments in backward pass (CPU only).
+            `0` stores every step (unless `memory_budget` is set), negative value picks `sqrt(T)`
+            for `O(sqrt(T))` memory. Default `0`.
+        
+        memory_budget (int):
+            Budget in bytes for stored alpha, used to derive checkpoint interval when `checkpoint_interval` is `0`.
+            Default `0` (no limit).
+        
+        alpha_dtype (Dtype, optional):
+            Storage type of alpha lattice: `float32` or type of `log_probs`.
+            Recurrences always accumulate in `float32`, loss and gradient are returned in type of `log_probs`.
+            Default `None` is `float32`.
+        
+        max_deviation (int):
+            Approximate loss of very long inputs: only alignments deviating at most `max_deviation` labels
+            from the uniform one are summed, so every frame costs `O(max_deviation)` instead of `O(S)`.
+            Loss is never below the exact one. Default `0` computes exact loss.
+    
+        linear_space (bool):
+            Run recurrences on probabilities rescaled every frame instead of log-probabilities (CPU only),
+            trading `logaddexp` of every cell for a few multiplications. Sequences whose lattice rows span
+            more than `float32` range fall back to log space. Default `False`.
     
     Returns:
-        array: `(N)`, where `N = batch size`
+        array: `(N)`, where `N = batch size`, or scalar when reduced
+    """
+    ...
+
+def ctc_loss_from_logits(
+        logits: mx.array,
+        targets: mx.array,
+        input_lengths: mx.array,
+        target_lengths: mx.array,
+        *,
+        blank: int = 0,
+        reduction: str = 'none',
+        zero_infinity: bool = False,
+        batch_first: bool = False,
+        need_grad: bool | None = None,
+        checkpoint_interval: int = 0,
+        memory_budget: int = 0,
+        alpha_dtype: mx.Dtype | None = None,
+        max_deviation: int = 0,
+        linear_space: bool = False,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> mx.array:
+    """
+    The Connectionist Temporal Classification loss of unnormalized outputs
+    
+    Same as `ctc_loss(log_softmax(logits, 2), ...)`, with log-softmax fused into the loss kernels:
+    frame normalizers are computed along with alpha recurrence, and gradient with respect to `logits`
+    is produced directly, so neither log-probabilities nor their gradient are materialized.
+    
+    Args:
+        logits (array):
+            Unnormalized outputs of size `(T, N, C)` (or `(N, T, C)` with `batch_first`), where
+            `T = input length`, `N = batch size`, and
+            `C = number of classes` (including blank).
+        
+        Other arguments are the same as for `ctc_loss`.
+    
+    Returns:
+        array: `(N)`, where `N = batch size`, or scalar when reduced
+    """
+    ...
+
+def ctc_greedy_decode(
+        log_probs: mx.array,
+        input_lengths: mx.array,
+        *,
+        blank: int = 0,
+        batch_first: bool = False,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> tuple[mx.array, mx.array]:
+    """
+    Greedy (best path) CTC decoding
+    
+    Takes the most probable class of every frame, then collapses repeated classes and removes blanks.
+    
+    Args:
+        log_probs (array):
+            The logarithmized probabilities (or logits) of the outputs of size `(T, N, C)`
+            (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+        
+        input_lengths (array):
+            Lengths of the inputs of size `(N)`, where `N = batch size` (must each be <= `T`).
+        
+        blank (int):
+            blank label. Default `0`.
+        
+        batch_first (bool):
+            `log_probs` are `(N, T, C)`. Default `False`.
+    
+    Returns:
+        tuple(array, array): `int32` labels of size `(N, T)` padded with `blank`,
+        and `int32` numbers of decoded labels of size `(N)`
+    """
+    ...
+
+def ctc_beam_search_decode(
+        log_probs: mx.array,
+        input_lengths: mx.array,
+        *,
+        blank: int = 0,
+        beam_width: int = 8,
+        top_k: int = 0,
+        num_best: int = 1,
+        batch_first: bool = False,
+        lm: NGramModel | None = None,
+        alphabet: list[str] = [],
+        word_delimiter: int = -1,
+        lm_weight: float = 0.5,
+        word_bonus: float = 0.0,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> tuple[mx.array, mx.array, mx.array]:
+    """
+    CTC prefix beam search decoding (CPU only)
+    
+    Keeps `beam_width` most probable label prefixes after every frame, merging alignments which collapse
+    to the same prefix. Batch items are decoded in parallel.
+    
+    Args:
+        log_probs (array):
+            The logarithmized probabilities of the outputs of size `(T, N, C)`
+            (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+        
+        input_lengths (array):
+            Lengths of the inputs of size `(N)`, where `N = batch size` (must each be <= `T`).
+        
+        blank (int):
+            blank label. Default `0`.
+        
+        beam_width (int):
+            Number of prefixes kept after every frame. Default `8`.
+        
+        top_k (int):
+            Only `top_k` most probable classes of every frame extend prefixes, `0` for all classes. Default `0`.
+        
+        num_best (int):
+            Number of returned hypotheses, at most `beam_width`. Default `1`.
+        
+        batch_first (bool):
+            `log_probs` are `(N, T, C)`. Default `False`.
+        
+        lm (NGramModel, optional):
+            Word n-gram model fused into prefix scores. Default `None`.
+        
+        alphabet (list[str]):
+            String of every class, used to form words for `lm`.
+        
+        word_delimiter (int):
+            Class completing words for `lm` (e.g. space).
+        
+        lm_weight (float):
+            Weight of LM log-probability of every completed word. Default `0.5`.
+        
+        word_bonus (float):
+            Score added for every completed word. Default `0`.
+    
+    Returns:
+        tuple(array, array, array): `int32` labels of size `(N, num_best, T)` padded with `blank`,
+        `int32` numbers of labels of size `(N, num_best)`, and `float32` log-probabilities
+        of size `(N, num_best)` including fused LM score, best first (`-inf` for missing hypotheses)
+    """
+    ...
+
+def ctc_forced_align(
+        log_probs: mx.array,
+        targets: mx.array,
+        input_lengths: mx.array,
+        target_lengths: mx.array,
+        *,
+        blank: int = 0,
+        batch_first: bool = False,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> tuple[mx.array, mx.array, mx.array]:
+    """
+    CTC forced alignment (CPU only)
+    
+    Finds the most probable alignment of every target (Viterbi path over the same lattice as `ctc_loss`).
+    
+    Args:
+        log_probs (array):
+            The logarithmized probabilities of the outputs of size `(T, N, C)`
+            (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+        
+        targets (array):
+            Target sequences of size `(N, S)`.
+        
+        input_lengths (array):
+            Lengths of the inputs of size `(N)` (must each be <= `T`).
+        
+        target_lengths (array):
+            Lengths of the targets of size `(N)` (must each be <= `S`).
+        
+        blank (int):
+            blank label. Default `0`.
+        
+        batch_first (bool):
+            `log_probs` are `(N, T, C)`. Default `False`.
+    
+    Returns:
+        tuple(array, array, array): `int32` class of every frame of size `(N, T)` (`blank` on blank
+        and padding frames), `int32` `[start, end)` frames of every target label of size `(N, S, 2)`
+        (`-1` on padding), and `float32` log-probabilities of best paths of size `(N)`
+        (`-inf` when alignment is impossible)
+    """
+    ...
+
+def ctc_posteriors(
+        log_probs: mx.array,
+        targets: mx.array,
+        input_lengths: mx.array,
+        target_lengths: mx.array,
+        *,
+        blank: int = 0,
+        top_k: int = 0,
+        batch_first: bool = False,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> mx.array | tuple[mx.array, mx.array]:
+    """
+    CTC state occupancy collapsed onto classes (CPU only)
+    
+    Posterior probability of every class on every frame over all alignments of the target
+    (the term subtracted from `softmax` in gradient of `ctc_loss`), computed without a backward pass.
+    Every valid frame sums to `1`, padding frames and impossible alignments are all zeros.
+    
+    Args:
+        log_probs (array):
+            The logarithmized probabilities of the outputs of size `(T, N, C)`
+            (or `(N, T, C)` with `batch_first`). Any strides are accepted.
+        
+        targets (array):
+            Target sequences of size `(N, S)`.
+        
+        input_lengths (array):
+            Lengths of the inputs of size `(N)` (must each be <= `T`).
+        
+        target_lengths (array):
+            Lengths of the targets of size `(N)` (must each be <= `S`).
+        
+        blank (int):
+            blank label. Default `0`.
+        
+        top_k (int):
+            Return only `top_k` most occupied classes of every frame, in descending order. Default `0` (dense).
+        
+        batch_first (bool):
+            `log_probs` (and outputs) are `(N, T, C)`. Default `False`.
+    
+    Returns:
+        array: `float32` posteriors of size `(T, N, C)` when `top_k` is `0`, or
+        tuple(array, array): `float32` posteriors and `int32` classes of size `(T, N, top_k)`
+        (padded with zero posteriors of blank)
+    """
+    ...
+
+def ctc_loss_chunk(
+        log_probs: mx.array,
+        targets: mx.array,
+        chunk_lengths: mx.array,
+        target_lengths: mx.array,
+        state: mx.array | None = None,
+        *,
+        blank: int = 0,
+        batch_first: bool = False,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> tuple[mx.array, mx.array]:
+    """
+    Chunk of streaming CTC forward pass (CPU only)
+    
+    Advances alpha rows of every sequence over a chunk of frames, so inputs of any length are consumed
+    with memory bounded by chunk size. Chaining chunks gives the same loss as `ctc_loss` of whole input.
+
+    Gradient flows back through states of chained chunks. It is the exact derivative with respect to
+    log-probabilities, which matches gradient of `ctc_loss` with respect to logits of `log_softmax`.
+    
+    Args:
+        log_probs (array):
+            The logarithmized probabilities of chunk frames of size `(Tc, N, C)`
+            (or `(N, Tc, C)` with `batch_first`). Any strides are accepted.
+        
+        targets (array):
+            Target sequences of size `(N, S)`, the same for every chunk.
+        
+        chunk_lengths (array):
+            Numbers of chunk frames belonging to every sequence of size `(N)` (must each be <= `Tc`),
+            e.g. `mx.clip(input_lengths - t0, 0, Tc)`. Sequences with `0` frames keep their state.
+        
+        target_lengths (array):
+            Lengths of the targets of size `(N)` (must each be <= `S`).
+        
+        state (array, optional):
+            `float32` alpha row of size `(N, 2S+2)` returned for previous chunk. Default `None` (start of input).
+        
+        blank (int):
+            blank label. Default `0`.
+        
+        batch_first (bool):
+            `log_probs` are `(N, Tc, C)`. Default `False`.
+    
+    Returns:
+        tuple(array, array): `float32` alpha row after the chunk of size `(N, 2S+2)`, and `float32`
+        negative log-likelihood of targets given frames consumed so far of size `(N)`
+    """
+    ...
+
+def rnnt_loss(
+        logits: mx.array,
+        targets: mx.array,
+        logit_lengths: mx.array,
+        target_lengths: mx.array,
+        *,
+        blank: int = 0,
+        reduction: str = "none",
+        fused_log_softmax: bool = True,
+        stream: mx.Stream | mx.Device | None = None
+    ) -> mx.array:
+    """
+    The RNN-Transducer loss (CPU only)
+    
+    Sums probability of all monotonic alignments of `T` frames to `U` target labels over `(T, U+1)` lattice,
+    where every node emits either blank (advancing frame) or next label (advancing target).
+    
+    With `fused_log_softmax`, log-softmax is computed on the fly and gradient is computed with respect to
+    `logits` directly, without materializing log-probabilities or their gradient. When `logits` buffer
+    is not used elsewhere, gradient is written over it.
+    
+    Args:
+        logits (array):
+            Joint network outputs of size `(N, T, U+1, C)`, where `N = batch size`, `T = max input length`,
+            `U = max target length` and `C = number of classes` (including blank): logits with
+            `fused_log_softmax`, log-probabilities otherwise. Any strides are accepted.
+        
+        targets (array):
+            Target sequences of size `(N, U)`, padded to the length of the longest sequence.
+        
+        logit_lengths (array):
+            Lengths of the inputs of size `(N)` (must each be in `[1, T]`).
+        
+        target_lengths (array):
+            Lengths of the targets of size `(N)` (must each be <= `U`).
+        
+        blank (int):
+            blank label. Default `0`.
+        
+        reduction (str):
+            Reduction of per-sample losses: `"none"`, `"sum"` or `"mean"` (divided by batch size only).
+            Default `"none"`.
+        
+        fused_log_softmax (bool):
+            `logits` are unnormalized, log-softmax is fused into loss and gradient. Default `True`.
+    
+    Returns:
+        array: loss of size `(N)`, or scalar when reduced
+    """
+    ...
+
+class NGramModel:
+    """
+    Word n-gram language model in binary format, memory-mapped from file
+    
+    Mapped pages are shared by processes opening the same file.
+    """
+
+    def __init__(self, path: str) -> None:
+        """Open binary model built by `NGramModel.build`."""
+        ...
+
+    @staticmethod
+    def build(arpa_path: str, output_path: str, quant_bits: int = 8) -> None:
+        """
+        Build binary model from ARPA file
+        
+        Args:
+            arpa_path (str):
+                Path of ARPA model.
+            
+            output_path (str):
+                Path of binary model.
+            
+            quant_bits (int):
+                Bits per quantized log-probability and backoff (1..16). Default `8`.
+        """
+        ...
+
+    @property
+    def order(self) -> int:
+        """Order of the model"""
+        ...
+
+    @property
+    def vocab_size(self) -> int:
+        """Number of words"""
+        ...
+
+    def score(self, context: list[str], word: str) -> float:
+        """
+        Log10-probability of `word` after `context` words (oldest first), with backoff
+        
+        Returns:
+            float: log10-probability
+        """
+        ...
+
+def set_num_threads(num_threads: int) -> None:
+    """
+    Set number of threads used by the CPU implementation
+    
+    Batch items are distributed across threads (or label positions of long targets, for batches smaller
+    than thread count), so results are identical for any thread count.
+    
+    Args:
+        num_threads (int):
+            Number of threads. `0` resets to the number of hardware threads (default).
+    """
+    ...
+
+def get_num_threads() -> int:
+    """
+    Number of threads used by the CPU implementation
+    
+    Returns:
+        int: number of threads
+    """
+    ...
+
+def set_stats_enabled(enabled: bool) -> None:
+    """
+    Enable or disable collection of CTC loss counters (disabled by default)
+    
+    Raises when instrumentation is not compiled in (`MLX_CTC_STATS` CMake option).
+    
+    Args:
+        enabled (bool):
+            Collect counters of `ctc_loss` forward and backward evaluations.
+    """
+    ...
+
+def get_stats() -> dict[str, int]:
+    """
+    CTC loss counters collected since last reset
+    
+    Phase times are in nanoseconds, measured by the CPU implementation and summed over worker threads:
+    `alloc` of outputs, `alpha` recurrence (with recomputation between checkpoints), `final` loss reduction,
+    `beta` sweep (beta recurrence with occupancy and gradient rows, which alternate every frame) and `vjp_final`
+    (gradient of padding frames).
+    GPU evaluations count calls and allocated bytes only. Cells are positions of `(T, N, 2S+1)` lattice
+    within (valid) or outside (padded) sequence lengths.
+    
+    Returns:
+        dict: counters by name
+    """
+    ...
+
+def reset_stats() -> None:
+    """
+    Reset all CTC loss counters to zero
     """
     ...
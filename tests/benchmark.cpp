@@ -0,0 +1,209 @@
+// Copyright © 2024 Yury Popov (@djphoenix).
+
+// Native benchmark of CTC loss forward and backward passes, without Python, autograd or log-softmax in the loop.
+//
+// Usage: ctc_benchmark [--device cpu|gpu] [--threads N] [--repeat N] [--json PATH] [--linear]
+//
+// Runs on a single CPU thread by default (`--threads 0` uses all cores), timing median of `--repeat` runs.
+// Forward is `ctc_loss` alone (with lattice kept for gradient), backward is the loss VJP on evaluated outputs,
+// so both are timed separately. `--json -` writes results to stdout instead of the table.
+// `--linear` runs CPU recurrences in scaled linear space (`linear_space=true`).
+// Peak memory is the maximum of MLX allocations while a shape runs (inputs included), reset before every shape;
+// the Metal allocator serves both devices, so it is reported as `0` by builds without Metal.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mlx/backend/metal/metal.h"
+#include "mlx/mlx.h"
+
+#include "ctc_loss/ctc_loss.h"
+
+using namespace mlx::core;
+
+struct BenchShape {
+  int T, N, C, S, S_min;
+};
+
+struct BenchResult {
+  BenchShape shape;
+  double fwd_seconds;
+  double bwd_seconds;
+  size_t input_bytes;
+  size_t fwd_bytes;
+  size_t bwd_bytes;
+  size_t peak_memory;
+};
+
+// Shapes of `benchmark.py`, followed by long-form inputs
+static const std::vector<BenchShape> bench_shapes = {
+  {   64, 128,   32,   16,    8 },
+  {  128, 128,   32,   32,   16 },
+  {  256, 128,   32,   64,   32 },
+  {  512, 128,   32,  128,   64 },
+  { 1024, 128,   32,  256,  128 },
+
+  {  128,  32,   32,   32,   16 },
+  {  128,  64,   32,   32,   16 },
+  {  128, 256,   32,   32,   16 },
+  {  128, 512,   32,   32,   16 },
+
+  {  128, 128,    8,   32,   16 },
+  {  128, 128,   16,   32,   16 },
+  {  128, 128,   48,   32,   16 },
+  {  128, 128,   64,   32,   16 },
+
+  {  256, 128,   32,   16,    8 },
+  {  256, 128,   32,   24,   12 },
+  {  256, 128,   32,   32,   16 },
+  {  256, 128,   32,   48,   24 },
+
+  { 4096,   4, 5000,  256,  128 },
+  { 4096,  16,   32, 1024,  512 },
+};
+
+static double median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return (v.size() % 2) ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+}
+
+static BenchResult run_bench(const BenchShape& sh, Device device, int repeat, bool linear) {
+  using clock = std::chrono::steady_clock;
+
+  auto logits         = random::normal({ sh.T, sh.N, sh.C });
+  auto log_probs      = subtract(logits, logsumexp(logits, 2, true));
+  auto targets        = random::randint(1, sh.C, { sh.N, sh.S }, int32);
+  auto input_lengths  = random::randint(sh.T / 2, sh.T, { sh.N }, int32);
+  auto target_lengths = random::randint(sh.S_min, sh.S, { sh.N }, int32);
+  auto ctg            = array(1.0f);
+  eval({ log_probs, targets, input_lengths, target_lengths, ctg });
+  metal::reset_peak_memory();
+
+  std::vector<double> fwd, bwd;
+  size_t fwd_bytes = 0, bwd_bytes = 0;
+
+  // First iteration is warm-up (kernel compilation, thread pool start, allocator caches)
+  for (int i = 0; i <= repeat; i++) {
+    auto t0 = clock::now();
+    auto loss = ctc_loss(
+      log_probs, targets, input_lengths, target_lengths,
+      0, "mean", false, false, true, 0, 0, std::nullopt, 0, linear, device
+    );
+    eval(loss);
+    auto t1 = clock::now();
+    auto outputs = loss.outputs();
+    auto grad = loss.primitive().vjp(loss.inputs(), { ctg }, { 0 }, outputs)[0];
+    eval(grad);
+    auto t2 = clock::now();
+
+    if (i == 0) {
+      for (auto& out : outputs) fwd_bytes += out.nbytes();
+      bwd_bytes = grad.nbytes();
+      continue;
+    }
+    fwd.push_back(std::chrono::duration<double>(t1 - t0).count());
+    bwd.push_back(std::chrono::duration<double>(t2 - t1).count());
+  }
+
+  return { sh, median(fwd), median(bwd), log_probs.nbytes(), fwd_bytes, bwd_bytes, metal::get_peak_memory() };
+}
+
+static void print_header() {
+  std::printf("| %-26s | %-31s | %-31s | %-10s |\n", "Shape (TxNxCxS)", "Forward", "Backward", "Peak mem");
+  std::printf("| %-26s | %9s %10s %10s | %9s %10s %10s | %10s |\n", "", "ms", "frames/s", "MB/s", "ms", "frames/s", "MB/s", "MB");
+}
+
+static void print_row(const BenchResult& r) {
+  const double mb = 1024 * 1024;
+  double frames = double(r.shape.T) * r.shape.N;
+  char head[32];
+  std::snprintf(head, sizeof(head), "%4d x %3d x %4d x %4d", r.shape.T, r.shape.N, r.shape.C, r.shape.S);
+  std::printf(
+    "| %-26s | %9.3f %10.3g %10.2f | %9.3f %10.3g %10.2f | %10.1f |\n",
+    head,
+    r.fwd_seconds * 1e3, frames / r.fwd_seconds, r.input_bytes / mb / r.fwd_seconds,
+    r.bwd_seconds * 1e3, frames / r.bwd_seconds, r.input_bytes / mb / r.bwd_seconds,
+    r.peak_memory / mb
+  );
+  std::fflush(stdout);
+}
+
+static void write_json(FILE* f, const std::vector<BenchResult>& results, const char* device, int threads, int repeat) {
+  const double mb = 1024 * 1024;
+  std::fprintf(f, "{\n  \"device\": \"%s\",\n  \"threads\": %d,\n  \"repeat\": %d,\n  \"results\": [\n", device, threads, repeat);
+  for (size_t i = 0; i < results.size(); i++) {
+    auto& r = results[i];
+    double frames = double(r.shape.T) * r.shape.N;
+    std::fprintf(
+      f,
+      "    {\"T\": %d, \"N\": %d, \"C\": %d, \"S\": %d, \"S_min\": %d, "
+      "\"fwd_s\": %.9g, \"fwd_frames_per_s\": %.9g, \"fwd_mb_per_s\": %.9g, "
+      "\"bwd_s\": %.9g, \"bwd_frames_per_s\": %.9g, \"bwd_mb_per_s\": %.9g, "
+      "\"fwd_output_mb\": %.6g, \"bwd_output_mb\": %.6g, \"peak_memory_mb\": %.6g}%s\n",
+      r.shape.T, r.shape.N, r.shape.C, r.shape.S, r.shape.S_min,
+      r.fwd_seconds, frames / r.fwd_seconds, r.input_bytes / mb / r.fwd_seconds,
+      r.bwd_seconds, frames / r.bwd_seconds, r.input_bytes / mb / r.bwd_seconds,
+      r.fwd_bytes / mb, r.bwd_bytes / mb, r.peak_memory / mb,
+      (i + 1 < results.size()) ? "," : ""
+    );
+  }
+  std::fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+  std::string device_name = "cpu";
+  std::string json_path;
+  int threads = 1;
+  int repeat = 10;
+  bool linear = false;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--device") && has_value) {
+      device_name = argv[++i];
+    } else if (!std::strcmp(argv[i], "--threads") && has_value) {
+      threads = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--repeat") && has_value) {
+      repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (!std::strcmp(argv[i], "--json") && has_value) {
+      json_path = argv[++i];
+    } else if (!std::strcmp(argv[i], "--linear")) {
+      linear = true;
+    } else {
+      std::fprintf(stderr, "Usage: %s [--device cpu|gpu] [--threads N] [--repeat N] [--json PATH] [--linear]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (device_name != "cpu" && device_name != "gpu") {
+    std::fprintf(stderr, "Unknown device: %s\n", device_name.c_str());
+    return 1;
+  }
+
+  ctc_set_num_threads(threads);
+  random::seed(42);
+  Device device = (device_name == "gpu") ? Device::gpu : Device::cpu;
+  set_default_device(device);
+
+  bool table = json_path != "-";
+  if (table) print_header();
+  std::vector<BenchResult> results;
+  for (auto& sh : bench_shapes) {
+    results.push_back(run_bench(sh, device, repeat, linear));
+    if (table) print_row(results.back());
+  }
+
+  if (json_path.empty()) return 0;
+  FILE* f = (json_path == "-") ? stdout : std::fopen(json_path.c_str(), "w");
+  if (!f) {
+    std::fprintf(stderr, "Cannot open %s\n", json_path.c_str());
+    return 1;
+  }
+  write_json(f, results, device_name.c_str(), ctc_get_num_threads(), repeat);
+  if (f != stdout) std::fclose(f);
+  return 0;
+}
@@ -8,8 +8,9 @@ import mlx.nn as mn
 import mlx_ctc
 from timeit import timeit
 
-# MLX does not have multithreading support, so limit torch to single thread
+# Limit both torch and MLX CTC CPU implementation to single thread for fair comparison
 torch.set_num_threads(1)
+mlx_ctc.set_num_threads(1)
 
 def gen_input(T: int, B: int, C: int, S: int, S_min: int):
   logits = torch.randn(T, B, C).requires_grad_()
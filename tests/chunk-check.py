@@ -0,0 +1,54 @@
+# Copyright © 2024 Yury Popov (@djphoenix).
+
+# Check chained MLX CTC Loss chunks and their gradient against loss of whole input
+
+import mlx.core as mx
+import mlx.nn as mn
+import numpy as np
+import mlx_ctc
+
+# 1. Generate input
+#    (chunks of uneven sizes, and a short sequence which has no frames in the last chunks)
+
+T, B, C, S = 128, 32, 24, 24
+chunk_sizes = [17, 1, 40, 30, 40]
+
+logits = mx.random.normal((T, B, C))
+targets = mx.random.randint(1, C, (B, S), dtype=mx.int32)
+input_lengths = np.random.randint(T//2, T + 1, (B,)).astype(np.int32)
+target_lengths = np.random.randint(S//4, S//2 + 1, (B,)).astype(np.int32)
+input_lengths[0], input_lengths[1], target_lengths[1] = T, 20, 4
+
+mx_input_lengths = mx.array(input_lengths)
+mx_target_lengths = mx.array(target_lengths)
+
+chunk_starts = np.cumsum([0] + chunk_sizes[:-1])
+print('Logits shape (time X batch X channels):', 'x'.join(map(str, logits.shape)))
+print('Chunk sizes:', ', '.join(map(str, chunk_sizes)))
+print('Sequences with zero-length chunks', sum(int((input_lengths <= t0).sum()) for t0 in chunk_starts))
+
+# 2. Loss of whole input, and of the same frames fed chunk by chunk
+#    (gradient is taken with respect to logits, where both conventions of log-probability gradient agree)
+
+def whole_loss(logits, targets, input_lengths, target_lengths):
+  loss = mlx_ctc.ctc_loss(mn.log_softmax(logits, -1), targets, input_lengths, target_lengths)
+  return loss.sum(), loss
+
+def chunked_loss(logits, targets, input_lengths, target_lengths):
+  log_probs = mn.log_softmax(logits, -1)
+  state = None
+  for t0, size in zip(chunk_starts, chunk_sizes):
+    chunk_lengths = mx.clip(input_lengths - int(t0), 0, size)
+    state, loss = mlx_ctc.ctc_loss_chunk(log_probs[int(t0):int(t0) + size], targets, chunk_lengths, target_lengths, state)
+  return loss.sum(), loss
+
+# 3. Verify loss and gradient
+
+with mx.stream(mx.cpu):
+  (_, ref_loss), ref_grad = mx.value_and_grad(whole_loss)(logits, targets, mx_input_lengths, mx_target_lengths)
+  (_, mlx_loss), mlx_grad = mx.value_and_grad(chunked_loss)(logits, targets, mx_input_lengths, mx_target_lengths)
+  mx.eval(ref_loss, ref_grad, mlx_loss, mlx_grad)
+
+print('Chunked loss diff', (mx.abs(mlx_loss - ref_loss).max() / mx.abs(ref_loss).max()).item())
+print('Chunked grad diff', (mx.abs(mlx_grad - ref_grad).max() / mx.abs(ref_grad).max()).item())
+print('Short sequence loss diff', abs(mlx_loss[1].item() - ref_loss[1].item()) / abs(ref_loss[1].item()))
@@ -0,0 +1,103 @@
+# Copyright © 2024 Yury Popov (@djphoenix).
+
+# Check MLX CTC decoders against simple reference computations
+
+import os
+import tempfile
+import mlx.core as mx
+import mlx.nn as mn
+import numpy as np
+import mlx_ctc
+
+# 1. Generate input
+#    (every frame is peaked on a random class, so that merging of alignments can not outweigh the best path)
+
+T, B, C = 128, 64, 16
+
+frame_classes = np.random.randint(0, C, (T, B))
+logits = np.random.randn(T, B, C).astype(np.float32)
+np.put_along_axis(logits, frame_classes[..., None], 20, axis=-1)
+input_lengths = np.random.randint(T//2, T + 1, (B,)).astype(np.int32)
+
+mx_log_probs = mn.log_softmax(mx.array(logits), -1)
+mx_input_lengths = mx.array(input_lengths)
+
+print('Log-probs shape (time X batch X channels):', 'x'.join(map(str, mx_log_probs.shape)))
+
+# 2. Beam search of width 1 keeps the best path, same as greedy decoding
+
+with mx.stream(mx.cpu):
+  greedy_labels, greedy_lengths = mlx_ctc.ctc_greedy_decode(mx_log_probs, mx_input_lengths)
+  beam_labels, beam_lengths, _ = mlx_ctc.ctc_beam_search_decode(mx_log_probs, mx_input_lengths, beam_width=1)
+  mx.eval(greedy_labels, greedy_lengths, beam_labels, beam_lengths)
+
+beam_mismatch = sum(
+  greedy_lengths[b].item() != beam_lengths[b, 0].item() or
+  not mx.array_equal(greedy_labels[b], beam_labels[b, 0]).item()
+  for b in range(B)
+)
+print('Beam width 1 mismatches with greedy', beam_mismatch)
+
+# 3. Score words with a tiny ARPA model against hand-computed backoff
+#    (16-bit quantization keeps every distinct value in its own bin)
+
+TINY_ARPA = '''
+\\data\\
+ngram 1=5
+ngram 2=3
+ngram 3=1
+
+\\1-grams:
+-1.0\t<s>\t-0.5
+-0.7\t</s>
+-0.6\ta\t-0.3
+-0.9\tb\t-0.2
+-1.2\tc
+
+\\2-grams:
+-0.4\t<s> a\t-0.1
+-0.3\ta b\t-0.25
+-0.5\tb c
+
+\\3-grams:
+-0.2\t<s> a b
+
+\\end\\
+'''
+
+lm_expected = [
+  ([], 'a', -0.6),                # unigram
+  (['a'], 'b', -0.3),             # bigram
+  (['<s>', 'a'], 'b', -0.2),      # trigram
+  (['b'], 'a', -0.2 - 0.6),       # backoff(b) + P(a)
+  (['<s>', 'a'], 'c', -0.1 - 0.3 - 1.2),  # backoff(<s> a) + backoff(a) + P(c)
+  (['a', 'b'], 'c', -0.25 - 0.5), # backoff(a b) + P(c | b)
+  (['a'], 'd', -100),             # unknown word
+]
+
+with tempfile.TemporaryDirectory() as tmp:
+  with open(os.path.join(tmp, 'tiny.arpa'), 'w') as f:
+    f.write(TINY_ARPA)
+  mlx_ctc.NGramModel.build(os.path.join(tmp, 'tiny.arpa'), os.path.join(tmp, 'tiny.bin'), quant_bits=16)
+  lm = mlx_ctc.NGramModel(os.path.join(tmp, 'tiny.bin'))
+  print('LM order', lm.order, 'vocabulary', lm.vocab_size)
+  print('LM score diff', max(abs(lm.score(ctx, word) - expected) for ctx, word, expected in lm_expected))
+  del lm
+
+# 4. Score of forced alignment equals probability of its single path, i.e. CTC loss over log-probs
+#    where every frame allows only the aligned class
+
+S = 24
+align_log_probs = mn.log_softmax(mx.random.normal((T, B, C)), -1)
+targets = mx.random.randint(1, C, (B, S), dtype=mx.int32)
+target_lengths = mx.random.randint(S//2, S + 1, (B,), dtype=mx.int32)
+
+with mx.stream(mx.cpu):
+  frame_labels, _, align_scores = mlx_ctc.ctc_forced_align(align_log_probs, targets, mx_input_lengths, target_lengths)
+  path_mask = mx.arange(C) == frame_labels.T[..., None]
+  path_loss = mlx_ctc.ctc_loss(mx.where(path_mask, align_log_probs, -float('inf')), targets, mx_input_lengths, target_lengths)
+  full_loss = mlx_ctc.ctc_loss(align_log_probs, targets, mx_input_lengths, target_lengths)
+  mx.eval(align_scores, path_loss, full_loss)
+
+print('Forced align score diff', mx.abs(align_scores + path_loss).max().item())
+print('Forced align score above total', mx.sum(align_scores > -full_loss + 1e-4).item())
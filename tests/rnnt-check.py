@@ -0,0 +1,50 @@
+# Copyright © 2024 Yury Popov (@djphoenix).
+
+# Check MLX RNN-T Loss and gradient output against torchaudio
+
+import torch
+import torchaudio
+import mlx.core as mx
+import numpy as np
+import mlx_ctc
+
+# 1. Generate input
+#    (a batch of short sequences, and a single long one, whose anti-diagonals are split between threads)
+
+def check(name, B, T, U, C):
+  logits = torch.randn(B, T, U + 1, C)
+  targets = torch.randint(1, C, (B, U), dtype=torch.int32)
+  logit_lengths = torch.randint(T//2, T + 1, (B,), dtype=torch.int32)
+  target_lengths = torch.randint(U//2, U + 1, (B,), dtype=torch.int32)
+  logit_lengths[0], target_lengths[0] = T, U
+
+  print(name, 'logits shape (batch X time X target X channels):', 'x'.join(map(str, logits.shape)))
+
+  mx_targets = mx.array(targets)
+  mx_logit_lengths = mx.array(logit_lengths)
+  mx_target_lengths = mx.array(target_lengths)
+
+  for fused in (True, False):
+    # 2. Generate reference output (log-probabilities are passed without fused log-softmax)
+
+    inputs = (logits if fused else logits.log_softmax(dim = -1)).requires_grad_()
+    ref_loss = torchaudio.functional.rnnt_loss(
+      inputs, targets, logit_lengths, target_lengths,
+      blank=0, reduction='none', fused_log_softmax=fused,
+    )
+    ref_grad, = torch.autograd.grad(ref_loss.sum(), inputs)
+
+    # 3. Generate and verify MLX output
+
+    mx_rnnt_grad = mx.value_and_grad(lambda x,t,i,l: (
+      (loss := mlx_ctc.rnnt_loss(x,t,i,l,fused_log_softmax=fused)).sum(), loss
+    ))
+
+    with mx.stream(mx.cpu):
+      (_, mlx_loss), mlx_grad = mx_rnnt_grad(mx.array(inputs.detach()), mx_targets, mx_logit_lengths, mx_target_lengths)
+      mx.eval(mlx_loss, mlx_grad)
+      print(name, 'fused' if fused else 'log-probs', 'Loss diff', torch.sub(ref_loss.detach(), torch.tensor(np.array(mlx_loss))).abs().div(ref_loss.abs().max()).max().item())
+      print(name, 'fused' if fused else 'log-probs', 'Grad diff', torch.sub(ref_grad, torch.tensor(np.array(mlx_grad))).abs().div(ref_grad.abs().max()).max().item())
+
+check('Batch', 16, 64, 24, 32)
+check('Single', 1, 800, 600, 8)
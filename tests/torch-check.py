@@ -34,19 +34,226 @@ ref_ctc = torch.nn.functional.ctc_loss(
   blank=0, reduction='none',
 )
 ref_grad, = torch.autograd.grad(ref_ctc.div(target_lengths).mean(), logits, retain_graph = True)
+ref_mean = ref_ctc.div(target_lengths).mean().item()
 
 # 3. Generate and verify MLX output
 
 mx_ctc_loss_grad = mx.value_and_grad(lambda p,t,i,l: (((x := mlx_ctc.ctc_loss(mn.log_softmax(p, -1),t,i,l))/l).mean(), x))
+mx_ctc_mean_grad = mx.value_and_grad(lambda p,t,i,l: mlx_ctc.ctc_loss(mn.log_softmax(p, -1),t,i,l,reduction='mean'))
 
 with mx.stream(mx.cpu):
   (_, mlx_ctc_loss), mlx_ctc_grad = mx_ctc_loss_grad(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
   mx.eval(mlx_ctc_loss, mlx_ctc_grad)
   print('CPU Loss diff', torch.sub(ref_ctc .detach(), torch.tensor(np.array(mlx_ctc_loss))).abs().div(ref_ctc .abs().max()).max().item())
   print('CPU Grad diff', torch.sub(ref_grad.detach(), torch.tensor(np.array(mlx_ctc_grad))).abs().div(ref_grad.abs().max()).max().item())
+  mlx_ctc_mean, mlx_ctc_grad = mx_ctc_mean_grad(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
+  mx.eval(mlx_ctc_mean, mlx_ctc_grad)
+  print('CPU Mean diff', abs(ref_mean - mlx_ctc_mean.item()) / abs(ref_mean))
+  print('CPU Mean grad diff', torch.sub(ref_grad.detach(), torch.tensor(np.array(mlx_ctc_grad))).abs().div(ref_grad.abs().max()).max().item())
 
 with mx.stream(mx.gpu):
   (_, mlx_ctc_loss), mlx_ctc_grad = mx_ctc_loss_grad(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
   mx.eval(mlx_ctc_loss, mlx_ctc_grad)
   print('GPU Loss diff', torch.sub(ref_ctc .detach(), torch.tensor(np.array(mlx_ctc_loss))).abs().div(ref_ctc .abs().max()).max().item())
   print('GPU Grad diff', torch.sub(ref_grad.detach(), torch.tensor(np.array(mlx_ctc_grad))).abs().div(ref_grad.abs().max()).max().item())
+  mlx_ctc_mean, mlx_ctc_grad = mx_ctc_mean_grad(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
+  mx.eval(mlx_ctc_mean, mlx_ctc_grad)
+  print('GPU Mean diff', abs(ref_mean - mlx_ctc_mean.item()) / abs(ref_mean))
+  print('GPU Mean grad diff', torch.sub(ref_grad.detach(), torch.tensor(np.array(mlx_ctc_grad))).abs().div(ref_grad.abs().max()).max().item())
+
+# 4. Verify gradient on a forced frame of low probability
+#    (target as long as input leaves a single alignment, so posterior of the label is 1 at every frame)
+
+F = 16
+forced = torch.randn(F, 1, C).log_softmax(dim = -1)
+forced_targets = torch.arange(1, F + 1, dtype=torch.int32)[None]
+forced_lengths = torch.tensor([F], dtype=torch.int32)
+forced[F // 2, 0, forced_targets[0, F // 2]] = -100
+forced.requires_grad_()
+
+ref_forced, = torch.autograd.grad(torch.nn.functional.ctc_loss(
+  forced, forced_targets, forced_lengths, forced_lengths, blank=0, reduction='sum',
+), forced)
+
+mx_forced_grad = mx.grad(lambda p,t,l: mlx_ctc.ctc_loss(p,t,l,l,reduction='sum'))
+
+for device in (mx.cpu, mx.gpu):
+  with mx.stream(device):
+    mlx_forced = mx_forced_grad(mx.array(forced.detach()), mx.array(forced_targets), mx.array(forced_lengths))
+    mx.eval(mlx_forced)
+    print(device, 'Forced frame grad diff', torch.sub(ref_forced, torch.tensor(np.array(mlx_forced))).abs().max().item())
+
+# 5. Verify a single long sequence, whose lattice rows are split between threads of a team
+#    (rows wider than 2 team slices of 1024 positions)
+
+W_T, W_S = 3000, 1200
+wide = torch.randn(W_T, 1, C).log_softmax(dim = -1).requires_grad_()
+wide_targets = torch.randint(1, C, (1, W_S), dtype=torch.int32)
+wide_input_lengths = torch.tensor([W_T], dtype=torch.int32)
+wide_target_lengths = torch.tensor([W_S], dtype=torch.int32)
+
+ref_wide = torch.nn.functional.ctc_loss(
+  wide, wide_targets, wide_input_lengths, wide_target_lengths, blank=0, reduction='sum',
+)
+ref_wide_grad, = torch.autograd.grad(ref_wide, wide)
+
+mx_wide_grad = mx.value_and_grad(lambda p,t,i,l: mlx_ctc.ctc_loss(p,t,i,l,reduction='sum'))
+
+with mx.stream(mx.cpu):
+  mlx_wide, mlx_wide_grad = mx_wide_grad(mx.array(wide.detach()), mx.array(wide_targets), mx.array(wide_input_lengths), mx.array(wide_target_lengths))
+  mx.eval(mlx_wide, mlx_wide_grad)
+  print('CPU Wide loss diff', abs(ref_wide.item() - mlx_wide.item()) / abs(ref_wide.item()))
+  print('CPU Wide grad diff', torch.sub(ref_wide_grad, torch.tensor(np.array(mlx_wide_grad))).abs().max().item())
+
+# 6. Verify loss with fused log-softmax against loss of normalized logits
+
+mx_unfused_grad = mx.value_and_grad(lambda p,t,i,l: ((x := mlx_ctc.ctc_loss(mn.log_softmax(p, -1),t,i,l)).sum(), x))
+mx_fused_grad = mx.value_and_grad(lambda p,t,i,l: ((x := mlx_ctc.ctc_loss_from_logits(p,t,i,l)).sum(), x))
+
+for device in (mx.cpu, mx.gpu):
+  with mx.stream(device):
+    (_, unfused_loss), unfused_grad = mx_unfused_grad(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
+    (_, fused_loss), fused_grad = mx_fused_grad(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
+    mx.eval(unfused_loss, unfused_grad, fused_loss, fused_grad)
+    print(device, 'From logits loss diff', (mx.abs(fused_loss - unfused_loss).max() / mx.abs(unfused_loss).max()).item())
+    print(device, 'From logits grad diff', (mx.abs(fused_grad - unfused_grad).max() / mx.abs(unfused_grad).max()).item())
+
+# 7. Verify posteriors: every valid frame sums to 1, and matches `softmax - grad` of summed loss by logits
+#    (padding frames are all zeros)
+
+ref_sum_grad, = torch.autograd.grad(ref_ctc.sum(), logits, retain_graph = True)
+valid_frames = (torch.arange(T)[:, None] < input_lengths[None, :].long())[..., None]
+ref_post = torch.where(valid_frames, logits.detach().softmax(dim = -1) - ref_sum_grad, 0)
+
+with mx.stream(mx.cpu):
+  mlx_post = mlx_ctc.ctc_posteriors(mn.log_softmax(mx_logits, -1), mx_targets, mx_input_lengths, mx_target_lengths)
+  mx.eval(mlx_post)
+  mlx_post = torch.tensor(np.array(mlx_post))
+  print('CPU Posteriors frame sum diff', torch.sub(mlx_post.sum(dim = -1), valid_frames[..., 0].float()).abs().max().item())
+  print('CPU Posteriors diff', torch.sub(ref_post, mlx_post).abs().max().item())
+
+# 8. Verify banded lattice: exact band (`max_deviation=0`) against pytorch with targets close to `T/2`,
+#    where the band is narrowest, and approximate bands of growing `max_deviation` (never below exact loss,
+#    converging to it once the band covers all positions), on CPU and GPU
+
+D_T, D_S = 128, 60
+dev_logits = torch.randn(D_T, B, C).requires_grad_()
+dev_targets = torch.randint(1, C, (B, D_S), dtype=torch.int32)
+dev_input_lengths = torch.randint(D_T - 8, D_T + 1, (B,), dtype=torch.int32)
+dev_target_lengths = torch.randint(D_S - 8, D_S + 1, (B,), dtype=torch.int32)
+
+ref_dev = torch.nn.functional.ctc_loss(
+  dev_logits.log_softmax(dim = -1), dev_targets, dev_input_lengths, dev_target_lengths,
+  blank=0, reduction='none', zero_infinity=True,
+)
+ref_dev_grad, = torch.autograd.grad(ref_dev.sum(), dev_logits)
+feasible = ref_dev.detach() > 0
+
+mx_dev_args = (mx.array(dev_logits.detach()), mx.array(dev_targets), mx.array(dev_input_lengths), mx.array(dev_target_lengths))
+mx_dev_grad = lambda D: mx.value_and_grad(lambda p,t,i,l: (
+  (x := mlx_ctc.ctc_loss(mn.log_softmax(p, -1),t,i,l,zero_infinity=True,max_deviation=D)).sum(), x
+))
+
+dev_losses = {}
+for device in (mx.cpu, mx.gpu):
+  with mx.stream(device):
+    for D in (0, 1, 2, 4, 8, 16, 2 * D_S):
+      (_, mlx_dev), mlx_dev_grad = mx_dev_grad(D)(*mx_dev_args)
+      mx.eval(mlx_dev, mlx_dev_grad)
+      dev_losses[device, D] = torch.tensor(np.array(mlx_dev)), torch.tensor(np.array(mlx_dev_grad))
+
+print('Feasible banded sequences', feasible.sum().item(), 'of', B)
+for device in (mx.cpu, mx.gpu):
+  exact_loss, exact_grad = dev_losses[device, 0]
+  print(device, 'Exact band loss diff', torch.sub(ref_dev.detach(), exact_loss).abs().div(ref_dev.abs().max()).max().item())
+  print(device, 'Exact band grad diff', torch.sub(ref_dev_grad, exact_grad).abs().div(ref_dev_grad.abs().max()).max().item())
+  prev_loss = None
+  for D in (1, 2, 4, 8, 16, 2 * D_S):
+    # Impossible sequences are zeroed, narrower bands may also drop all alignments of a feasible one
+    dev_loss = torch.where(feasible & (dev_losses[device, D][0] == 0), float('inf'), dev_losses[device, D][0])
+    print(device, 'Deviation', D,
+      'below exact', torch.sum(dev_loss < exact_loss - 1e-3 * exact_loss.abs()).item(),
+      'above narrower band', 0 if prev_loss is None else torch.sum(dev_loss > prev_loss + 1e-3 * prev_loss.abs()).item(),
+      'mean excess', torch.sub(dev_loss, exact_loss)[feasible & dev_loss.isfinite()].mean().item())
+    prev_loss = dev_loss
+  print(device, 'Full band loss diff', torch.sub(dev_losses[device, 2 * D_S][0], exact_loss).abs().div(exact_loss.abs().max()).max().item())
+
+for D in (0, 1, 2, 4, 8, 16, 2 * D_S):
+  cpu_loss, cpu_grad = dev_losses[mx.cpu, D]
+  gpu_loss, gpu_grad = dev_losses[mx.gpu, D]
+  print('Deviation', D, 'CPU/GPU loss diff', torch.sub(cpu_loss, gpu_loss).abs().div(cpu_loss.abs().max()).max().item(),
+    'grad diff', torch.sub(cpu_grad, gpu_grad).abs().div(cpu_grad.abs().max().clamp(min = 1e-30)).max().item())
+
+# 9. Verify linear-space recurrences against pytorch and log space (CPU only): plain, with checkpoints
+#    (rows stored and reloaded with their exponents), with frames shifted far below zero (rescaled every frame),
+#    and with an emission more than 87 below maximum of its frame (sequence falls back to log space)
+
+mx_lin_grad = lambda **kw: mx.value_and_grad(lambda p,t,i,l,shift: (
+  (x := mlx_ctc.ctc_loss(mn.log_softmax(p, -1) - shift,t,i,l,**kw)).sum(), x
+))
+
+no_shift = mx.zeros((1, 1, 1))
+frame_shift = mx.array(np.random.uniform(0, 300, (T, 1, 1)).astype(np.float32))
+valid_shift = torch.tensor(np.array(frame_shift[:, :, 0])) * (torch.arange(T)[:, None] < input_lengths[None, :].long())
+
+low_logits = logits.detach().clone()
+low_logits[T // 4, 0, 1:] = low_logits[T // 4, 0, 0] - 200
+ref_low = torch.nn.functional.ctc_loss(
+  low_logits.log_softmax(dim = -1), targets, input_lengths, target_lengths, blank=0, reduction='none',
+)
+
+# Fallbacks are counted only when instrumentation is compiled in
+try:
+  mlx_ctc.set_stats_enabled(True)
+  lin_stats = True
+except RuntimeError:
+  lin_stats = False
+
+with mx.stream(mx.cpu):
+  for name, p, shift, ref in (
+    ('Linear', mx_logits, no_shift, ref_ctc.detach()),
+    ('Linear shifted', mx_logits, frame_shift, ref_ctc.detach() + valid_shift.sum(dim = 0)),
+    ('Linear fallback', mx.array(low_logits), no_shift, ref_low.detach()),
+  ):
+    for K in (0, 7):
+      (_, log_loss), log_grad = mx_lin_grad(checkpoint_interval=K)(p, mx_targets, mx_input_lengths, mx_target_lengths, shift)
+      mx.eval(log_loss, log_grad)
+      if lin_stats: mlx_ctc.reset_stats()
+      (_, lin_loss), lin_grad = mx_lin_grad(checkpoint_interval=K, linear_space=True)(p, mx_targets, mx_input_lengths, mx_target_lengths, shift)
+      mx.eval(lin_loss, lin_grad)
+      print(name, 'checkpoint', K, 'torch loss diff', torch.sub(ref, torch.tensor(np.array(lin_loss))).abs().div(ref.abs().max()).max().item())
+      print(name, 'checkpoint', K, 'log-space loss diff', (mx.abs(lin_loss - log_loss).max() / mx.abs(log_loss).max()).item())
+      print(name, 'checkpoint', K, 'log-space grad diff', (mx.abs(lin_grad - log_grad).max() / mx.abs(log_grad).max()).item())
+      if lin_stats: print(name, 'checkpoint', K, 'fallbacks', mlx_ctc.get_stats()['linear_fallbacks'])
+      if shift is no_shift and p is mx_logits:
+        print(name, 'checkpoint', K, 'torch grad diff', torch.sub(ref_sum_grad, torch.tensor(np.array(lin_grad))).abs().div(ref_sum_grad.abs().max()).max().item())
+
+mlx_ctc.set_stats_enabled(False)
+
+# 10. Verify alpha checkpointing (CPU only): intervals dividing input length and not, `sqrt(T)`,
+#     and intervals derived from memory budget, give the same loss and gradient as the full lattice
+
+mx_ckpt_grad = lambda **kw: mx.value_and_grad(lambda p,t,i,l: (
+  (x := mlx_ctc.ctc_loss(mn.log_softmax(p, -1),t,i,l,**kw)).sum(), x
+))
+
+row_bytes = B * (2 * t + 2) * 4
+
+with mx.stream(mx.cpu):
+  (_, full_loss), full_grad = mx_ckpt_grad()(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
+  mx.eval(full_loss, full_grad)
+  for name, kw in (
+    ('interval 8', dict(checkpoint_interval=8)),
+    ('interval 16', dict(checkpoint_interval=16)),
+    ('interval 3', dict(checkpoint_interval=3)),
+    ('interval 7', dict(checkpoint_interval=7)),
+    ('interval 100', dict(checkpoint_interval=100)),
+    ('interval sqrt(T)', dict(checkpoint_interval=-1)),
+    ('budget of 16 rows', dict(memory_budget=16 * row_bytes)),
+    ('budget of 10 rows', dict(memory_budget=10 * row_bytes)),
+  ):
+    (_, ckpt_loss), ckpt_grad = mx_ckpt_grad(**kw)(mx_logits, mx_targets, mx_input_lengths, mx_target_lengths)
+    mx.eval(ckpt_loss, ckpt_grad)
+    print('Checkpoint', name, 'loss equal', mx.array_equal(ckpt_loss, full_loss).item(),
+      'grad equal', mx.array_equal(ckpt_grad, full_grad).item(),
+      'grad diff', (mx.abs(ckpt_grad - full_grad).max() / mx.abs(full_grad).max()).item())